@@ -0,0 +1,72 @@
+#include "Compiler.hpp"
+#include "Vm.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string_view>
+
+
+namespace
+{
+    // Recursive fib is almost nothing but calls and returns; the loop calls a small leaf function.
+    constexpr std::string_view script = R"===(fun fib(n)
+{
+    if (n < 2) return n;
+    return fib(n - 1) + fib(n - 2);
+}
+var result = fib(25);
+
+fun add(a, b) { return a + b; }
+var sum = 0;
+for (var i = 0; i < 1000000; i = i + 1)
+{
+    sum = add(sum, i);
+}
+        )===";
+
+    constexpr auto runs = 10;
+
+    auto measure(Optimization optimization, std::string_view name) -> bool
+    {
+        auto best = std::chrono::nanoseconds::max();
+
+        for (auto run = 0; run < runs; run++)
+        {
+            Vm vm;
+            const auto chunk = Compiler{ script, vm.get_heap(), vm.get_globals() }.compile(Engine::Stack, optimization);
+            if (!chunk)
+            {
+                return false;
+            }
+
+            const auto start = std::chrono::steady_clock::now();
+            const auto result = vm.interpret(*chunk);
+            const auto elapsed = std::chrono::steady_clock::now() - start;
+
+            if (result != InterpretResult::Ok)
+            {
+                return false;
+            }
+
+            best = std::min(best, std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed));
+        }
+
+        std::cout << "calls/" << name << ": " << std::chrono::duration<double>(best).count() * 1000 << " ms (best of "
+                  << runs << ")\n";
+
+        return true;
+    }
+} // namespace
+
+
+int main()
+{
+    if (!measure(Optimization::None, "stack") || !measure(Optimization::Peephole, "stack-peephole"))
+    {
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
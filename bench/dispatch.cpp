@@ -0,0 +1,83 @@
+#include "Compiler.hpp"
+#include "Vm.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string_view>
+
+
+namespace
+{
+    // The for/while loops from main.cpp, with more iterations and accumulating instead of printing.
+    constexpr std::string_view script = R"===(var sum = 0;
+for(var i = 0; i < 1000000; i=i+1)
+{
+    sum = sum + i;
+}
+var b = 0;
+while(b < 1000000)
+{
+    sum = sum + b;
+    b = b + 1;
+}
+        )===";
+
+#if defined(AXOLOTL_THREADED_DISPATCH)
+    constexpr std::string_view dispatch_name = "threaded";
+#else
+    constexpr std::string_view dispatch_name = "switch";
+#endif
+
+    constexpr auto runs = 10;
+
+    auto measure(Engine engine, Optimization optimization, std::string_view engine_name) -> bool
+    {
+        auto best = std::chrono::nanoseconds::max();
+        std::uint64_t instructions = 0;
+
+        for (auto run = 0; run < runs; run++)
+        {
+            Vm vm;
+            const auto chunk = Compiler{ script, vm.get_heap(), vm.get_globals() }.compile(engine, optimization);
+            if (!chunk)
+            {
+                return false;
+            }
+
+            const auto start = std::chrono::steady_clock::now();
+            const auto result = vm.interpret(*chunk);
+            const auto elapsed = std::chrono::steady_clock::now() - start;
+
+            if (result != InterpretResult::Ok)
+            {
+                return false;
+            }
+
+            best = std::min(best, std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed));
+            instructions = vm.get_instruction_count();
+        }
+
+        const auto seconds = std::chrono::duration<double>(best).count();
+        std::cout << dispatch_name << '/' << engine_name << ": " << instructions << " instructions in "
+                  << seconds * 1000 << " ms (best of " << runs << "), "
+                  << static_cast<double>(instructions) / seconds / 1e6 << " M instructions/s\n";
+
+        return true;
+    }
+} // namespace
+
+
+int main()
+{
+    if (!measure(Engine::Stack, Optimization::None, "stack")
+        || !measure(Engine::Stack, Optimization::Peephole, "stack-peephole")
+        || !measure(Engine::Stack, Optimization::Ast, "stack-ast")
+        || !measure(Engine::Register, Optimization::None, "register"))
+    {
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
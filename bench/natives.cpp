@@ -0,0 +1,92 @@
+#include "Compiler.hpp"
+#include "Vm.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <string_view>
+
+
+namespace
+{
+    // The same loop calling a small math helper, either written in the script or bound from C++, and a
+    // native string helper.
+    constexpr std::string_view scripted_helper = R"===(fun norm2(x, y) { return x * x + y * y; }
+)===";
+
+    constexpr std::string_view script = R"===(var sum = 0;
+for (var i = 0; i < 1000000; i = i + 1)
+{
+    sum = sum + norm2(i, 1);
+}
+var text = "";
+for (var j = 0; j < 2000; j = j + 1)
+{
+    text = join(text, "x");
+}
+        )===";
+
+    constexpr auto runs = 10;
+
+    auto norm2(Number x, Number y) noexcept -> Number
+    {
+        return x * x + y * y;
+    }
+
+    auto join(Heap& heap, const ObjString* lhs, const ObjString* rhs) -> ObjString*
+    {
+        return heap.concatenate(lhs->view(), rhs->view());
+    }
+
+    auto measure(bool native_math, std::string_view name) -> bool
+    {
+        const auto source = native_math ? std::string{ script }
+                                        : std::string{ scripted_helper } + std::string{ script };
+        auto best = std::chrono::nanoseconds::max();
+
+        for (auto run = 0; run < runs; run++)
+        {
+            Vm vm;
+            vm.define_native<&join>("join");
+            if (native_math)
+            {
+                vm.define_native<&norm2>("norm2");
+            }
+
+            const auto chunk = Compiler{ source, vm.get_heap(), vm.get_globals() }.compile();
+            if (!chunk)
+            {
+                return false;
+            }
+
+            const auto start = std::chrono::steady_clock::now();
+            const auto result = vm.interpret(*chunk);
+            const auto elapsed = std::chrono::steady_clock::now() - start;
+
+            if (result != InterpretResult::Ok)
+            {
+                return false;
+            }
+
+            best = std::min(best, std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed));
+        }
+
+        std::cout << "natives/" << name << ": " << std::chrono::duration<double>(best).count() * 1000 << " ms (best of "
+                  << runs << ")\n";
+
+        return true;
+    }
+} // namespace
+
+
+int main()
+{
+    if (!measure(false, "scripted-math") || !measure(true, "native-math"))
+    {
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
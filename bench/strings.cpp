@@ -0,0 +1,78 @@
+#include "Compiler.hpp"
+#include "Vm.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string_view>
+
+
+namespace
+{
+    // Strings moving through locals, globals, equality tests and conditional jumps, plus concatenations
+    // that mostly find their result already interned and one that keeps growing.
+    constexpr std::string_view script = R"===(var greeting = "hello";
+var matches = 0;
+for (var i = 0; i < 200000; i = i + 1)
+{
+    var word = "ab";
+    var pair = word + word;
+    if (pair == "abab" and word != pair) matches = matches + 1;
+    var sentence = greeting + " " + word;
+    if (!(sentence == "hello ab")) matches = matches - 1;
+    greeting = greeting;
+}
+var text = "";
+for (var j = 0; j < 2000; j = j + 1)
+{
+    text = text + "x";
+}
+        )===";
+
+    constexpr auto runs = 10;
+
+    auto measure(Engine engine, Optimization optimization, std::string_view engine_name) -> bool
+    {
+        auto best = std::chrono::nanoseconds::max();
+
+        for (auto run = 0; run < runs; run++)
+        {
+            Vm vm;
+            const auto chunk = Compiler{ script, vm.get_heap(), vm.get_globals() }.compile(engine, optimization);
+            if (!chunk)
+            {
+                return false;
+            }
+
+            const auto start = std::chrono::steady_clock::now();
+            const auto result = vm.interpret(*chunk);
+            const auto elapsed = std::chrono::steady_clock::now() - start;
+
+            if (result != InterpretResult::Ok)
+            {
+                return false;
+            }
+
+            best = std::min(best, std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed));
+        }
+
+        std::cout << "strings/" << engine_name << ": " << std::chrono::duration<double>(best).count() * 1000
+                  << " ms (best of " << runs << ")\n";
+
+        return true;
+    }
+} // namespace
+
+
+int main()
+{
+    if (!measure(Engine::Stack, Optimization::None, "stack")
+        || !measure(Engine::Stack, Optimization::Ast, "stack-ast")
+        || !measure(Engine::Register, Optimization::None, "register"))
+    {
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,194 @@
+#include "Memory.hpp"
+#include "Table.hpp"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+
+namespace
+{
+    // Identifier-shaped names: a handful of short common words, then numbered variants like a generated
+    // program or a large script would have.
+    constexpr std::array<std::string_view, 16> stems{ "i",     "n",   "sum",    "count", "index", "value",
+                                                      "total", "tmp", "result", "left",  "right", "node",
+                                                      "next",  "key", "buffer", "print_line" };
+
+    constexpr std::array<std::size_t, 3> key_counts{ 16, 256, 4096 };
+    constexpr std::array<double, 3> max_loads{ 0.5, 0.75, 0.9 };
+    constexpr auto lookups = std::size_t{ 1 } << 22;
+    constexpr auto runs = 5;
+
+    // Written once per measurement so the lookups cannot be optimised away.
+    volatile std::size_t sink = 0;
+
+    auto make_names(std::size_t count, std::string_view suffix) -> std::vector<std::string>
+    {
+        std::vector<std::string> names;
+        names.reserve(count);
+        for (std::size_t index = 0; names.size() < count; index++)
+        {
+            auto name = std::string{ stems[index % stems.size()] };
+            if (index >= stems.size())
+            {
+                name += '_' + std::to_string(index / stems.size());
+            }
+            names.push_back(name + std::string{ suffix });
+        }
+        return names;
+    }
+
+    struct Keys
+    {
+        std::vector<std::string> names;
+        std::vector<ObjString*> present;
+        // Interned but never inserted: what a lookup of a local or a not yet defined global looks like.
+        std::vector<ObjString*> absent;
+        // Indices into present/absent, shuffled so that no container gets a free ride from insertion order.
+        std::vector<std::size_t> probes;
+    };
+
+    auto make_keys(Heap& heap, Keys& keys, std::size_t count) -> void
+    {
+        keys.names = make_names(count, "");
+        for (const auto& name : keys.names)
+        {
+            keys.present.push_back(heap.make_string(name));
+        }
+        for (const auto& name : make_names(count, "_"))
+        {
+            keys.absent.push_back(heap.make_string(name));
+        }
+
+        std::mt19937 random{ 42 };
+        keys.probes.resize(lookups);
+        std::ranges::generate(keys.probes, [&random, count] { return random() % count; });
+    }
+
+    struct CachedHash
+    {
+        auto operator()(const ObjString* string) const noexcept -> std::size_t
+        {
+            return string->get_hash();
+        }
+    };
+
+    // Runs `lookup` over every probe and returns the best time per lookup in nanoseconds.
+    template <typename F>
+    auto time_lookups(const Keys& keys, F lookup) -> double
+    {
+        auto best = std::chrono::nanoseconds::max();
+        std::size_t checksum = 0;
+        for (auto run = 0; run < runs; run++)
+        {
+            const auto start = std::chrono::steady_clock::now();
+            for (const auto index : keys.probes)
+            {
+                checksum += lookup(index);
+            }
+            const auto elapsed = std::chrono::steady_clock::now() - start;
+            best = std::min(best, std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed));
+        }
+
+        sink = checksum;
+        return static_cast<double>(best.count()) / static_cast<double>(keys.probes.size());
+    }
+
+    auto report(std::string_view name, std::string_view lookup, double nanoseconds) -> void
+    {
+        std::cout << "  " << name << ' ' << lookup << ": " << nanoseconds << " ns\n";
+    }
+
+    // Pointer lookups, hit and miss: what the compiler's global resolution and late-bound accesses do.
+    template <typename Container, typename Find>
+    auto measure_pointers(std::string_view name, const Keys& keys, const Container& container, Find find) -> void
+    {
+        report(name, "hit", time_lookups(keys, [&](std::size_t index) { return find(container, keys.present[index]); }));
+        report(name, "miss", time_lookups(keys, [&](std::size_t index) { return find(container, keys.absent[index]); }));
+    }
+
+    auto measure(const Keys& keys) -> void
+    {
+        const auto count = keys.present.size();
+        std::cout << count << " keys\n";
+
+        std::map<ObjString*, std::size_t> tree;
+        std::unordered_map<ObjString*, std::size_t, CachedHash> buckets;
+        for (std::size_t slot = 0; slot < count; slot++)
+        {
+            tree.emplace(keys.present[slot], slot);
+            buckets.emplace(keys.present[slot], slot);
+        }
+
+        const auto find_std = [](const auto& container, ObjString* key) -> std::size_t
+        {
+            const auto found = container.find(key);
+            return found != container.end() ? found->second : 0;
+        };
+        measure_pointers("std::map", keys, tree, find_std);
+        measure_pointers("std::unordered_map", keys, buckets, find_std);
+
+        for (const auto max_load : max_loads)
+        {
+            Table<std::size_t> table{ max_load };
+            for (std::size_t slot = 0; slot < count; slot++)
+            {
+                table.try_emplace(keys.present[slot], slot);
+            }
+
+            const auto name = "Table@" + std::to_string(max_load).substr(0, 4);
+            measure_pointers(name, keys, table,
+                             [](const Table<std::size_t>& container, ObjString* key) -> std::size_t
+                             {
+                                 const auto* found = container.find(key);
+                                 return found != nullptr ? *found : 0;
+                             });
+
+            // Interning: the same names looked up by contents, as the compiler hands them to make_string.
+            report(name, "intern",
+                   time_lookups(keys,
+                                [&](std::size_t index) -> std::size_t
+                                {
+                                    const std::string_view chars = keys.names[index];
+                                    return table.find_string(chars, ObjString::hash_string(chars)) != nullptr;
+                                }));
+        }
+    }
+} // namespace
+
+
+int main()
+{
+    for (const auto count : key_counts)
+    {
+        Heap heap{ GcConfig{ .initial_threshold = std::size_t{ 1 } << 30 } };
+        Keys keys;
+        const auto roots = heap.add_roots(
+        [&keys](Heap& marker)
+        {
+            for (auto* key : keys.present)
+            {
+                marker.mark_object(key);
+            }
+            for (auto* key : keys.absent)
+            {
+                marker.mark_object(key);
+            }
+        });
+
+        make_keys(heap, keys, count);
+        measure(keys);
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,336 @@
+#pragma once
+
+#include "Scanner.hpp"
+#include "Value.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <new>
+#include <span>
+#include <type_traits>
+#include <utility>
+
+// Syntax tree that AstCompiler builds between parsing and emission when asked for Optimization::Ast.
+// Variables are resolved while parsing, by the same rules Compiler applies, so the tree already says
+// which slot every access uses.
+namespace ast
+{
+    // Bump allocator for the nodes of one compile. Nodes are never freed one by one: the whole tree
+    // goes away with the arena, so they must not own anything.
+    class Arena
+    {
+    public:
+        template <typename T, typename... Args>
+        auto make(Args&&... args) -> T*
+        {
+            static_assert(std::is_trivially_destructible_v<T>);
+            return ::new (resource.allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+        }
+
+        // Room for `count` values of a trivial type, left uninitialized.
+        template <typename T>
+        auto make_array(std::size_t count) -> std::span<T>
+        {
+            static_assert(std::is_trivial_v<T>);
+            return { static_cast<T*>(resource.allocate(sizeof(T) * count, alignof(T))), count };
+        }
+
+    private:
+        static constexpr std::size_t initial_size = 16 * 1024;
+
+        std::pmr::monotonic_buffer_resource resource{ initial_size };
+    };
+
+    // Where a variable lives: a stack slot, an upvalue of the enclosing closure, a global slot, or a global
+    // looked up by name at runtime.
+    struct Binding
+    {
+        enum class Kind : std::uint8_t
+        {
+            Local,
+            Upvalue,
+            GlobalSlot,
+            Global,
+        };
+
+        Kind kind = Kind::Global;
+        std::size_t index = 0;
+
+        auto operator==(const Binding& other) const -> bool = default;
+    };
+
+    enum class ExprKind : std::uint8_t
+    {
+        Literal,
+        Variable,
+        Assign,
+        Unary,
+        Binary,
+        Logical,
+        Shared,
+        Call,
+    };
+
+    // `line` is the line of the last token of the expression, where Compiler would emit its instruction.
+    struct Expr
+    {
+        ExprKind kind;
+        std::size_t line;
+    };
+
+    struct Literal : Expr
+    {
+        static constexpr auto tag = ExprKind::Literal;
+
+        Literal(std::size_t line, const Value& value) : Expr{ tag, line }, value{ value }
+        {
+        }
+
+        Value value;
+    };
+
+    struct Variable : Expr
+    {
+        static constexpr auto tag = ExprKind::Variable;
+
+        Variable(std::size_t line, const Token& name, Binding binding)
+        : Expr{ tag, line }, name{ name }, binding{ binding }
+        {
+        }
+
+        Token name;
+        Binding binding;
+    };
+
+    struct Assign : Expr
+    {
+        static constexpr auto tag = ExprKind::Assign;
+
+        Assign(std::size_t line, const Token& name, Binding binding, Expr* value)
+        : Expr{ tag, line }, name{ name }, binding{ binding }, value{ value }
+        {
+        }
+
+        Token name;
+        Binding binding;
+        Expr* value;
+    };
+
+    struct Unary : Expr
+    {
+        static constexpr auto tag = ExprKind::Unary;
+
+        Unary(std::size_t line, TokenType op, Expr* operand) : Expr{ tag, line }, op{ op }, operand{ operand }
+        {
+        }
+
+        TokenType op;
+        Expr* operand;
+    };
+
+    struct Binary : Expr
+    {
+        static constexpr auto tag = ExprKind::Binary;
+
+        Binary(std::size_t line, TokenType op, Expr* lhs, Expr* rhs)
+        : Expr{ tag, line }, op{ op }, lhs{ lhs }, rhs{ rhs }
+        {
+        }
+
+        TokenType op;
+        Expr* lhs;
+        Expr* rhs;
+    };
+
+    // `and` / `or`: the right operand only runs when the left one does not decide the result.
+    struct Logical : Expr
+    {
+        static constexpr auto tag = ExprKind::Logical;
+
+        Logical(std::size_t line, TokenType op, Expr* lhs, Expr* rhs)
+        : Expr{ tag, line }, op{ op }, lhs{ lhs }, rhs{ rhs }
+        {
+        }
+
+        TokenType op;
+        Expr* lhs;
+        Expr* rhs;
+    };
+
+    // Produced by common subexpression elimination: evaluates `value` and also leaves a copy in the
+    // statement's temporary `slot`, where the later occurrences read it as a local.
+    struct Shared : Expr
+    {
+        static constexpr auto tag = ExprKind::Shared;
+
+        Shared(std::size_t line, std::size_t slot, Expr* value) : Expr{ tag, line }, slot{ slot }, value{ value }
+        {
+        }
+
+        std::size_t slot;
+        Expr* value;
+    };
+
+    struct Call : Expr
+    {
+        static constexpr auto tag = ExprKind::Call;
+
+        Call(std::size_t line, Expr* callee, std::span<Expr*> arguments)
+        : Expr{ tag, line }, callee{ callee }, arguments{ arguments }
+        {
+        }
+
+        Expr* callee;
+        std::span<Expr*> arguments;
+    };
+
+    enum class StmtKind : std::uint8_t
+    {
+        Print,
+        Expression,
+        Var,
+        Block,
+        If,
+        While,
+        Function,
+        Return,
+    };
+
+    // Statements of a block are chained through `next`.
+    struct Stmt
+    {
+        StmtKind kind;
+        std::size_t line;
+        Stmt* next = nullptr;
+    };
+
+    // The statements whose expression runs with nothing else on the stack above the locals, so that
+    // common subexpressions can be kept in temporaries pushed there: `temporaries` of them, starting at
+    // slot `first_temporary`.
+    struct ExprStmt : Stmt
+    {
+        ExprStmt(StmtKind kind, std::size_t line, Expr* value, std::size_t first_temporary)
+        : Stmt{ kind, line }, value{ value }, first_temporary{ first_temporary }
+        {
+        }
+
+        Expr* value;
+        std::size_t first_temporary;
+        std::size_t temporaries = 0;
+    };
+
+    struct Print : ExprStmt
+    {
+        static constexpr auto tag = StmtKind::Print;
+
+        Print(std::size_t line, Expr* value, std::size_t first_temporary)
+        : ExprStmt{ tag, line, value, first_temporary }
+        {
+        }
+    };
+
+    struct Expression : ExprStmt
+    {
+        static constexpr auto tag = StmtKind::Expression;
+
+        Expression(std::size_t line, Expr* value, std::size_t first_temporary)
+        : ExprStmt{ tag, line, value, first_temporary }
+        {
+        }
+    };
+
+    // `binding` is the new local's slot or the global's slot, whatever its size.
+    struct Var : ExprStmt
+    {
+        static constexpr auto tag = StmtKind::Var;
+
+        Var(std::size_t line, Binding binding, Expr* value, std::size_t first_temporary)
+        : ExprStmt{ tag, line, value, first_temporary }, binding{ binding }
+        {
+        }
+
+        Binding binding;
+        // Whether a closure captures the local, which then has to be closed rather than popped.
+        bool captured = false;
+    };
+
+    struct Block : Stmt
+    {
+        static constexpr auto tag = StmtKind::Block;
+
+        Block(std::size_t line, Stmt* body) : Stmt{ tag, line }, body{ body }
+        {
+        }
+
+        Stmt* body;
+    };
+
+    // Either branch may be missing once the optimizer has removed it.
+    struct If : Stmt
+    {
+        static constexpr auto tag = StmtKind::If;
+
+        If(std::size_t line, Expr* condition, Stmt* then_branch, Stmt* else_branch)
+        : Stmt{ tag, line }, condition{ condition }, then_branch{ then_branch }, else_branch{ else_branch }
+        {
+        }
+
+        Expr* condition;
+        Stmt* then_branch;
+        Stmt* else_branch;
+    };
+
+    // Both `while` and `for` loops: `increment` runs after each iteration of the body. A loop without
+    // a condition never exits.
+    struct While : Stmt
+    {
+        static constexpr auto tag = StmtKind::While;
+
+        While(std::size_t line, Expr* condition, Stmt* body, Expr* increment)
+        : Stmt{ tag, line }, condition{ condition }, body{ body }, increment{ increment }
+        {
+        }
+
+        Expr* condition;
+        Stmt* body;
+        Expr* increment;
+    };
+
+    // A function declaration. Its code, arity and upvalues are in the `function`th entry of the compiler's
+    // table of functions; `body` runs with the parameters in slots 1 to arity.
+    struct Function : Stmt
+    {
+        static constexpr auto tag = StmtKind::Function;
+
+        Function(std::size_t line, Binding binding, std::size_t function)
+        : Stmt{ tag, line }, binding{ binding }, function{ function }
+        {
+        }
+
+        Binding binding;
+        std::size_t function;
+        Stmt* body = nullptr;
+        // As for Var.
+        bool captured = false;
+    };
+
+    // `value` is missing for a bare `return;`, which returns nil.
+    struct Return : Stmt
+    {
+        static constexpr auto tag = StmtKind::Return;
+
+        Return(std::size_t line, Expr* value) : Stmt{ tag, line }, value{ value }
+        {
+        }
+
+        Expr* value;
+    };
+
+    // Checked downcast by the node's tag.
+    template <typename T, typename Node>
+    [[nodiscard]] auto as(Node* node) noexcept -> T*
+    {
+        return node != nullptr && node->kind == T::tag ? static_cast<T*>(node) : nullptr;
+    }
+} // namespace ast
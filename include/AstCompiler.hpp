@@ -0,0 +1,1271 @@
+#pragma once
+
+#include "Ast.hpp"
+#include "AstOptimizer.hpp"
+#include "Chunk.hpp"
+#include "Debug.hpp"
+#include "Globals.hpp"
+#include "Memory.hpp"
+#include "Parser.hpp"
+#include "Peephole.hpp"
+#include "Value.hpp"
+
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <optional>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Stack code generator for Optimization::Ast. The whole script is parsed into an ast tree first, the
+// AstOptimizer passes run over it, and only then is code emitted, superinstructions included, before
+// the Peephole passes finish each chunk: the script's and one per function. Resolution and errors
+// follow Compiler.
+class AstCompiler
+{
+public:
+    AstCompiler(std::string_view source, Heap& heap, Globals& globals)
+    : parser{ source }, heap{ heap }, globals{ globals }
+    {
+    }
+
+    std::optional<Chunk> compile()
+    {
+        // String literals are only reachable through the tree until they become constants of the chunks.
+        const auto roots = heap.add_roots(
+        [this](Heap& gc)
+        {
+            for (const auto& literal : literals)
+            {
+                gc.mark_value(literal);
+            }
+            for (const auto& constant : chunk.get_constants())
+            {
+                gc.mark_value(constant);
+            }
+            for (const auto& function : functions)
+            {
+                for (const auto& constant : function.chunk().get_constants())
+                {
+                    gc.mark_value(constant);
+                }
+            }
+        });
+
+        parser.advance();
+
+        ast::Stmt* program = nullptr;
+        auto** link = &program;
+        while (!parser.match(TokenType::Eof))
+        {
+            *link = declaration();
+            link = &(*link)->next;
+        }
+
+        if (!parser.had_error)
+        {
+            emit_statements(optimizer.run(program));
+        }
+
+        end_compiler();
+
+        if (parser.had_error)
+        {
+            return std::nullopt;
+        }
+
+        return chunk;
+    }
+
+    [[nodiscard]] auto get_stats() const noexcept -> const AstStats&
+    {
+        return optimizer.get_stats();
+    }
+
+    [[nodiscard]] auto get_peephole_stats() const noexcept -> const PeepholeStats&
+    {
+        return peephole_stats;
+    }
+
+private:
+    using PrefixFn = ast::Expr* (AstCompiler::*)(bool);
+    using InfixFn = ast::Expr* (AstCompiler::*)(ast::Expr*, bool);
+
+    struct Rule
+    {
+        PrefixFn prefix;
+        InfixFn infix;
+        Precedence precedence;
+    };
+
+    struct Local
+    {
+        std::string_view name;
+        int depth = -1;
+        // Where the declaration records that a closure captures the local; nothing for parameters, which
+        // are never popped.
+        bool* captured = nullptr;
+    };
+
+    // What is put aside while a nested function is parsed.
+    struct EnclosingFunction
+    {
+        std::vector<Local> locals;
+        std::size_t scope_depth;
+        std::size_t function;
+    };
+
+    // Parsing.
+
+    auto declaration() -> ast::Stmt*
+    {
+        auto* stmt = parser.match(TokenType::FUN)   ? fun_declaration()
+                     : parser.match(TokenType::VAR) ? var_declaration()
+                                                    : statement();
+
+        if (parser.panic_mode)
+        {
+            parser.synchronize();
+        }
+
+        return stmt;
+    }
+
+    auto statement() -> ast::Stmt*
+    {
+        if (parser.match(TokenType::PRINT))
+        {
+            return print_statement();
+        }
+        if (parser.match(TokenType::RETURN))
+        {
+            return return_statement();
+        }
+        if (parser.match(TokenType::FOR))
+        {
+            return for_statement();
+        }
+        if (parser.match(TokenType::IF))
+        {
+            return if_statement();
+        }
+        if (parser.match(TokenType::WHILE))
+        {
+            return while_statement();
+        }
+        if (parser.match(TokenType::LEFT_BRACE))
+        {
+            begin_scope();
+            auto* body = block();
+            end_scope();
+            return arena.make<ast::Block>(parser.previous.get_line(), body);
+        }
+        return expression_statement();
+    }
+
+    auto block() -> ast::Stmt*
+    {
+        ast::Stmt* body = nullptr;
+        auto** link = &body;
+        while (!parser.check(TokenType::RIGHT_BRACE) && !parser.check(TokenType::Eof))
+        {
+            *link = declaration();
+            link = &(*link)->next;
+        }
+
+        parser.consume(TokenType::RIGHT_BRACE, "Expect '}' after block.");
+        return body;
+    }
+
+    auto var_declaration() -> ast::Stmt*
+    {
+        parser.consume(TokenType::IDENTIFIER, "Expect variable name.");
+        const auto name = parser.previous;
+        const auto first_temporary = locals.size();
+
+        if (scope_depth == 0)
+        {
+            auto* global_name = heap.make_string(name.get_lexme());
+            heap.write_barrier(values::make(global_name));
+            const auto global = globals.declare(global_name);
+
+            auto* value = parser.match(TokenType::EQUAL) ? expression() : nullptr;
+            parser.consume(TokenType::SEMICOLON, "Expect ';' after variable declaration.");
+
+            mark_global_defined(global);
+
+            const ast::Binding binding{ .kind = ast::Binding::Kind::GlobalSlot, .index = global };
+            return arena.make<ast::Var>(parser.previous.get_line(), binding, value, first_temporary);
+        }
+
+        declare_local(name);
+        auto* value = parser.match(TokenType::EQUAL) ? expression() : nullptr;
+        parser.consume(TokenType::SEMICOLON, "Expect ';' after variable declaration.");
+
+        const ast::Binding binding{ .kind = ast::Binding::Kind::Local, .index = locals.size() - 1 };
+        auto* var = arena.make<ast::Var>(parser.previous.get_line(), binding, value, first_temporary);
+        locals.back().depth = static_cast<int>(scope_depth);
+        locals.back().captured = &var->captured;
+        return var;
+    }
+
+    auto fun_declaration() -> ast::Stmt*
+    {
+        parser.consume(TokenType::IDENTIFIER, "Expect function name.");
+        const auto name = parser.previous;
+
+        // The body may refer to the function itself: it can only run once the declaration has.
+        auto binding = ast::Binding{ .kind = ast::Binding::Kind::Local };
+        if (scope_depth == 0)
+        {
+            auto* global_name = heap.make_string(name.get_lexme());
+            heap.write_barrier(values::make(global_name));
+            binding = { .kind = ast::Binding::Kind::GlobalSlot, .index = globals.declare(global_name) };
+            mark_global_defined(binding.index);
+        }
+        else
+        {
+            declare_local(name);
+            binding.index = locals.size() - 1;
+        }
+
+        auto* declaration = arena.make<ast::Function>(name.get_line(), binding, functions.size());
+        if (binding.kind == ast::Binding::Kind::Local)
+        {
+            locals.back().depth = static_cast<int>(scope_depth);
+            locals.back().captured = &declaration->captured;
+        }
+
+        begin_function(name);
+        begin_scope();
+
+        parser.consume(TokenType::LEFT_PAREN, "Expect '(' after function name.");
+        if (!parser.check(TokenType::RIGHT_PAREN))
+        {
+            do
+            {
+                auto& parsed = functions[current_function];
+                parsed.set_arity(parsed.get_arity() + 1);
+                if (parsed.get_arity() > max_arguments)
+                {
+                    parser.error_at_current("Can't have more than 255 parameters.");
+                }
+
+                parser.consume(TokenType::IDENTIFIER, "Expect parameter name.");
+                declare_local(parser.previous);
+                locals.back().depth = static_cast<int>(scope_depth);
+            } while (parser.match(TokenType::COMMA));
+        }
+        parser.consume(TokenType::RIGHT_PAREN, "Expect ')' after parameters.");
+        parser.consume(TokenType::LEFT_BRACE, "Expect '{' before function body.");
+        declaration->body = block();
+        declaration->line = parser.previous.get_line();
+
+        // No end_scope: returning discards the whole frame.
+        end_function();
+        return declaration;
+    }
+
+    // Starts a new entry of `functions` for the declaration of `name`, whose body is parsed next. Slot 0 of
+    // its frame holds the function being called.
+    auto begin_function(const Token& name) -> void
+    {
+        enclosing.push_back(
+        EnclosingFunction{ .locals = std::move(locals), .scope_depth = scope_depth, .function = current_function });
+        locals = { Local{ .name = {}, .depth = 0 } };
+        scope_depth = 0;
+        current_function = functions.size();
+        functions.emplace_back().set_name(std::string{ name.get_lexme() });
+    }
+
+    auto end_function() -> void
+    {
+        auto outer = std::move(enclosing.back());
+        enclosing.pop_back();
+        locals = std::move(outer.locals);
+        scope_depth = outer.scope_depth;
+        current_function = outer.function;
+    }
+
+    auto return_statement() -> ast::Stmt*
+    {
+        if (current_function == no_function)
+        {
+            parser.error("Can't return from top-level code.");
+        }
+
+        ast::Expr* value = nullptr;
+        if (!parser.match(TokenType::SEMICOLON))
+        {
+            value = expression();
+            parser.consume(TokenType::SEMICOLON, "Expect ';' after return value.");
+        }
+        return arena.make<ast::Return>(parser.previous.get_line(), value);
+    }
+
+    auto print_statement() -> ast::Stmt*
+    {
+        auto* value = expression();
+        parser.consume(TokenType::SEMICOLON, "Expect ';' after value.");
+        return arena.make<ast::Print>(parser.previous.get_line(), value, locals.size());
+    }
+
+    auto expression_statement() -> ast::Stmt*
+    {
+        auto* value = expression();
+        parser.consume(TokenType::SEMICOLON, "Expect ';' after expression.");
+        return arena.make<ast::Expression>(parser.previous.get_line(), value, locals.size());
+    }
+
+    auto if_statement() -> ast::Stmt*
+    {
+        parser.consume(TokenType::LEFT_PAREN, "Expect '(' after 'if'.");
+        auto* condition = expression();
+        parser.consume(TokenType::RIGHT_PAREN, "Expect ')' after condition.");
+        const auto line = parser.previous.get_line();
+
+        auto* then_branch = statement();
+        auto* else_branch = parser.match(TokenType::ELSE) ? statement() : nullptr;
+        return arena.make<ast::If>(line, condition, then_branch, else_branch);
+    }
+
+    auto while_statement() -> ast::Stmt*
+    {
+        parser.consume(TokenType::LEFT_PAREN, "Expect '(' after 'while'.");
+        auto* condition = expression();
+        parser.consume(TokenType::RIGHT_PAREN, "Expect ')' after condition.");
+        const auto line = parser.previous.get_line();
+
+        return arena.make<ast::While>(line, condition, statement(), nullptr);
+    }
+
+    // A block holding the initializer and a loop that runs the increment after the body. Without
+    // `continue` nothing can skip the increment, so it needs no jump around it.
+    auto for_statement() -> ast::Stmt*
+    {
+        begin_scope();
+
+        parser.consume(TokenType::LEFT_PAREN, "Expect '(' after 'for'.");
+
+        ast::Stmt* initializer = nullptr;
+        if (parser.match(TokenType::SEMICOLON))
+        {
+        }
+        else if (parser.match(TokenType::VAR))
+        {
+            initializer = var_declaration();
+        }
+        else
+        {
+            initializer = expression_statement();
+        }
+
+        ast::Expr* condition = nullptr;
+        if (!parser.match(TokenType::SEMICOLON))
+        {
+            condition = expression();
+            parser.consume(TokenType::SEMICOLON, "Expect ';' after loop condition.");
+        }
+
+        ast::Expr* increment = nullptr;
+        if (!parser.match(TokenType::RIGHT_PAREN))
+        {
+            increment = expression();
+            parser.consume(TokenType::RIGHT_PAREN, "Expect ')' after for clauses.");
+        }
+
+        const auto line = parser.previous.get_line();
+        auto* loop = arena.make<ast::While>(line, condition, statement(), increment);
+
+        end_scope();
+
+        if (initializer == nullptr)
+        {
+            return arena.make<ast::Block>(line, loop);
+        }
+        initializer->next = loop;
+        return arena.make<ast::Block>(line, initializer);
+    }
+
+    auto expression() -> ast::Expr*
+    {
+        return parse_precedence(Precedence::ASSIGNMENT);
+    }
+
+    auto parse_precedence(Precedence precedence) -> ast::Expr*
+    {
+        parser.advance();
+        const auto prefix_rule = get_rule(parser.previous.get_type()).prefix;
+        if (prefix_rule == nullptr)
+        {
+            parser.error("Expected expression.");
+            return arena.make<ast::Literal>(parser.previous.get_line(), values::make(Nil{}));
+        }
+
+        const auto can_assign = precedence <= Precedence::ASSIGNMENT;
+        auto* expr = std::invoke(prefix_rule, this, can_assign);
+
+        while (precedence <= get_rule(parser.current.get_type()).precedence)
+        {
+            parser.advance();
+            const auto infix_rule = get_rule(parser.previous.get_type()).infix;
+            expr = std::invoke(infix_rule, this, expr, can_assign);
+        }
+
+        if (can_assign && parser.match(TokenType::EQUAL))
+        {
+            parser.error("Invalid assignment target.");
+        }
+
+        return expr;
+    }
+
+    auto number([[maybe_unused]] bool can_assign) -> ast::Expr*
+    {
+        Number value{};
+        std::from_chars(parser.previous.get_lexme().begin(), parser.previous.get_lexme().end(), value);
+        return arena.make<ast::Literal>(parser.previous.get_line(), values::make(value));
+    }
+
+    auto string([[maybe_unused]] bool can_assign) -> ast::Expr*
+    {
+        const auto lexme = parser.previous.get_lexme();
+        const auto value = values::make(heap.make_string(lexme.substr(1, lexme.size() - 2)));
+        literals.push_back(value);
+        return arena.make<ast::Literal>(parser.previous.get_line(), value);
+    }
+
+    auto literal([[maybe_unused]] bool can_assign) -> ast::Expr*
+    {
+        switch (parser.previous.get_type())
+        {
+        case TokenType::FALSE: return arena.make<ast::Literal>(parser.previous.get_line(), values::make(false));
+        case TokenType::TRUE: return arena.make<ast::Literal>(parser.previous.get_line(), values::make(true));
+        default: return arena.make<ast::Literal>(parser.previous.get_line(), values::make(Nil{}));
+        }
+    }
+
+    auto call(ast::Expr* callee, [[maybe_unused]] bool can_assign) -> ast::Expr*
+    {
+        std::vector<ast::Expr*> arguments;
+        if (!parser.check(TokenType::RIGHT_PAREN))
+        {
+            do
+            {
+                arguments.push_back(expression());
+                if (arguments.size() == max_arguments + 1)
+                {
+                    parser.error("Can't have more than 255 arguments.");
+                }
+            } while (parser.match(TokenType::COMMA));
+        }
+        parser.consume(TokenType::RIGHT_PAREN, "Expect ')' after arguments.");
+
+        const auto stored = arena.make_array<ast::Expr*>(arguments.size());
+        std::ranges::copy(arguments, stored.begin());
+        return arena.make<ast::Call>(parser.previous.get_line(), callee, stored);
+    }
+
+    auto grouping([[maybe_unused]] bool can_assign) -> ast::Expr*
+    {
+        auto* expr = expression();
+        parser.consume(TokenType::RIGHT_PAREN, "Expect ')' after expression.");
+        return expr;
+    }
+
+    auto variable(bool can_assign) -> ast::Expr*
+    {
+        const auto name = parser.previous;
+        const auto binding = resolve(name);
+
+        if (can_assign && parser.match(TokenType::EQUAL))
+        {
+            auto* value = expression();
+            return arena.make<ast::Assign>(parser.previous.get_line(), name, binding, value);
+        }
+
+        return arena.make<ast::Variable>(name.get_line(), name, binding);
+    }
+
+    auto unary([[maybe_unused]] bool can_assign) -> ast::Expr*
+    {
+        const auto operator_type = parser.previous.get_type();
+        auto* operand = parse_precedence(Precedence::UNARY);
+        return arena.make<ast::Unary>(parser.previous.get_line(), operator_type, operand);
+    }
+
+    auto binary(ast::Expr* lhs, [[maybe_unused]] bool can_assign) -> ast::Expr*
+    {
+        const auto operator_type = parser.previous.get_type();
+        auto* rhs = parse_precedence(next_precedence(get_rule(operator_type).precedence));
+        return arena.make<ast::Binary>(parser.previous.get_line(), operator_type, lhs, rhs);
+    }
+
+    auto and_(ast::Expr* lhs, [[maybe_unused]] bool can_assign) -> ast::Expr*
+    {
+        auto* rhs = parse_precedence(Precedence::AND);
+        return arena.make<ast::Logical>(parser.previous.get_line(), TokenType::AND, lhs, rhs);
+    }
+
+    auto or_(ast::Expr* lhs, [[maybe_unused]] bool can_assign) -> ast::Expr*
+    {
+        auto* rhs = parse_precedence(Precedence::OR);
+        return arena.make<ast::Logical>(parser.previous.get_line(), TokenType::OR, lhs, rhs);
+    }
+
+    auto resolve(const Token& name) -> ast::Binding
+    {
+        if (const auto local = resolve_local(name))
+        {
+            return { .kind = ast::Binding::Kind::Local, .index = *local };
+        }
+        if (const auto upvalue = resolve_upvalue(enclosing.size(), name))
+        {
+            return { .kind = ast::Binding::Kind::Upvalue, .index = *upvalue };
+        }
+        if (const auto slot = resolve_global(name))
+        {
+            return { .kind = ast::Binding::Kind::GlobalSlot, .index = *slot };
+        }
+        return { .kind = ast::Binding::Kind::Global };
+    }
+
+    // Same rule as the stack compiler: slots only for globals certain to be defined when this code runs.
+    [[nodiscard]] auto resolve_global(const Token& name) -> std::optional<std::size_t>
+    {
+        auto* const interned = heap.find_interned(name.get_lexme());
+        const auto slot = interned != nullptr ? globals.find(interned) : std::nullopt;
+        if (!slot || *slot > std::numeric_limits<std::uint16_t>::max())
+        {
+            return std::nullopt;
+        }
+
+        if (!globals.is_defined(*slot) && (*slot >= defined_globals.size() || !defined_globals[*slot]))
+        {
+            return std::nullopt;
+        }
+
+        return slot;
+    }
+
+    auto mark_global_defined(std::size_t global) -> void
+    {
+        if (global >= defined_globals.size())
+        {
+            defined_globals.resize(global + 1);
+        }
+        defined_globals[global] = true;
+    }
+
+    auto declare_local(const Token& name) -> void
+    {
+        for (auto local = locals.rbegin(); local != locals.rend(); ++local)
+        {
+            if (local->depth != -1 && local->depth < static_cast<int>(scope_depth))
+            {
+                break;
+            }
+
+            if (local->name == name.get_lexme())
+            {
+                parser.error("Already a variable with this name in this scope.");
+            }
+        }
+
+        if (locals.size() == max_locals)
+        {
+            parser.error("Too many local variables in function.");
+            return;
+        }
+
+        locals.push_back({ .name = name.get_lexme(), .depth = -1 });
+    }
+
+    auto resolve_local(const Token& name) -> std::optional<std::size_t>
+    {
+        for (auto i = locals.size(); i-- > 0;)
+        {
+            if (locals[i].name == name.get_lexme())
+            {
+                if (locals[i].depth == -1)
+                {
+                    parser.error("Can't read local variable in its own initializer.");
+                }
+                return i;
+            }
+        }
+
+        return std::nullopt;
+    }
+
+    // Finds `name` among the locals of the functions enclosing the one at nesting level `depth`, which are
+    // the first `depth` entries of `enclosing`, and threads an upvalue for it through every function in
+    // between. The index of that function's upvalue, or nothing when it is no such local.
+    auto resolve_upvalue(std::size_t depth, const Token& name) -> std::optional<std::size_t>
+    {
+        if (depth == 0)
+        {
+            return std::nullopt;
+        }
+
+        auto& outer = enclosing[depth - 1].locals;
+        auto local = outer.size();
+        while (local > 0 && outer[local - 1].name != name.get_lexme())
+        {
+            local--;
+        }
+
+        auto capture = Function::Capture{ .index = 0, .is_local = true };
+        if (local > 0)
+        {
+            auto& captured = outer[local - 1];
+            if (captured.depth == -1)
+            {
+                // The variable is in scope, so it must not be taken for a global of the same name.
+                parser.error("Can't read local variable in its own initializer.");
+                return 0;
+            }
+            if (captured.captured != nullptr)
+            {
+                *captured.captured = true;
+            }
+            capture.index = static_cast<std::uint8_t>(local - 1);
+        }
+        else if (const auto upvalue = resolve_upvalue(depth - 1, name))
+        {
+            capture = Function::Capture{ .index = static_cast<std::uint8_t>(*upvalue), .is_local = false };
+        }
+        else
+        {
+            return std::nullopt;
+        }
+
+        auto& function = functions[depth == enclosing.size() ? current_function : enclosing[depth].function];
+        const auto& captures = function.get_captures();
+        if (const auto found = std::ranges::find(captures, capture); found != captures.end())
+        {
+            return static_cast<std::size_t>(found - captures.begin());
+        }
+        if (captures.size() == max_upvalues)
+        {
+            parser.error("Too many closure variables in function.");
+            return 0;
+        }
+        function.add_capture(capture);
+        return captures.size() - 1;
+    }
+
+    auto begin_scope() noexcept -> void
+    {
+        scope_depth++;
+    }
+
+    auto end_scope() -> void
+    {
+        scope_depth--;
+
+        while (!locals.empty() && locals.back().depth > static_cast<int>(scope_depth))
+        {
+            locals.pop_back();
+        }
+    }
+
+    // Emission.
+
+    auto emit_statements(const ast::Stmt* first) -> void
+    {
+        for (const auto* stmt = first; stmt != nullptr; stmt = stmt->next)
+        {
+            emit_statement(*stmt);
+        }
+    }
+
+    auto emit_statement(const ast::Stmt& stmt) -> void
+    {
+        switch (stmt.kind)
+        {
+        case ast::StmtKind::Print:
+        {
+            const auto& print = *ast::as<const ast::Print>(&stmt);
+            reserve_temporaries(print);
+            emit_expression(*print.value);
+            line = print.line;
+            emit_byte(OpCode::Print);
+            release_temporaries(print);
+            break;
+        }
+        case ast::StmtKind::Expression:
+        {
+            const auto& expression = *ast::as<const ast::Expression>(&stmt);
+            reserve_temporaries(expression);
+            emit_effect(*expression.value);
+            release_temporaries(expression);
+            break;
+        }
+        case ast::StmtKind::Var: emit_var(*ast::as<const ast::Var>(&stmt)); break;
+        case ast::StmtKind::Block:
+        {
+            const auto& block = *ast::as<const ast::Block>(&stmt);
+            const auto outer_locals = slots.size();
+            emit_statements(block.body);
+
+            line = block.line;
+            for (; slots.size() > outer_locals; slots.pop_back())
+            {
+                emit_byte(slots.back() ? OpCode::CloseUpvalue : OpCode::Pop);
+            }
+            break;
+        }
+        case ast::StmtKind::If:
+        {
+            const auto& if_stmt = *ast::as<const ast::If>(&stmt);
+            emit_expression(*if_stmt.condition);
+            line = if_stmt.line;
+            const auto then_jump = emit_jump(OpCode::JumpIfFalsePop);
+            emit_branch(if_stmt.then_branch);
+
+            if (if_stmt.else_branch != nullptr)
+            {
+                const auto else_jump = emit_jump(OpCode::Jump);
+                patch_jump(then_jump);
+                emit_branch(if_stmt.else_branch);
+                patch_jump(else_jump);
+            }
+            else
+            {
+                patch_jump(then_jump);
+            }
+            break;
+        }
+        case ast::StmtKind::While:
+        {
+            const auto& loop = *ast::as<const ast::While>(&stmt);
+            const auto loop_start = code->size();
+            std::optional<std::size_t> exit_jump;
+            if (loop.condition != nullptr)
+            {
+                emit_expression(*loop.condition);
+                line = loop.line;
+                exit_jump = emit_jump(OpCode::JumpIfFalsePop);
+            }
+
+            emit_branch(loop.body);
+            if (loop.increment != nullptr)
+            {
+                emit_effect(*loop.increment);
+            }
+
+            line = loop.line;
+            emit_loop(loop_start);
+            if (exit_jump)
+            {
+                patch_jump(*exit_jump);
+            }
+            break;
+        }
+        case ast::StmtKind::Function: emit_function(*ast::as<const ast::Function>(&stmt)); break;
+        case ast::StmtKind::Return:
+        {
+            const auto& return_stmt = *ast::as<const ast::Return>(&stmt);
+            if (const auto* call = ast::as<const ast::Call>(return_stmt.value))
+            {
+                // The callee takes over this frame; the Return hands on the result of a native.
+                emit_call(*call, OpCode::TailCall);
+            }
+            else
+            {
+                emit_value(return_stmt.value, return_stmt.line);
+            }
+            line = return_stmt.line;
+            emit_byte(OpCode::Return);
+            break;
+        }
+        }
+    }
+
+    auto emit_branch(const ast::Stmt* branch) -> void
+    {
+        if (branch != nullptr)
+        {
+            emit_statement(*branch);
+        }
+    }
+
+    auto emit_var(const ast::Var& var) -> void
+    {
+        if (var.binding.kind == ast::Binding::Kind::Local)
+        {
+            // The value stays where it is pushed, which is the new local's slot.
+            emit_value(var.value, var.line);
+            slots.push_back(var.captured);
+            return;
+        }
+
+        reserve_temporaries(var);
+        emit_value(var.value, var.line);
+        line = var.line;
+        emit_define_global(var.binding.index);
+        release_temporaries(var);
+    }
+
+    auto emit_define_global(std::size_t global) -> void
+    {
+        if (global <= std::numeric_limits<std::uint16_t>::max())
+        {
+            emit_operand(OpCode::DefineGlobalSlot, global);
+        }
+        else
+        {
+            emit_operand(OpCode::DefineGlobal, make_constant(values::make(globals.name(global))));
+        }
+    }
+
+    // Emits the body into the function's own chunk, then the function, or a closure over it, where it is
+    // declared.
+    auto emit_function(const ast::Function& declaration) -> void
+    {
+        auto& function = functions[declaration.function];
+        auto* const outer_code = std::exchange(code, &function.chunk());
+        auto outer_slots = std::exchange(slots, std::vector<bool>(function.get_arity() + 1, false));
+
+        emit_statements(declaration.body);
+        line = declaration.line;
+        emit_bytes(OpCode::Nil, OpCode::Return);
+        finish_chunk(function.get_name());
+
+        code = outer_code;
+        slots = std::move(outer_slots);
+
+        // The chunk is shared with the entry in `functions`, which keeps its constants reachable meanwhile.
+        auto* object = heap.allocate<ObjFunction>(function);
+        line = declaration.line;
+        emit_operand(function.get_captures().empty() ? OpCode::Constant : OpCode::Closure,
+                     make_constant(values::make(object)));
+
+        if (declaration.binding.kind == ast::Binding::Kind::Local)
+        {
+            slots.push_back(declaration.captured);
+            return;
+        }
+        emit_define_global(declaration.binding.index);
+    }
+
+    // The initializer of a declaration, nil without one.
+    auto emit_value(const ast::Expr* value, std::size_t value_line) -> void
+    {
+        if (value != nullptr)
+        {
+            emit_expression(*value);
+            return;
+        }
+
+        line = value_line;
+        emit_byte(OpCode::Nil);
+    }
+
+    // Evaluates `expr` only for its effects. `local = local + constant` becomes a single IncrLocal.
+    auto emit_effect(const ast::Expr& expr) -> void
+    {
+        if (const auto increment = local_increment(expr))
+        {
+            line = expr.line;
+            emit_bytes(OpCode::IncrLocal, increment->first, increment->second);
+            return;
+        }
+
+        emit_expression(expr);
+        line = expr.line;
+        emit_byte(OpCode::Pop);
+    }
+
+    [[nodiscard]] auto local_increment(const ast::Expr& expr) -> std::optional<std::pair<std::uint8_t, std::uint8_t>>
+    {
+        const auto* assign = ast::as<const ast::Assign>(&expr);
+        const auto* sum = assign != nullptr ? ast::as<const ast::Binary>(assign->value) : nullptr;
+        if (sum == nullptr || assign->binding.kind != ast::Binding::Kind::Local)
+        {
+            return std::nullopt;
+        }
+
+        const auto* local = ast::as<const ast::Variable>(sum->lhs);
+        if (sum->op != TokenType::PLUS || local == nullptr || local->binding != assign->binding)
+        {
+            return std::nullopt;
+        }
+
+        return local_constant_operands(*sum);
+    }
+
+    // The slot and constant index of `local + constant`, if both fit the operands of AddLocalConst.
+    [[nodiscard]] auto local_constant_operands(const ast::Binary& sum)
+    -> std::optional<std::pair<std::uint8_t, std::uint8_t>>
+    {
+        const auto* local = ast::as<const ast::Variable>(sum.lhs);
+        const auto* constant = ast::as<const ast::Literal>(sum.rhs);
+        if (local == nullptr || constant == nullptr || local->binding.kind != ast::Binding::Kind::Local
+            || !is_constant(constant->value))
+        {
+            return std::nullopt;
+        }
+
+        const auto index = make_constant(constant->value);
+        if (local->binding.index > std::numeric_limits<std::uint8_t>::max()
+            || index > std::numeric_limits<std::uint8_t>::max())
+        {
+            return std::nullopt;
+        }
+
+        return std::pair{ static_cast<std::uint8_t>(local->binding.index), static_cast<std::uint8_t>(index) };
+    }
+
+    auto emit_expression(const ast::Expr& expr) -> void
+    {
+        switch (expr.kind)
+        {
+        case ast::ExprKind::Literal:
+            line = expr.line;
+            emit_literal(ast::as<const ast::Literal>(&expr)->value);
+            break;
+        case ast::ExprKind::Variable:
+        {
+            const auto& variable = *ast::as<const ast::Variable>(&expr);
+            line = variable.line;
+            emit_access(variable.binding, variable.name, false);
+            break;
+        }
+        case ast::ExprKind::Assign:
+        {
+            const auto& assign = *ast::as<const ast::Assign>(&expr);
+            emit_expression(*assign.value);
+            line = assign.line;
+            emit_access(assign.binding, assign.name, true);
+            break;
+        }
+        case ast::ExprKind::Unary:
+        {
+            const auto& unary = *ast::as<const ast::Unary>(&expr);
+            emit_expression(*unary.operand);
+            line = unary.line;
+            emit_byte(unary.op == TokenType::MINUS ? OpCode::Negate : OpCode::Not);
+            break;
+        }
+        case ast::ExprKind::Binary: emit_binary(*ast::as<const ast::Binary>(&expr)); break;
+        case ast::ExprKind::Logical:
+        {
+            const auto& logical = *ast::as<const ast::Logical>(&expr);
+            emit_expression(*logical.lhs);
+            line = logical.line;
+            if (logical.op == TokenType::AND)
+            {
+                const auto end_jump = emit_jump(OpCode::JumpIfFalse);
+                emit_byte(OpCode::Pop);
+                emit_expression(*logical.rhs);
+                patch_jump(end_jump);
+            }
+            else
+            {
+                const auto else_jump = emit_jump(OpCode::JumpIfFalse);
+                const auto end_jump = emit_jump(OpCode::Jump);
+                patch_jump(else_jump);
+                emit_byte(OpCode::Pop);
+                emit_expression(*logical.rhs);
+                patch_jump(end_jump);
+            }
+            break;
+        }
+        case ast::ExprKind::Shared:
+        {
+            const auto& shared = *ast::as<const ast::Shared>(&expr);
+            emit_expression(*shared.value);
+            line = shared.line;
+            emit_bytes(OpCode::Setlocal, static_cast<std::uint8_t>(shared.slot));
+            break;
+        }
+        case ast::ExprKind::Call: emit_call(*ast::as<const ast::Call>(&expr), OpCode::Call); break;
+        }
+    }
+
+    // `op` is Call or TailCall.
+    auto emit_call(const ast::Call& call, OpCode op) -> void
+    {
+        emit_expression(*call.callee);
+        for (const auto* argument : call.arguments)
+        {
+            emit_expression(*argument);
+        }
+        line = call.line;
+        emit_bytes(op, static_cast<std::uint8_t>(call.arguments.size()));
+    }
+
+    auto emit_binary(const ast::Binary& binary) -> void
+    {
+        if (binary.op == TokenType::PLUS)
+        {
+            if (const auto operands = local_constant_operands(binary))
+            {
+                line = binary.line;
+                emit_bytes(OpCode::AddLocalConst, operands->first, operands->second);
+                return;
+            }
+        }
+
+        emit_expression(*binary.lhs);
+        emit_expression(*binary.rhs);
+        line = binary.line;
+
+        switch (binary.op)
+        {
+        case TokenType::BANG_EQUAL: emit_byte(OpCode::NotEqual); break;
+        case TokenType::EQUAL_EQUAL: emit_byte(OpCode::Equal); break;
+        case TokenType::GREATER: emit_byte(OpCode::Greater); break;
+        case TokenType::GREATER_EQUAL: emit_byte(OpCode::GreaterEqual); break;
+        case TokenType::LESS: emit_byte(OpCode::Less); break;
+        case TokenType::LESS_EQUAL: emit_byte(OpCode::LessEqual); break;
+        case TokenType::PLUS: emit_byte(OpCode::Add); break;
+        case TokenType::MINUS: emit_byte(OpCode::Subtract); break;
+        case TokenType::STAR: emit_byte(OpCode::Mutliply); break;
+        case TokenType::SLASH: emit_byte(OpCode::Divide); break;
+        default: break; // Unreachable.
+        }
+    }
+
+    // Gets or sets a variable wherever it lives.
+    auto emit_access(const ast::Binding& binding, const Token& name, bool set) -> void
+    {
+        switch (binding.kind)
+        {
+        case ast::Binding::Kind::Local:
+            emit_bytes(set ? OpCode::Setlocal : OpCode::GetLocal, static_cast<std::uint8_t>(binding.index));
+            break;
+        case ast::Binding::Kind::Upvalue:
+            emit_bytes(set ? OpCode::SetUpvalue : OpCode::GetUpvalue, static_cast<std::uint8_t>(binding.index));
+            break;
+        case ast::Binding::Kind::GlobalSlot:
+            emit_operand(set ? OpCode::SetGlobalSlot : OpCode::GetGlobalSlot, binding.index);
+            break;
+        case ast::Binding::Kind::Global:
+            emit_operand(set ? OpCode::SetGlobal : OpCode::GetGlobal,
+                         make_constant(values::make(heap.make_string(name.get_lexme()))));
+            break;
+        }
+    }
+
+    // Booleans and nil have instructions of their own; everything else is a constant.
+    [[nodiscard]] static auto is_constant(const Value& value) noexcept -> bool
+    {
+        return !values::is<Boolean>(value) && !values::is<Nil>(value);
+    }
+
+    auto emit_literal(const Value& value) -> void
+    {
+        if (values::is<Nil>(value))
+        {
+            emit_byte(OpCode::Nil);
+        }
+        else if (values::is<Boolean>(value))
+        {
+            emit_byte(values::as<Boolean>(value) ? OpCode::True : OpCode::False);
+        }
+        else
+        {
+            emit_operand(OpCode::Constant, make_constant(value));
+        }
+    }
+
+    // Temporaries of common subexpressions sit right above the locals for the whole statement.
+    auto reserve_temporaries(const ast::ExprStmt& stmt) -> void
+    {
+        line = stmt.line;
+        for (std::size_t i = 0; i < stmt.temporaries; i++)
+        {
+            emit_byte(OpCode::Nil);
+        }
+    }
+
+    auto release_temporaries(const ast::ExprStmt& stmt) -> void
+    {
+        line = stmt.line;
+        for (std::size_t i = 0; i < stmt.temporaries; i++)
+        {
+            emit_byte(OpCode::Pop);
+        }
+    }
+
+    auto end_compiler() -> void
+    {
+        line = parser.previous.get_line();
+        emit_byte(OpCode::Return);
+        finish_chunk("code");
+    }
+
+    // Runs the Peephole passes over the chunk being emitted, which is complete.
+    auto finish_chunk(std::string_view name) -> void
+    {
+        if (!parser.had_error)
+        {
+            peephole_stats += Peephole{ *code }.run();
+        }
+        if (!parser.had_error && debug::enabled)
+        {
+            debug::Debug::dissassemble_chunk(*code, name);
+        }
+    }
+
+    template <typename T>
+    auto emit_byte(T byte) -> void
+    {
+        code->write(byte, line);
+    }
+
+    template <typename... T>
+    auto emit_bytes(T... bytes) -> void
+    {
+        (emit_byte(bytes), ...);
+    }
+
+    // Emits `op` with a one-byte operand, switching to its long form when the operand does not fit.
+    auto emit_operand(OpCode op, std::size_t operand) -> void
+    {
+        if (operand <= std::numeric_limits<std::uint8_t>::max())
+        {
+            emit_bytes(op, static_cast<std::uint8_t>(operand));
+            return;
+        }
+
+        const auto [long_op, width] = long_form(op);
+        emit_byte(long_op);
+        for (auto shift = 8 * width; shift > 0;)
+        {
+            shift -= 8;
+            emit_byte(static_cast<std::uint8_t>((operand >> shift) & 0xFF));
+        }
+    }
+
+    auto emit_jump(OpCode instruction) -> std::size_t
+    {
+        emit_bytes(instruction, static_cast<std::uint8_t>(0xFF), static_cast<std::uint8_t>(0xFF));
+        return code->size() - 2;
+    }
+
+    auto patch_jump(std::size_t offset) -> void
+    {
+        const auto jump = code->size() - offset - 2;
+
+        if (jump > std::numeric_limits<std::uint16_t>::max())
+        {
+            parser.error("Too much code to jump over.");
+        }
+
+        code->set(offset, static_cast<std::byte>((jump >> 8) & 0xFF));
+        code->set(offset + 1, static_cast<std::byte>(jump & 0xFF));
+    }
+
+    auto emit_loop(std::size_t loop_start) -> void
+    {
+        emit_byte(OpCode::Loop);
+        const auto offset = code->size() - loop_start + 2;
+
+        if (offset > std::numeric_limits<std::uint16_t>::max())
+        {
+            parser.error("Loop body too large.");
+        }
+
+        emit_bytes(static_cast<std::uint8_t>((offset >> 8) & 0xFF), static_cast<std::uint8_t>(offset & 0xFF));
+    }
+
+    auto make_constant(const Value& value) -> std::size_t
+    {
+        const auto constant = code->add_constant(value);
+        if (constant >= max_constants)
+        {
+            parser.error("Too many constants in one chunk.");
+            return 0;
+        }
+        return constant;
+    }
+
+    [[nodiscard]] auto get_rule(TokenType type) const -> const Rule&
+    {
+        return rules[static_cast<std::size_t>(type)];
+    }
+
+    std::vector<Rule> rules{
+        { .prefix = &AstCompiler::grouping, .infix = &AstCompiler::call, .precedence = Precedence::CALL }, // LEFT_PAREN
+        { .prefix = nullptr, .infix = nullptr, .precedence = Precedence::NONE },                       // RIGHT_PAREN
+        { .prefix = nullptr, .infix = nullptr, .precedence = Precedence::NONE },                       // LEFT_BRACE
+        { .prefix = nullptr, .infix = nullptr, .precedence = Precedence::NONE },                       // RIGHT_BRACE
+        { .prefix = nullptr, .infix = nullptr, .precedence = Precedence::NONE },                       // COMMA
+        { .prefix = nullptr, .infix = nullptr, .precedence = Precedence::NONE },                       // DOT
+        { .prefix = &AstCompiler::unary, .infix = &AstCompiler::binary, .precedence = Precedence::TERM }, // MINUS
+        { .prefix = nullptr, .infix = &AstCompiler::binary, .precedence = Precedence::TERM },          // PLUS
+        { .prefix = nullptr, .infix = nullptr, .precedence = Precedence::NONE },                       // SEMICOLON
+        { .prefix = nullptr, .infix = &AstCompiler::binary, .precedence = Precedence::FACTOR },        // SLASH
+        { .prefix = nullptr, .infix = &AstCompiler::binary, .precedence = Precedence::FACTOR },        // STAR
+        { .prefix = &AstCompiler::unary, .infix = nullptr, .precedence = Precedence::NONE },           // BANG
+        { .prefix = nullptr, .infix = &AstCompiler::binary, .precedence = Precedence::EQUALITY },      // BANG_EQUAL
+        { .prefix = nullptr, .infix = nullptr, .precedence = Precedence::NONE },                       // EQUAL
+        { .prefix = nullptr, .infix = &AstCompiler::binary, .precedence = Precedence::EQUALITY },      // EQUAL_EQUAL
+        { .prefix = nullptr, .infix = &AstCompiler::binary, .precedence = Precedence::COMPARISON },    // GREATER
+        { .prefix = nullptr, .infix = &AstCompiler::binary, .precedence = Precedence::COMPARISON },    // GREATER_EQUAL
+        { .prefix = nullptr, .infix = &AstCompiler::binary, .precedence = Precedence::COMPARISON },    // LESS
+        { .prefix = nullptr, .infix = &AstCompiler::binary, .precedence = Precedence::COMPARISON },    // LESS_EQUAL
+        { .prefix = &AstCompiler::variable, .infix = nullptr, .precedence = Precedence::NONE },        // IDENTIFIER
+        { .prefix = &AstCompiler::string, .infix = nullptr, .precedence = Precedence::NONE },          // STRING
+        { .prefix = &AstCompiler::number, .infix = nullptr, .precedence = Precedence::NONE },          // NUMBER
+        { .prefix = nullptr, .infix = &AstCompiler::and_, .precedence = Precedence::AND },             // AND
+        { .prefix = nullptr, .infix = nullptr, .precedence = Precedence::NONE },                       // CLASS
+        { .prefix = nullptr, .infix = nullptr, .precedence = Precedence::NONE },                       // ELSE
+        { .prefix = &AstCompiler::literal, .infix = nullptr, .precedence = Precedence::NONE },         // FALSE
+        { .prefix = nullptr, .infix = nullptr, .precedence = Precedence::NONE },                       // FOR
+        { .prefix = nullptr, .infix = nullptr, .precedence = Precedence::NONE },                       // FUN
+        { .prefix = nullptr, .infix = nullptr, .precedence = Precedence::NONE },                       // IF
+        { .prefix = &AstCompiler::literal, .infix = nullptr, .precedence = Precedence::NONE },         // NIL
+        { .prefix = nullptr, .infix = &AstCompiler::or_, .precedence = Precedence::OR },               // OR
+        { .prefix = nullptr, .infix = nullptr, .precedence = Precedence::NONE },                       // PRINT
+        { .prefix = nullptr, .infix = nullptr, .precedence = Precedence::NONE },                       // RETURN
+        { .prefix = nullptr, .infix = nullptr, .precedence = Precedence::NONE },                       // SUPER
+        { .prefix = nullptr, .infix = nullptr, .precedence = Precedence::NONE },                       // THIS
+        { .prefix = &AstCompiler::literal, .infix = nullptr, .precedence = Precedence::NONE },         // TRUE
+        { .prefix = nullptr, .infix = nullptr, .precedence = Precedence::NONE },                       // VAR
+        { .prefix = nullptr, .infix = nullptr, .precedence = Precedence::NONE },                       // WHILE
+        { .prefix = nullptr, .infix = nullptr, .precedence = Precedence::NONE },                       // ERROR
+        { .prefix = nullptr, .infix = nullptr, .precedence = Precedence::NONE },                       // Eof
+    };
+
+    // Same limits as Compiler: one-byte local slots, upvalue indices and argument counts, and what
+    // ConstantLong can address.
+    static constexpr std::size_t max_locals = std::numeric_limits<std::uint8_t>::max();
+    static constexpr std::size_t max_upvalues = std::numeric_limits<std::uint8_t>::max() + 1;
+    static constexpr std::size_t max_arguments = std::numeric_limits<std::uint8_t>::max();
+    static constexpr std::size_t max_constants = std::size_t{ 1 } << 24;
+    static constexpr auto no_function = std::numeric_limits<std::size_t>::max();
+
+    Parser parser;
+    Heap& heap;
+    Globals& globals;
+    Chunk chunk;
+    ast::Arena arena;
+    // Strings made for the tree, reachable from nothing else until they are constants of the chunk.
+    std::vector<Value> literals;
+    AstOptimizer optimizer{ arena, heap, literals };
+    // Slots of the globals defined by top-level declarations parsed so far.
+    std::vector<bool> defined_globals;
+    // The functions declared in the script, in the order their declarations were parsed.
+    std::vector<Function> functions;
+    // The function being parsed, no_function for the script's own code.
+    std::size_t current_function = no_function;
+    // The functions whose parsing is suspended by a nested one, innermost last.
+    std::vector<EnclosingFunction> enclosing;
+    std::vector<Local> locals;
+    std::size_t scope_depth = 0;
+    // The chunk being emitted: the script's or a function's.
+    Chunk* code = &chunk;
+    // The locals on the stack at the point being emitted, and whether a closure captures each.
+    std::vector<bool> slots;
+    // Line recorded for the instructions being emitted.
+    std::size_t line = 0;
+    PeepholeStats peephole_stats;
+};
@@ -0,0 +1,497 @@
+#pragma once
+
+#include "Ast.hpp"
+#include "Folding.hpp"
+#include "Memory.hpp"
+#include "Scanner.hpp"
+#include "Value.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+struct AstStats
+{
+    std::size_t constants_folded = 0;
+    std::size_t branches_removed = 0;
+    std::size_t dead_statements_removed = 0;
+    std::size_t subexpressions_shared = 0;
+};
+
+// Passes over the tree of a whole script, before any code exists for it:
+//  - operators applied to literals are folded, `and` and `or` included;
+//  - `if` and `while` on a literal condition keep only what can run;
+//  - statements after one that never completes are dropped. Without `break`, that is a `return`, a loop
+//    with no condition, or a block or `if` that always ends up in one;
+//  - a pure subexpression repeated within a statement without calls is computed once and kept in a temporary.
+// Function bodies go through the same passes as the script.
+class AstOptimizer
+{
+public:
+    // Strings made by folding are appended to `literals`, which the caller keeps reachable.
+    AstOptimizer(ast::Arena& arena, Heap& heap, std::vector<Value>& literals)
+    : arena{ arena }, heap{ heap }, literals{ literals }
+    {
+    }
+
+    auto run(ast::Stmt* program) -> ast::Stmt*
+    {
+        stats = AstStats{};
+        return simplify_list(program);
+    }
+
+    [[nodiscard]] auto get_stats() const noexcept -> const AstStats&
+    {
+        return stats;
+    }
+
+private:
+    // A node that common subexpression elimination could replace. Nodes are numbered in evaluation
+    // order, and the subtree of a node numbered `begin` covers the numbers up to `end`.
+    struct Occurrence
+    {
+        ast::Expr** link;
+        std::size_t begin;
+        std::size_t end;
+        std::size_t cost;
+        // Inside the right operand of an `and` or `or`, which may not run.
+        bool conditional;
+    };
+
+    // What keeping a value in a temporary costs in instructions: reserving the slot, storing to it and
+    // popping it at the end of the statement.
+    static constexpr std::size_t sharing_overhead = 3;
+    static constexpr std::size_t max_temporaries = 8;
+    // Statements with more candidate subexpressions than this are left alone, which bounds the
+    // quadratic search for repeats.
+    static constexpr std::size_t max_occurrences = 64;
+
+    auto simplify_list(ast::Stmt* first) -> ast::Stmt*
+    {
+        ast::Stmt* head = nullptr;
+        auto** link = &head;
+        for (auto* stmt = first; stmt != nullptr;)
+        {
+            auto* next = stmt->next;
+            if (auto* simplified = simplify(stmt))
+            {
+                simplified->next = nullptr;
+                *link = simplified;
+                link = &simplified->next;
+
+                if (never_completes(*simplified))
+                {
+                    for (; next != nullptr; next = next->next)
+                    {
+                        stats.dead_statements_removed++;
+                    }
+                }
+            }
+            stmt = next;
+        }
+        return head;
+    }
+
+    // Returns what replaces `stmt`, nullptr if nothing does.
+    auto simplify(ast::Stmt* stmt) -> ast::Stmt*
+    {
+        switch (stmt->kind)
+        {
+        case ast::StmtKind::Print:
+        case ast::StmtKind::Expression:
+        case ast::StmtKind::Var:
+        {
+            auto* expr_stmt = static_cast<ast::ExprStmt*>(stmt);
+            if (expr_stmt->value != nullptr)
+            {
+                expr_stmt->value = fold(expr_stmt->value);
+            }
+
+            // The value of a local declaration becomes the local itself, right where the temporaries would go.
+            const auto* var = ast::as<ast::Var>(stmt);
+            if (expr_stmt->value != nullptr && (var == nullptr || var->binding.kind != ast::Binding::Kind::Local))
+            {
+                share_subexpressions(*expr_stmt);
+            }
+            return stmt;
+        }
+        case ast::StmtKind::Block:
+        {
+            auto* block = ast::as<ast::Block>(stmt);
+            block->body = simplify_list(block->body);
+            return block;
+        }
+        case ast::StmtKind::If:
+        {
+            auto* if_stmt = ast::as<ast::If>(stmt);
+            if_stmt->condition = fold(if_stmt->condition);
+            if_stmt->then_branch = simplify_branch(if_stmt->then_branch);
+            if_stmt->else_branch = simplify_branch(if_stmt->else_branch);
+
+            if (const auto* condition = ast::as<ast::Literal>(if_stmt->condition))
+            {
+                stats.branches_removed++;
+                return folding::is_falsey(condition->value) ? if_stmt->else_branch : if_stmt->then_branch;
+            }
+            return if_stmt;
+        }
+        case ast::StmtKind::While:
+        {
+            auto* loop = ast::as<ast::While>(stmt);
+            if (loop->condition != nullptr)
+            {
+                loop->condition = fold(loop->condition);
+                if (const auto* condition = ast::as<ast::Literal>(loop->condition))
+                {
+                    stats.branches_removed++;
+                    if (folding::is_falsey(condition->value))
+                    {
+                        return nullptr;
+                    }
+                    loop->condition = nullptr;
+                }
+            }
+
+            loop->body = simplify_branch(loop->body);
+            if (loop->increment != nullptr)
+            {
+                loop->increment = fold(loop->increment);
+            }
+            return loop;
+        }
+        case ast::StmtKind::Function:
+        {
+            auto* function = ast::as<ast::Function>(stmt);
+            function->body = simplify_list(function->body);
+            return function;
+        }
+        case ast::StmtKind::Return:
+        {
+            auto* return_stmt = ast::as<ast::Return>(stmt);
+            if (return_stmt->value != nullptr)
+            {
+                return_stmt->value = fold(return_stmt->value);
+            }
+            return return_stmt;
+        }
+        }
+        return stmt;
+    }
+
+    auto simplify_branch(ast::Stmt* branch) -> ast::Stmt*
+    {
+        return branch != nullptr ? simplify(branch) : nullptr;
+    }
+
+    [[nodiscard]] static auto never_completes(const ast::Stmt& stmt) noexcept -> bool
+    {
+        if (stmt.kind == ast::StmtKind::Return)
+        {
+            return true;
+        }
+
+        if (const auto* loop = ast::as<const ast::While>(&stmt))
+        {
+            return loop->condition == nullptr;
+        }
+
+        if (const auto* block = ast::as<const ast::Block>(&stmt))
+        {
+            for (const auto* inner = block->body; inner != nullptr; inner = inner->next)
+            {
+                if (never_completes(*inner))
+                {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        if (const auto* if_stmt = ast::as<const ast::If>(&stmt))
+        {
+            return if_stmt->then_branch != nullptr && if_stmt->else_branch != nullptr
+                   && never_completes(*if_stmt->then_branch) && never_completes(*if_stmt->else_branch);
+        }
+
+        return false;
+    }
+
+    auto fold(ast::Expr* expr) -> ast::Expr*
+    {
+        switch (expr->kind)
+        {
+        case ast::ExprKind::Assign:
+        {
+            auto* assign = ast::as<ast::Assign>(expr);
+            assign->value = fold(assign->value);
+            return assign;
+        }
+        case ast::ExprKind::Unary:
+        {
+            auto* unary = ast::as<ast::Unary>(expr);
+            unary->operand = fold(unary->operand);
+            if (const auto* operand = ast::as<ast::Literal>(unary->operand))
+            {
+                if (const auto folded = folding::unary(unary->op, operand->value))
+                {
+                    return literal(unary->line, *folded);
+                }
+            }
+            return unary;
+        }
+        case ast::ExprKind::Binary:
+        {
+            auto* binary = ast::as<ast::Binary>(expr);
+            binary->lhs = fold(binary->lhs);
+            binary->rhs = fold(binary->rhs);
+            const auto* lhs = ast::as<ast::Literal>(binary->lhs);
+            const auto* rhs = ast::as<ast::Literal>(binary->rhs);
+            if (lhs != nullptr && rhs != nullptr)
+            {
+                if (const auto folded = folding::binary(binary->op, lhs->value, rhs->value, heap))
+                {
+                    return literal(binary->line, *folded);
+                }
+            }
+            return binary;
+        }
+        case ast::ExprKind::Logical:
+        {
+            // A literal left operand decides which operand is the result; the other one never runs.
+            auto* logical = ast::as<ast::Logical>(expr);
+            logical->lhs = fold(logical->lhs);
+            logical->rhs = fold(logical->rhs);
+            if (const auto* lhs = ast::as<ast::Literal>(logical->lhs))
+            {
+                stats.constants_folded++;
+                const auto falsey = folding::is_falsey(lhs->value);
+                return (logical->op == TokenType::AND) == falsey ? logical->lhs : logical->rhs;
+            }
+            return logical;
+        }
+        case ast::ExprKind::Call:
+        {
+            auto* call = ast::as<ast::Call>(expr);
+            call->callee = fold(call->callee);
+            for (auto*& argument : call->arguments)
+            {
+                argument = fold(argument);
+            }
+            return call;
+        }
+        default: return expr;
+        }
+    }
+
+    auto literal(std::size_t line, const Value& value) -> ast::Expr*
+    {
+        stats.constants_folded++;
+        literals.push_back(value);
+        return arena.make<ast::Literal>(line, value);
+    }
+
+    // Keeps the first evaluation of a repeated subexpression in a temporary for the later ones to read.
+    // Only the operators of Folding qualify, over literals and variables that the statement does not
+    // assign: the value is the same each time, and computing it can at worst fail the way the first
+    // evaluation would have, before any later one. The first evaluation must be one that always runs.
+    // A call may assign any global, or any local through a closure, so statements with one are left alone.
+    auto share_subexpressions(ast::ExprStmt& stmt) -> void
+    {
+        occurrences.clear();
+        assigned.clear();
+        visited = 0;
+        calls = false;
+        collect(&stmt.value, false);
+        if (calls || occurrences.size() > max_occurrences)
+        {
+            return;
+        }
+
+        // Largest first: sharing an expression also shares everything inside it.
+        std::ranges::stable_sort(occurrences, std::greater{}, &Occurrence::cost);
+        std::vector<bool> covered(visited, false);
+        std::vector<Occurrence> group;
+        for (const auto& candidate : occurrences)
+        {
+            if (covered[candidate.begin])
+            {
+                continue;
+            }
+
+            group.clear();
+            for (const auto& other : occurrences)
+            {
+                if (other.cost == candidate.cost && !covered[other.begin] && same(**other.link, **candidate.link))
+                {
+                    group.push_back(other);
+                }
+            }
+
+            std::ranges::sort(group, {}, &Occurrence::begin);
+            const auto first = std::ranges::find(group, false, &Occurrence::conditional);
+            const auto uses = static_cast<std::size_t>(group.end() - first);
+            if (uses < 2 || (uses - 1) * (candidate.cost - 1) <= sharing_overhead || reads_assigned(**first->link))
+            {
+                continue;
+            }
+
+            const auto slot = stmt.first_temporary + stmt.temporaries;
+            if (slot > std::numeric_limits<std::uint8_t>::max() || stmt.temporaries == max_temporaries)
+            {
+                return;
+            }
+
+            const auto line = (*first->link)->line;
+            *first->link = arena.make<ast::Shared>(line, slot, *first->link);
+            const ast::Binding temporary{ .kind = ast::Binding::Kind::Local, .index = slot };
+            for (auto use = first + 1; use != group.end(); ++use)
+            {
+                *use->link = arena.make<ast::Variable>((*use->link)->line, Token{ TokenType::IDENTIFIER }, temporary);
+            }
+            for (auto use = first; use != group.end(); ++use)
+            {
+                std::fill(covered.begin() + static_cast<std::ptrdiff_t>(use->begin),
+                          covered.begin() + static_cast<std::ptrdiff_t>(use->end), true);
+            }
+
+            stmt.temporaries++;
+            stats.subexpressions_shared += uses - 1;
+        }
+    }
+
+    // Numbers the subtree at `link` in evaluation order and records its candidates. Returns the number
+    // of instructions the subtree compiles to if it is pure, nullopt otherwise.
+    auto collect(ast::Expr** link, bool conditional) -> std::optional<std::size_t>
+    {
+        const auto begin = visited++;
+        auto* expr = *link;
+        std::optional<std::size_t> cost;
+
+        switch (expr->kind)
+        {
+        case ast::ExprKind::Literal:
+        case ast::ExprKind::Variable: return 1;
+        case ast::ExprKind::Assign:
+        {
+            auto* assign = ast::as<ast::Assign>(expr);
+            collect(&assign->value, conditional);
+            assigned.push_back(assign->name.get_lexme());
+            return std::nullopt;
+        }
+        case ast::ExprKind::Unary:
+        {
+            if (const auto operand = collect(&ast::as<ast::Unary>(expr)->operand, conditional))
+            {
+                cost = *operand + 1;
+            }
+            break;
+        }
+        case ast::ExprKind::Binary:
+        {
+            auto* binary = ast::as<ast::Binary>(expr);
+            const auto lhs = collect(&binary->lhs, conditional);
+            const auto rhs = collect(&binary->rhs, conditional);
+            if (lhs && rhs)
+            {
+                cost = *lhs + *rhs + 1;
+            }
+            break;
+        }
+        case ast::ExprKind::Logical:
+        {
+            auto* logical = ast::as<ast::Logical>(expr);
+            collect(&logical->lhs, conditional);
+            collect(&logical->rhs, true);
+            return std::nullopt;
+        }
+        case ast::ExprKind::Shared: return std::nullopt;
+        case ast::ExprKind::Call:
+            calls = true;
+            return std::nullopt;
+        }
+
+        if (cost)
+        {
+            occurrences.push_back(
+            { .link = link, .begin = begin, .end = visited, .cost = *cost, .conditional = conditional });
+        }
+        return cost;
+    }
+
+    [[nodiscard]] auto reads_assigned(const ast::Expr& expr) const -> bool
+    {
+        switch (expr.kind)
+        {
+        case ast::ExprKind::Variable:
+            return std::ranges::find(assigned, ast::as<const ast::Variable>(&expr)->name.get_lexme()) != assigned.end();
+        case ast::ExprKind::Unary: return reads_assigned(*ast::as<const ast::Unary>(&expr)->operand);
+        case ast::ExprKind::Binary:
+        {
+            const auto* binary = ast::as<const ast::Binary>(&expr);
+            return reads_assigned(*binary->lhs) || reads_assigned(*binary->rhs);
+        }
+        default: return false;
+        }
+    }
+
+    // Structural equality of pure expressions. Numbers compare by representation, so that 0 and -0
+    // stay apart.
+    [[nodiscard]] static auto same(const ast::Expr& lhs, const ast::Expr& rhs) -> bool
+    {
+        if (lhs.kind != rhs.kind)
+        {
+            return false;
+        }
+
+        switch (lhs.kind)
+        {
+        case ast::ExprKind::Literal:
+        {
+            const auto& a = ast::as<const ast::Literal>(&lhs)->value;
+            const auto& b = ast::as<const ast::Literal>(&rhs)->value;
+            if (values::is<Number>(a) && values::is<Number>(b))
+            {
+                return std::bit_cast<std::uint64_t>(values::as<Number>(a))
+                       == std::bit_cast<std::uint64_t>(values::as<Number>(b));
+            }
+            return a == b;
+        }
+        case ast::ExprKind::Variable:
+        {
+            const auto* a = ast::as<const ast::Variable>(&lhs);
+            const auto* b = ast::as<const ast::Variable>(&rhs);
+            return a->binding == b->binding
+                   && (a->binding.kind != ast::Binding::Kind::Global || a->name.get_lexme() == b->name.get_lexme());
+        }
+        case ast::ExprKind::Unary:
+        {
+            const auto* a = ast::as<const ast::Unary>(&lhs);
+            const auto* b = ast::as<const ast::Unary>(&rhs);
+            return a->op == b->op && same(*a->operand, *b->operand);
+        }
+        case ast::ExprKind::Binary:
+        {
+            const auto* a = ast::as<const ast::Binary>(&lhs);
+            const auto* b = ast::as<const ast::Binary>(&rhs);
+            return a->op == b->op && same(*a->lhs, *b->lhs) && same(*a->rhs, *b->rhs);
+        }
+        default: return false;
+        }
+    }
+
+    ast::Arena& arena;
+    Heap& heap;
+    std::vector<Value>& literals;
+    AstStats stats;
+    std::vector<Occurrence> occurrences;
+    std::vector<std::string_view> assigned;
+    std::size_t visited = 0;
+    // Whether the statement being searched for repeats makes a call.
+    bool calls = false;
+};
@@ -2,8 +2,13 @@
 
 #include "Value.hpp"
 
+#include <algorithm>
+#include <bit>
 #include <cstddef>
 #include <cstdint>
+#include <iterator>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
 enum class OpCode : std::uint8_t
@@ -31,7 +36,276 @@ enum class OpCode : std::uint8_t
     Jump,
     JumpIfFalse,
     Loop,
-    Return,
+    // Globals the compiler resolved to a slot; the plain Global opcodes look them up by name.
+    GetGlobalSlot,
+    SetGlobalSlot,
+    DefineGlobalSlot,
+    // Long forms, for operands that do not fit in a byte: a 24-bit constant index or a 16-bit global slot,
+    // both big-endian like jump offsets.
+    ConstantLong,
+    GetGlobalLong,
+    DefineGlobalLong,
+    SetGlobalLong,
+    GetGlobalSlotLong,
+    SetGlobalSlotLong,
+    DefineGlobalSlotLong,
+    // Superinstructions, produced by the compiler's peephole pass.
+    NotEqual,       // Equal, Not
+    GreaterEqual,   // Less, Not
+    LessEqual,      // Greater, Not
+    JumpIfFalsePop, // JumpIfFalse that always pops the condition
+    AddLocalConst,  // GetLocal slot, Constant k, Add
+    IncrLocal,      // AddLocalConst slot k, Setlocal slot, Pop
+    JumpIfTruePop,  // Not, JumpIfFalsePop; produced by the optimizer
+    // Calls the value below the arguments, which stay where they are and become the callee's first locals.
+    Call,
+    // Call in tail position: the callee replaces the running function in its frame. Always followed by a
+    // Return, for when it is not taken (a jump over it lands on that Return).
+    TailCall,
+    // Variables of enclosing functions, by their index in the running closure.
+    GetUpvalue,
+    SetUpvalue,
+    // Pop for a local captured by a closure: the upvalue takes the value over.
+    CloseUpvalue,
+    // Wraps a function constant in a closure holding the variables its captures name; and its long form.
+    Closure,
+    ClosureLong,
+    // Quickened forms, never emitted: the VM rewrites a generic instruction in place once it has run it
+    // on numbers, and the quickened one back as soon as its operands are anything else.
+    AddNumber,
+    SubtractNumber,
+    MultiplyNumber,
+    DivideNumber,
+    GreaterNumber,
+    LessNumber,
+    GreaterEqualNumber,
+    LessEqualNumber,
+    AddLocalConstNumber,
+    IncrLocalNumber,
+    Return,         // Keep last: opcode_count relies on it.
+};
+
+inline constexpr auto opcode_count = static_cast<std::size_t>(OpCode::Return) + 1;
+
+// Number of operand bytes following each opcode.
+[[nodiscard]] constexpr auto operand_size(OpCode op) noexcept -> std::size_t
+{
+    switch (op)
+    {
+    case OpCode::Constant:
+    case OpCode::GetLocal:
+    case OpCode::Setlocal:
+    case OpCode::GetGlobal:
+    case OpCode::DefineGlobal:
+    case OpCode::SetGlobal:
+    case OpCode::GetGlobalSlot:
+    case OpCode::SetGlobalSlot:
+    case OpCode::DefineGlobalSlot:
+    case OpCode::Call:
+    case OpCode::TailCall:
+    case OpCode::GetUpvalue:
+    case OpCode::SetUpvalue:
+    case OpCode::Closure: return 1;
+    case OpCode::Jump:
+    case OpCode::JumpIfFalse:
+    case OpCode::Loop:
+    case OpCode::GetGlobalSlotLong:
+    case OpCode::SetGlobalSlotLong:
+    case OpCode::DefineGlobalSlotLong:
+    case OpCode::JumpIfFalsePop:
+    case OpCode::AddLocalConst:
+    case OpCode::IncrLocal:
+    case OpCode::JumpIfTruePop:
+    case OpCode::AddLocalConstNumber:
+    case OpCode::IncrLocalNumber: return 2;
+    case OpCode::ConstantLong:
+    case OpCode::GetGlobalLong:
+    case OpCode::DefineGlobalLong:
+    case OpCode::SetGlobalLong:
+    case OpCode::ClosureLong: return 3;
+    default: return 0;
+    }
+}
+
+// How many values each instruction leaves on the stack, less how many it takes off. Conditional jumps
+// have the same effect whichever way they go. The calls also take off as many arguments as their operand
+// says.
+[[nodiscard]] constexpr auto stack_effect(OpCode op) noexcept -> int
+{
+    switch (op)
+    {
+    case OpCode::Constant:
+    case OpCode::ConstantLong:
+    case OpCode::Nil:
+    case OpCode::True:
+    case OpCode::False:
+    case OpCode::GetLocal:
+    case OpCode::GetGlobal:
+    case OpCode::GetGlobalLong:
+    case OpCode::GetGlobalSlot:
+    case OpCode::GetGlobalSlotLong:
+    case OpCode::AddLocalConst:
+    case OpCode::AddLocalConstNumber:
+    case OpCode::GetUpvalue:
+    case OpCode::Closure:
+    case OpCode::ClosureLong: return 1;
+    case OpCode::Pop:
+    case OpCode::CloseUpvalue:
+    case OpCode::Print:
+    case OpCode::DefineGlobal:
+    case OpCode::DefineGlobalLong:
+    case OpCode::DefineGlobalSlot:
+    case OpCode::DefineGlobalSlotLong:
+    case OpCode::Equal:
+    case OpCode::NotEqual:
+    case OpCode::Greater:
+    case OpCode::GreaterEqual:
+    case OpCode::Less:
+    case OpCode::LessEqual:
+    case OpCode::Add:
+    case OpCode::Subtract:
+    case OpCode::Mutliply:
+    case OpCode::Divide:
+    case OpCode::AddNumber:
+    case OpCode::SubtractNumber:
+    case OpCode::MultiplyNumber:
+    case OpCode::DivideNumber:
+    case OpCode::GreaterNumber:
+    case OpCode::LessNumber:
+    case OpCode::GreaterEqualNumber:
+    case OpCode::LessEqualNumber:
+    case OpCode::JumpIfFalsePop:
+    case OpCode::JumpIfTruePop: return -1;
+    default: return 0;
+    }
+}
+
+// The long form of an instruction taking a constant index or global slot, and its operand width.
+[[nodiscard]] constexpr auto long_form(OpCode op) noexcept -> std::pair<OpCode, std::size_t>
+{
+    switch (op)
+    {
+    case OpCode::Constant: return { OpCode::ConstantLong, 3 };
+    case OpCode::GetGlobal: return { OpCode::GetGlobalLong, 3 };
+    case OpCode::DefineGlobal: return { OpCode::DefineGlobalLong, 3 };
+    case OpCode::SetGlobal: return { OpCode::SetGlobalLong, 3 };
+    case OpCode::GetGlobalSlot: return { OpCode::GetGlobalSlotLong, 2 };
+    case OpCode::SetGlobalSlot: return { OpCode::SetGlobalSlotLong, 2 };
+    case OpCode::DefineGlobalSlot: return { OpCode::DefineGlobalSlotLong, 2 };
+    case OpCode::Closure: return { OpCode::ClosureLong, 3 };
+    default: return { op, 1 };
+    }
+}
+
+// Instruction set of the register engine. Every instruction is one 32-bit word, either
+// op | A << 8 | B << 16 | C << 24 or op | A << 8 | Bx << 16. A always names a register;
+// B and C are "RK" operands, a register below registers::constant_flag and a constant above it.
+enum class RegOp : std::uint8_t
+{
+    LoadConstant,     // R[A] = K[Bx]
+    LoadNil,          // R[A] = nil
+    LoadTrue,         // R[A] = true
+    LoadFalse,        // R[A] = false
+    Move,             // R[A] = R[B]
+    GetGlobal,        // R[A] = globals[K[Bx]]
+    DefineGlobal,     // globals[K[Bx]] = R[A]
+    SetGlobal,        // globals[K[Bx]] = R[A]
+    GetGlobalSlot,    // R[A] = global slot Bx
+    DefineGlobalSlot, // global slot Bx = R[A]
+    SetGlobalSlot,    // global slot Bx = R[A]
+    Equal,            // R[A] = RK[B] == RK[C]
+    Greater,          // R[A] = RK[B] > RK[C]
+    Less,             // R[A] = RK[B] < RK[C]
+    Add,              // R[A] = RK[B] + RK[C]
+    Subtract,         // R[A] = RK[B] - RK[C]
+    Multiply,         // R[A] = RK[B] * RK[C]
+    Divide,           // R[A] = RK[B] / RK[C]
+    Not,              // R[A] = !RK[B]
+    Negate,           // R[A] = -RK[B]
+    Print,            // print RK[B]
+    Jump,             // pc += sBx
+    JumpIfFalse,      // if !R[A]: pc += sBx
+    JumpIfTrue,       // if R[A]: pc += sBx
+    Loop,             // pc += sBx, backwards; a GC safepoint
+    Return,           // Keep last: register_opcode_count relies on it.
+};
+
+inline constexpr auto register_opcode_count = static_cast<std::size_t>(RegOp::Return) + 1;
+
+namespace registers
+{
+    inline constexpr std::size_t instruction_size = sizeof(std::uint32_t);
+
+    // RK operands at or above this value refer to constant (operand - constant_flag).
+    inline constexpr std::uint8_t constant_flag = 0x80;
+    inline constexpr std::size_t max_registers = constant_flag;
+    inline constexpr std::size_t max_rk_constants = 0x100 - constant_flag;
+
+    [[nodiscard]] constexpr auto encode(RegOp op, std::uint8_t a, std::uint8_t b = 0, std::uint8_t c = 0) noexcept
+    -> std::uint32_t
+    {
+        return static_cast<std::uint32_t>(op) | (static_cast<std::uint32_t>(a) << 8)
+               | (static_cast<std::uint32_t>(b) << 16) | (static_cast<std::uint32_t>(c) << 24);
+    }
+
+    [[nodiscard]] constexpr auto encode_bx(RegOp op, std::uint8_t a, std::uint16_t bx) noexcept -> std::uint32_t
+    {
+        return static_cast<std::uint32_t>(op) | (static_cast<std::uint32_t>(a) << 8)
+               | (static_cast<std::uint32_t>(bx) << 16);
+    }
+
+    [[nodiscard]] constexpr auto with_a(std::uint32_t word, std::uint8_t a) noexcept -> std::uint32_t
+    {
+        return (word & ~0xFF00U) | (static_cast<std::uint32_t>(a) << 8);
+    }
+
+    [[nodiscard]] constexpr auto with_bx(std::uint32_t word, std::uint16_t bx) noexcept -> std::uint32_t
+    {
+        return (word & 0xFFFFU) | (static_cast<std::uint32_t>(bx) << 16);
+    }
+
+    [[nodiscard]] constexpr auto opcode(std::uint32_t word) noexcept -> RegOp
+    {
+        return static_cast<RegOp>(word & 0xFF);
+    }
+
+    [[nodiscard]] constexpr auto arg_a(std::uint32_t word) noexcept -> std::uint8_t
+    {
+        return static_cast<std::uint8_t>(word >> 8);
+    }
+
+    [[nodiscard]] constexpr auto arg_b(std::uint32_t word) noexcept -> std::uint8_t
+    {
+        return static_cast<std::uint8_t>(word >> 16);
+    }
+
+    [[nodiscard]] constexpr auto arg_c(std::uint32_t word) noexcept -> std::uint8_t
+    {
+        return static_cast<std::uint8_t>(word >> 24);
+    }
+
+    [[nodiscard]] constexpr auto arg_bx(std::uint32_t word) noexcept -> std::uint16_t
+    {
+        return static_cast<std::uint16_t>(word >> 16);
+    }
+
+    // Jump offsets are counted in instructions, relative to the one following the jump.
+    [[nodiscard]] constexpr auto arg_sbx(std::uint32_t word) noexcept -> std::int16_t
+    {
+        return static_cast<std::int16_t>(arg_bx(word));
+    }
+
+    [[nodiscard]] constexpr auto is_constant(std::uint8_t rk) noexcept -> bool
+    {
+        return rk >= constant_flag;
+    }
+} // namespace registers
+
+// Which interpreter loop a chunk was compiled for.
+enum class Engine : std::uint8_t
+{
+    Stack,
+    Register,
 };
 
 namespace debug
@@ -48,12 +322,50 @@ public:
     template <typename T>
     auto write(T byte, std::size_t line) -> void
     {
+        if (lines.empty() || lines.back().line != line)
+        {
+            lines.push_back(LineStart{ .offset = static_cast<std::uint32_t>(data.size()),
+                                       .line = static_cast<std::uint32_t>(line) });
+        }
         data.emplace_back(static_cast<std::byte>(byte));
-        lines.push_back(line);
     }
 
+    auto write_word(std::uint32_t word, std::size_t line) -> void
+    {
+        for (std::size_t i = 0; i < registers::instruction_size; i++)
+        {
+            write((word >> (8 * i)) & 0xFF, line);
+        }
+    }
+
+    [[nodiscard]] auto word_at(std::size_t offset) const noexcept -> std::uint32_t
+    {
+        return static_cast<std::uint32_t>(data[offset]) | (static_cast<std::uint32_t>(data[offset + 1]) << 8)
+               | (static_cast<std::uint32_t>(data[offset + 2]) << 16)
+               | (static_cast<std::uint32_t>(data[offset + 3]) << 24);
+    }
+
+    auto set_word(std::size_t offset, std::uint32_t word) -> void
+    {
+        for (std::size_t i = 0; i < registers::instruction_size; i++)
+        {
+            data[offset + i] = static_cast<std::byte>((word >> (8 * i)) & 0xFF);
+        }
+    }
+
+    // Identical constants share one slot. Numbers are matched by bit pattern, so 0 and -0 stay apart;
+    // objects by identity, which for interned strings is the same as by contents.
     auto add_constant(const Value& value) -> std::size_t
     {
+        if (value.is_number())
+        {
+            return pooled(number_constants, std::bit_cast<std::uint64_t>(value.as_number()), value);
+        }
+        if (value.is_obj())
+        {
+            return pooled(object_constants, static_cast<const Obj*>(value.as_obj()), value);
+        }
+
         constants.emplace_back(value);
         return constants.size() - 1;
     }
@@ -64,13 +376,179 @@ public:
         data[index] = value;
     }
 
+    [[nodiscard]] auto read(std::size_t index) const noexcept -> std::byte
+    {
+        return data[index];
+    }
+
+    // Drops the code but keeps the constants, for passes that re-emit a finished chunk.
+    auto clear_code() noexcept -> void
+    {
+        data.clear();
+        lines.clear();
+    }
+
+    // Drops everything from `new_size` on; used when instructions are rewritten into shorter ones.
+    auto truncate(std::size_t new_size) -> void
+    {
+        data.resize(new_size);
+        while (!lines.empty() && lines.back().offset >= new_size)
+        {
+            lines.pop_back();
+        }
+    }
+
+    // How far the code and the constant pool reach at some point during compilation.
+    struct Mark
+    {
+        std::size_t code;
+        std::size_t constants;
+    };
+
+    [[nodiscard]] auto mark() const noexcept -> Mark
+    {
+        return Mark{ .code = data.size(), .constants = constants.size() };
+    }
+
+    // Drops the constants from `count` on, which the caller knows only dropped code used, and forgets them
+    // for deduplication.
+    auto truncate_constants(std::size_t count) -> void
+    {
+        for (auto index = count; index < constants.size(); index++)
+        {
+            const auto& value = constants[index];
+            if (value.is_number())
+            {
+                number_constants.erase(std::bit_cast<std::uint64_t>(value.as_number()));
+            }
+            else if (value.is_obj())
+            {
+                object_constants.erase(static_cast<const Obj*>(value.as_obj()));
+            }
+        }
+        constants.resize(std::min(count, constants.size()));
+    }
+
+    // Source line of the byte at `offset`, found by binary search over the line runs.
+    [[nodiscard]] auto get_line(std::size_t offset) const noexcept -> std::size_t
+    {
+        const auto run = std::ranges::upper_bound(lines, offset, {}, &LineStart::offset);
+        return std::prev(run)->line;
+    }
+
     [[nodiscard]] auto size() const noexcept -> std::size_t
     {
         return data.size();
     }
 
+    [[nodiscard]] auto get_constants() const noexcept -> const ValueArray&
+    {
+        return constants;
+    }
+
+    [[nodiscard]] auto get_engine() const noexcept -> Engine
+    {
+        return engine;
+    }
+
+    // Most values the code ever has on the stack at once, on top of a function's callee and arguments, so
+    // the VM can make room for all of them before it starts. For register chunks, the registers; for stack
+    // chunks, found by following every path through the code. The compilers leave the same depth at a jump
+    // target whichever way it is reached, so each instruction only needs visiting once.
+    [[nodiscard]] auto max_stack_depth() const -> std::size_t
+    {
+        if (engine == Engine::Register)
+        {
+            return register_count;
+        }
+
+        std::size_t deepest = 0;
+        std::vector<bool> visited(data.size());
+        std::vector<std::pair<std::size_t, std::size_t>> pending{ { 0, 0 } };
+        while (!pending.empty())
+        {
+            auto [offset, depth] = pending.back();
+            pending.pop_back();
+
+            while (offset < data.size() && !visited[offset])
+            {
+                visited[offset] = true;
+                const auto op = static_cast<OpCode>(data[offset]);
+                depth = static_cast<std::size_t>(static_cast<std::ptrdiff_t>(depth) + stack_effect(op));
+                if (op == OpCode::Call || op == OpCode::TailCall)
+                {
+                    depth -= static_cast<std::size_t>(data[offset + 1]);
+                }
+                deepest = std::max(deepest, depth);
+                if (op == OpCode::Return)
+                {
+                    break;
+                }
+
+                const auto next = offset + 1 + operand_size(op);
+                if (op != OpCode::Jump && op != OpCode::Loop && op != OpCode::JumpIfFalse
+                    && op != OpCode::JumpIfFalsePop && op != OpCode::JumpIfTruePop)
+                {
+                    offset = next;
+                    continue;
+                }
+
+                const auto distance = (static_cast<std::size_t>(data[offset + 1]) << 8)
+                                      | static_cast<std::size_t>(data[offset + 2]);
+                const auto target = op == OpCode::Loop ? next - distance : next + distance;
+                if (op == OpCode::Jump || op == OpCode::Loop)
+                {
+                    offset = target;
+                    continue;
+                }
+
+                pending.emplace_back(target, depth);
+                offset = next;
+            }
+        }
+        return deepest;
+    }
+
+    // Only meaningful for register chunks: how many registers the code touches.
+    [[nodiscard]] auto get_register_count() const noexcept -> std::size_t
+    {
+        return register_count;
+    }
+
+    auto set_registers(std::size_t count) noexcept -> void
+    {
+        engine = Engine::Register;
+        register_count = count;
+    }
+
 private:
+    // Line numbers are run-length encoded: each entry covers the bytes from its offset up to the next one.
+    struct LineStart
+    {
+        std::uint32_t offset;
+        std::uint32_t line;
+    };
+
+    template <typename Key>
+    auto pooled(std::unordered_map<Key, std::size_t>& pool, Key key, const Value& value) -> std::size_t
+    {
+        const auto [slot, inserted] = pool.try_emplace(key, constants.size());
+        if (inserted)
+        {
+            constants.emplace_back(value);
+        }
+        return slot->second;
+    }
+
     std::vector<std::byte> data;
     ValueArray constants;
-    std::vector<std::size_t> lines;
+    std::unordered_map<std::uint64_t, std::size_t> number_constants;
+    std::unordered_map<const Obj*, std::size_t> object_constants;
+    std::vector<LineStart> lines;
+    Engine engine = Engine::Stack;
+    std::size_t register_count = 0;
+    // Run-time state owned by the VM, set up before the code first runs: the slot each constant naming a
+    // global resolved to, for the late-bound instructions (see Vm::cached_global), and max_stack_depth.
+    std::vector<std::size_t> global_cache;
+    std::size_t stack_depth = 0;
 };
\ No newline at end of file
@@ -1,10 +1,18 @@
 #pragma once
 
+#include "AstCompiler.hpp"
 #include "Chunk.hpp"
 #include "Debug.hpp"
+#include "Folding.hpp"
+#include "Globals.hpp"
+#include "Memory.hpp"
+#include "Parser.hpp"
+#include "Peephole.hpp"
+#include "RegisterCompiler.hpp"
 #include "Scanner.hpp"
 #include "Value.hpp"
 
+#include <algorithm>
 #include <array>
 #include <charconv>
 #include <cstdint>
@@ -15,23 +23,10 @@
 #include <string>
 #include <string_view>
 #include <type_traits>
+#include <utility>
+#include <vector>
 
 
-enum class Precedence : std::uint8_t
-{
-    NONE,
-    ASSIGNMENT, // =
-    OR,         // or
-    AND,        // and
-    EQUALITY,   // == !=
-    COMPARISON, // < > <= >=
-    TERM,       // + -
-    FACTOR,     // * /
-    UNARY,      // ! -
-    CALL,       // . ()
-    PRIMARY
-};
-
 class Compiler;
 using ParseFn = void (Compiler::*)(bool);
 
@@ -68,9 +63,21 @@ public:
         return token;
     }
 
+    auto capture() noexcept -> void
+    {
+        captured = true;
+    }
+
+    // Whether a closure uses the variable, which then has to be closed rather than popped.
+    [[nodiscard]] auto is_captured() const noexcept -> bool
+    {
+        return captured;
+    }
+
 private:
     Token token{ TokenType::Eof };
     int depth = -1;
+    bool captured = false;
 };
 
 enum class FunctionType : std::uint8_t
@@ -82,6 +89,15 @@ enum class FunctionType : std::uint8_t
 class CompilerState
 {
 public:
+    // A function's slot 0 holds the function being called, so its parameters and locals start at 1.
+    explicit CompilerState(FunctionType function_type = FunctionType::Script) : function_type{ function_type }
+    {
+        if (function_type == FunctionType::Function)
+        {
+            locals[local_count++] = Local{ Token{ TokenType::Eof }, 0 };
+        }
+    }
+
     auto begin_scope() noexcept -> void
     {
         scope_depth++;
@@ -93,12 +109,13 @@ public:
     }
 
 
+    // Calls `func` with each local going out of scope, innermost first.
     template <typename F>
     auto clean_scope(F func) -> void
     {
-        while (local_count > 0 && locals[local_count - 1].get_depth() < scope_depth)
+        while (local_count > 0 && locals[local_count - 1].get_depth() > static_cast<int>(scope_depth))
         {
-            std::invoke(func);
+            std::invoke(func, locals[local_count - 1]);
             local_count--;
         }
     }
@@ -148,6 +165,30 @@ public:
         locals[index].set_depth(depth);
     }
 
+    auto capture_local(std::size_t index) noexcept -> void
+    {
+        locals[index].capture();
+    }
+
+    // The index of the function's upvalue for `capture`, adding it on first use; nothing once there are
+    // more than an operand can address.
+    [[nodiscard]] auto add_upvalue(Function::Capture capture) -> std::optional<std::size_t>
+    {
+        const auto& captures = function.get_captures();
+        if (const auto found = std::ranges::find(captures, capture); found != captures.end())
+        {
+            return static_cast<std::size_t>(found - captures.begin());
+        }
+
+        if (captures.size() == locals.size())
+        {
+            return std::nullopt;
+        }
+
+        function.add_capture(capture);
+        return captures.size() - 1;
+    }
+
     [[nodiscard]] auto get_scope_depth() const noexcept -> std::size_t
     {
         return scope_depth;
@@ -168,6 +209,11 @@ public:
         return function;
     }
 
+    [[nodiscard]] auto get_function_type() const noexcept -> FunctionType
+    {
+        return function_type;
+    }
+
 private:
     Function function;
     FunctionType function_type = FunctionType::Script;
@@ -177,31 +223,67 @@ private:
     std::size_t scope_depth = 0;
 };
 
-struct Parser
-{
-    Token previous{ Token{ TokenType::Eof } };
-    Token current{ Token{ TokenType::Eof } };
-    bool had_error = false;
-    bool panic_mode = false;
-};
-
 class Compiler
 {
 public:
-    explicit Compiler(std::string_view source) : scanner{ source }
+    Compiler(std::string_view source, Heap& heap, Globals& globals)
+    : source{ source }, parser{ source }, heap{ heap }, globals{ globals }
     {
     }
 
-    std::optional<Chunk> compile()
+    // The optimizers only know the stack instruction set; register chunks are produced as they are.
+    // The register engine has no calls, so a script that may use functions is compiled for the stack
+    // engine at `level` instead: the chunk's get_engine() reports which one it was compiled for.
+    std::optional<Chunk> compile(Engine engine = Engine::Stack, Optimization level = Optimization::None)
     {
+        if (engine == Engine::Register && RegisterCompiler::supports(source))
+        {
+            return RegisterCompiler{ source, heap, globals }.compile();
+        }
+
+        optimization = level;
+        peephole_stats = PeepholeStats{};
+        ast_stats = AstStats{};
+
+        if (optimization >= Optimization::Ast)
+        {
+            AstCompiler ast_compiler{ source, heap, globals };
+            auto chunk = ast_compiler.compile();
+            peephole_stats = ast_compiler.get_peephole_stats();
+            ast_stats = ast_compiler.get_stats();
+            return chunk;
+        }
+
         current_state = CompilerState{};
+        enclosing.clear();
+        defined_globals.clear();
+        last_instruction = no_instruction;
+        previous_instruction = no_instruction;
+        jump_target = 0;
+
+        // Constants are only reachable through the chunks being built until the VM takes them over.
+        const auto roots = heap.add_roots(
+        [this](Heap& gc)
+        {
+            for (const auto& constant : current_chunk().get_constants())
+            {
+                gc.mark_value(constant);
+            }
+            for (auto& outer : enclosing)
+            {
+                for (const auto& constant : outer.state.func().chunk().get_constants())
+                {
+                    gc.mark_value(constant);
+                }
+            }
+        });
 
         parser.panic_mode = false;
         parser.had_error = false;
 
-        advance();
+        parser.advance();
 
-        while (!match(TokenType::Eof))
+        while (!parser.match(TokenType::Eof))
         {
             declaration();
         }
@@ -216,33 +298,28 @@ public:
         return current_chunk();
     }
 
-private:
-    auto advance() -> void
+    // What the optimizer did to the last chunk compiled with Optimization::Peephole or above.
+    [[nodiscard]] auto get_peephole_stats() const noexcept -> const PeepholeStats&
     {
-        parser.previous = parser.current;
-
-        for (;;)
-        {
-            parser.current = scanner.scan_token();
-            if (parser.current.get_type() != TokenType::ERROR)
-            {
-                break;
-            }
-            error_at_current(parser.current.get_lexme());
-        }
+        return peephole_stats;
     }
 
-    auto consume(TokenType token_type, std::string_view message) -> void
+    // What the tree passes did to the last chunk compiled with Optimization::Ast.
+    [[nodiscard]] auto get_ast_stats() const noexcept -> const AstStats&
     {
-        if (parser.current.get_type() == token_type)
-        {
-            advance();
-            return;
-        }
-
-        error_at_current(message);
+        return ast_stats;
     }
 
+private:
+    // What is put aside while a nested function is compiled.
+    struct EnclosingFunction
+    {
+        CompilerState state;
+        std::size_t last_instruction;
+        std::size_t previous_instruction;
+        std::size_t jump_target;
+    };
+
     auto expression() -> void
     {
         parse_precedence(Precedence::ASSIGNMENT);
@@ -250,19 +327,19 @@ private:
 
     auto block() -> void
     {
-        while (!check(TokenType::RIGHT_BRACE) && !check(TokenType::Eof))
+        while (!parser.check(TokenType::RIGHT_BRACE) && !parser.check(TokenType::Eof))
         {
             declaration();
         }
 
-        consume(TokenType::RIGHT_BRACE, "Expect '}' after block.");
+        parser.consume(TokenType::RIGHT_BRACE, "Expect '}' after block.");
     }
 
     auto var_declaration() -> void
     {
         const auto global = parse_variable("Expect variable name.");
 
-        if (match(TokenType::EQUAL))
+        if (parser.match(TokenType::EQUAL))
         {
             expression();
         }
@@ -271,14 +348,150 @@ private:
             emit_byte(OpCode::Nil);
         }
 
-        consume(TokenType::SEMICOLON, "Expect ';' after variable declaration.");
+        parser.consume(TokenType::SEMICOLON, "Expect ';' after variable declaration.");
+
+        define_variable(global);
+    }
+
+    auto fun_declaration() -> void
+    {
+        const auto global = parse_variable("Expect function name.");
+
+        // The body may refer to the function itself: it can only run once the declaration has.
+        if (current_state.get_scope_depth() > 0)
+        {
+            mark_initialized();
+        }
+        else
+        {
+            mark_global_defined(global);
+        }
 
+        function(FunctionType::Function);
         define_variable(global);
     }
 
-    auto parse_variable(std::string_view error_message) -> std::uint8_t
+    // Compiles the parameters and body of a function and leaves it as a constant of the enclosing chunk.
+    auto function(FunctionType type) -> void
+    {
+        begin_function(type);
+        begin_scope();
+
+        parser.consume(TokenType::LEFT_PAREN, "Expect '(' after function name.");
+        if (!parser.check(TokenType::RIGHT_PAREN))
+        {
+            do
+            {
+                auto& function = current_state.func();
+                function.set_arity(function.get_arity() + 1);
+                if (function.get_arity() > max_arguments)
+                {
+                    parser.error_at_current("Can't have more than 255 parameters.");
+                }
+
+                define_variable(parse_variable("Expect parameter name."));
+            } while (parser.match(TokenType::COMMA));
+        }
+        parser.consume(TokenType::RIGHT_PAREN, "Expect ')' after parameters.");
+        parser.consume(TokenType::LEFT_BRACE, "Expect '{' before function body.");
+        block();
+
+        // No end_scope: returning discards the whole frame.
+        end_function();
+    }
+
+    auto begin_function(FunctionType type) -> void
     {
-        consume(TokenType::IDENTIFIER, error_message);
+        enclosing.push_back(EnclosingFunction{ .state = std::move(current_state),
+                                               .last_instruction = last_instruction,
+                                               .previous_instruction = previous_instruction,
+                                               .jump_target = jump_target });
+        current_state = CompilerState{ type };
+        current_state.func().set_name(std::string{ parser.previous.get_lexme() });
+        last_instruction = no_instruction;
+        previous_instruction = no_instruction;
+        jump_target = 0;
+    }
+
+    auto end_function() -> void
+    {
+        end_compiler();
+
+        // Allocated while the roots still reach the constants through the function being moved.
+        auto* function = heap.allocate<ObjFunction>(std::move(current_state.func()));
+        const auto captures = !function->function.get_captures().empty();
+
+        auto outer = std::move(enclosing.back());
+        enclosing.pop_back();
+        current_state = std::move(outer.state);
+        last_instruction = outer.last_instruction;
+        previous_instruction = outer.previous_instruction;
+        jump_target = outer.jump_target;
+
+        if (captures)
+        {
+            emit_operand(OpCode::Closure, make_constant(values::make(function)));
+        }
+        else
+        {
+            emit_constant(values::make(function));
+        }
+    }
+
+    auto call([[maybe_unused]] bool can_assign) -> void
+    {
+        const auto argument_count = argument_list();
+        emit_bytes(OpCode::Call, argument_count);
+    }
+
+    auto argument_list() -> std::uint8_t
+    {
+        std::size_t count = 0;
+        if (!parser.check(TokenType::RIGHT_PAREN))
+        {
+            do
+            {
+                expression();
+                if (count == max_arguments)
+                {
+                    parser.error("Can't have more than 255 arguments.");
+                }
+                count++;
+            } while (parser.match(TokenType::COMMA));
+        }
+        parser.consume(TokenType::RIGHT_PAREN, "Expect ')' after arguments.");
+        return static_cast<std::uint8_t>(count);
+    }
+
+    auto return_statement() -> void
+    {
+        if (current_state.get_function_type() == FunctionType::Script)
+        {
+            parser.error("Can't return from top-level code.");
+        }
+
+        if (parser.match(TokenType::SEMICOLON))
+        {
+            emit_return();
+            return;
+        }
+
+        expression();
+        parser.consume(TokenType::SEMICOLON, "Expect ';' after return value.");
+
+        // The call computing the returned value can take over this frame. A jump may land after it (as in
+        // `return a and f();`), so the Return stays.
+        if (last_instruction != no_instruction
+            && static_cast<OpCode>(current_chunk().read(last_instruction)) == OpCode::Call)
+        {
+            current_chunk().set(last_instruction, static_cast<std::byte>(OpCode::TailCall));
+        }
+        emit_byte(OpCode::Return);
+    }
+
+    auto parse_variable(std::string_view error_message) -> std::size_t
+    {
+        parser.consume(TokenType::IDENTIFIER, error_message);
 
         declare_variable();
 
@@ -287,19 +500,47 @@ private:
             return 0;
         }
 
-        return identifier_constant(parser.previous);
+        return declare_global(parser.previous);
+    }
+
+    auto identifier_constant(const Token& token) -> std::size_t
+    {
+        return make_constant(values::make(heap.make_string(token.get_lexme())));
+    }
+
+    auto declare_global(const Token& token) -> std::size_t
+    {
+        auto* name = heap.make_string(token.get_lexme());
+        heap.write_barrier(values::make(name));
+        return globals.declare(name);
     }
 
-    auto identifier_constant(const Token& token) -> std::uint8_t
+    // A global can be accessed by slot once it is certain to be defined by the time this code runs:
+    // either it already is, or a top-level `var` earlier in this script defines it. Anything else is
+    // looked up by name at runtime.
+    [[nodiscard]] auto resolve_global(const Token& token) -> std::optional<std::size_t>
     {
-        return make_constant(std::string{ token.get_lexme().begin(), token.get_lexme().end() });
+        // Names no string was ever made for can't be globals; looking them up needn't intern them.
+        auto* const name = heap.find_interned(token.get_lexme());
+        const auto slot = name != nullptr ? globals.find(name) : std::nullopt;
+        if (!slot || *slot > std::numeric_limits<std::uint16_t>::max())
+        {
+            return std::nullopt;
+        }
+
+        if (!globals.is_defined(*slot) && (*slot >= defined_globals.size() || !defined_globals[*slot]))
+        {
+            return std::nullopt;
+        }
+
+        return slot;
     }
 
     auto add_local(const Token& token) -> void
     {
         if (!current_state.add_local(token))
         {
-            error("Too many local variables in function.");
+            parser.error("Too many local variables in function.");
         }
     }
 
@@ -312,7 +553,7 @@ private:
 
         if (current_state.find(parser.previous) != -1)
         {
-            error("Already a variable with this name in this scope.");
+            parser.error("Already a variable with this name in this scope.");
         }
 
         add_local(parser.previous);
@@ -323,7 +564,7 @@ private:
         current_state.set_local_depth(current_state.get_local_count() - 1, static_cast<int>(current_state.get_scope_depth()));
     }
 
-    auto define_variable(std::uint8_t global) -> void
+    auto define_variable(std::size_t global) -> void
     {
         if (current_state.get_scope_depth() > 0)
         {
@@ -331,7 +572,25 @@ private:
             return;
         }
 
-        emit_bytes(OpCode::DefineGlobal, global);
+        if (global <= std::numeric_limits<std::uint16_t>::max())
+        {
+            emit_operand(OpCode::DefineGlobalSlot, global);
+        }
+        else
+        {
+            emit_operand(OpCode::DefineGlobal, make_constant(values::make(globals.name(global))));
+        }
+
+        mark_global_defined(global);
+    }
+
+    auto mark_global_defined(std::size_t global) -> void
+    {
+        if (global >= defined_globals.size())
+        {
+            defined_globals.resize(global + 1);
+        }
+        defined_globals[global] = true;
     }
 
     auto and_([[maybe_unused]] bool can_assign) -> void
@@ -350,7 +609,7 @@ private:
         const auto end_jump = emit_jump(OpCode::Jump);
 
         patch_jump(static_cast<int>(else_jump));
-        emit_jump(OpCode::Pop);
+        emit_byte(OpCode::Pop);
 
         parse_precedence(Precedence::OR);
         patch_jump(static_cast<int>(end_jump));
@@ -359,7 +618,7 @@ private:
     auto expression_statement() -> void
     {
         expression();
-        consume(TokenType::SEMICOLON, "Expect ';' after expression.");
+        parser.consume(TokenType::SEMICOLON, "Expect ';' after expression.");
         emit_byte(OpCode::Pop);
     }
 
@@ -367,12 +626,12 @@ private:
     {
         begin_scope();
 
-        consume(TokenType::LEFT_PAREN, "Expect '(' after 'for'.");
+        parser.consume(TokenType::LEFT_PAREN, "Expect '(' after 'for'.");
 
-        if (match(TokenType::SEMICOLON))
+        if (parser.match(TokenType::SEMICOLON))
         {
         }
-        else if (match(TokenType::VAR))
+        else if (parser.match(TokenType::VAR))
         {
             var_declaration();
         }
@@ -383,26 +642,27 @@ private:
 
 
         int loop_start = current_chunk().size();
+        mark_jump_target();
 
         int exit_jump = -1;
 
-        if (!match(TokenType::SEMICOLON))
+        if (!parser.match(TokenType::SEMICOLON))
         {
             expression();
-            consume(TokenType::SEMICOLON, "Expect ';' after loop condition.");
+            parser.consume(TokenType::SEMICOLON, "Expect ';' after loop condition.");
 
-            exit_jump = static_cast<int>(emit_jump(OpCode::JumpIfFalse));
-            emit_byte(OpCode::Pop);
+            exit_jump = static_cast<int>(emit_jump(OpCode::JumpIfFalsePop));
         }
 
-        if (!match(TokenType::RIGHT_PAREN))
+        if (!parser.match(TokenType::RIGHT_PAREN))
         {
             const auto body_jump = emit_jump(OpCode::Jump);
             auto increment_start = current_chunk().size();
+            mark_jump_target();
             expression();
             emit_byte(OpCode::Pop);
 
-            consume(TokenType::RIGHT_PAREN, "Expect ')' after for clauses.");
+            parser.consume(TokenType::RIGHT_PAREN, "Expect ')' after for clauses.");
 
             emit_loop(loop_start);
             loop_start = increment_start;
@@ -414,7 +674,6 @@ private:
         if (exit_jump != -1)
         {
             patch_jump(exit_jump);
-            emit_byte(OpCode::Pop);
         }
 
         end_scope();
@@ -435,47 +694,102 @@ private:
 
         if (jump > std::numeric_limits<std::uint16_t>::max())
         {
-            error("Too much code to jump over.");
+            parser.error("Too much code to jump over.");
         }
 
         current_chunk().set(offset, static_cast<std::byte>((jump >> 8) & 0xFF));
         current_chunk().set(offset + 1, static_cast<std::byte>(jump & 0xFF));
+        mark_jump_target();
+    }
+
+    // The value pushed by the instruction at `start`, if it is a literal that no jump lands after: only
+    // then can it be replaced without changing where control flow goes. Callers make sure the operand
+    // is that one instruction.
+    [[nodiscard]] auto literal_operand(std::size_t start) -> std::optional<Value>
+    {
+        if (start == no_instruction || jump_target > start)
+        {
+            return std::nullopt;
+        }
+
+        auto& chunk = current_chunk();
+        switch (static_cast<OpCode>(chunk.read(start)))
+        {
+        case OpCode::Nil: return values::make(Nil{});
+        case OpCode::True: return values::make(true);
+        case OpCode::False: return values::make(false);
+        case OpCode::Constant: return chunk.get_constants()[static_cast<std::size_t>(chunk.read(start + 1))];
+        case OpCode::ConstantLong:
+        {
+            std::size_t constant = 0;
+            for (std::size_t i = 1; i <= 3; i++)
+            {
+                constant = (constant << 8) | static_cast<std::size_t>(chunk.read(start + i));
+            }
+            return chunk.get_constants()[constant];
+        }
+        default: return std::nullopt;
+        }
+    }
+
+    // Drops the operand instructions from `operands.code` on, with the constants only they used, and emits
+    // `value` in their place, picking the instruction history back up from `before`, the instruction
+    // preceding them.
+    auto replace_with_literal(const Chunk::Mark& operands, std::size_t before, const Value& value) -> void
+    {
+        current_chunk().truncate(operands.code);
+        current_chunk().truncate_constants(operands.constants);
+        last_instruction = before;
+
+        if (values::is<Boolean>(value))
+        {
+            emit_byte(values::as<Boolean>(value) ? OpCode::True : OpCode::False);
+        }
+        else
+        {
+            emit_constant(value);
+        }
+    }
+
+    // Nothing emitted before this point may be fused with what comes after it.
+    auto mark_jump_target() noexcept -> void
+    {
+        jump_target = current_chunk().size();
     }
 
     auto if_statement() -> void
     {
-        consume(TokenType::LEFT_PAREN, "Expect '(' after 'if'.");
+        parser.consume(TokenType::LEFT_PAREN, "Expect '(' after 'if'.");
         expression();
-        consume(TokenType::RIGHT_PAREN, "Expect ')' after condition.");
+        parser.consume(TokenType::RIGHT_PAREN, "Expect ')' after condition.");
 
-        const auto then_jump = emit_jump(OpCode::JumpIfFalse);
-        emit_byte(OpCode::Pop);
+        const auto then_jump = emit_jump(OpCode::JumpIfFalsePop);
         statement();
 
-        const auto else_jump = emit_jump(OpCode::Jump);
-
-        patch_jump(static_cast<int>(then_jump));
-        emit_byte(OpCode::Pop);
-
-        if (match(TokenType::ELSE))
+        if (parser.match(TokenType::ELSE))
         {
+            const auto else_jump = emit_jump(OpCode::Jump);
+            patch_jump(static_cast<int>(then_jump));
             statement();
+            patch_jump(static_cast<int>(else_jump));
+        }
+        else
+        {
+            patch_jump(static_cast<int>(then_jump));
         }
-
-        patch_jump(else_jump);
     }
 
     auto emit_constant(const Value& value) -> void
     {
-        emit_bytes(OpCode::Constant, make_constant(value));
+        emit_operand(OpCode::Constant, make_constant(value));
     }
 
-    auto make_constant(const Value& value) -> std::uint8_t
+    auto make_constant(const Value& value) -> std::size_t
     {
         const auto constant = current_chunk().add_constant(value);
-        if (constant > std::numeric_limits<std::uint8_t>::max())
+        if (constant >= max_constants)
         {
-            error("Too many constants in one chunk.");
+            parser.error("Too many constants in one chunk.");
             return 0;
         }
         return constant;
@@ -502,7 +816,8 @@ private:
 
     auto string([[maybe_unused]] bool can_assign) -> void
     {
-        emit_constant(std::string{ parser.previous.get_lexme().begin() + 1, parser.previous.get_lexme().end() - 1 });
+        const auto lexme = parser.previous.get_lexme();
+        emit_constant(values::make(heap.make_string(lexme.substr(1, lexme.size() - 2))));
     }
 
     auto variable(bool can_assign) -> void
@@ -514,24 +829,40 @@ private:
     {
         auto arg = resolve_local(token);
 
-        auto get_op = static_cast<std::uint8_t>(OpCode::GetLocal);
-        auto set_op = static_cast<std::uint8_t>(OpCode::Setlocal);
+        auto get_op = OpCode::GetLocal;
+        auto set_op = OpCode::Setlocal;
+
+        if (arg == -1)
+        {
+            arg = resolve_upvalue(current_state, enclosing.size(), token);
+            get_op = OpCode::GetUpvalue;
+            set_op = OpCode::SetUpvalue;
+        }
 
         if (arg == -1)
         {
-            arg = identifier_constant(token);
-            get_op = static_cast<std::uint8_t>(OpCode::GetGlobal);
-            set_op = static_cast<std::uint8_t>(OpCode::SetGlobal);
+            if (const auto slot = resolve_global(token))
+            {
+                arg = static_cast<int>(*slot);
+                get_op = OpCode::GetGlobalSlot;
+                set_op = OpCode::SetGlobalSlot;
+            }
+            else
+            {
+                arg = static_cast<int>(identifier_constant(token));
+                get_op = OpCode::GetGlobal;
+                set_op = OpCode::SetGlobal;
+            }
         }
 
-        if (can_assign && match(TokenType::EQUAL))
+        if (can_assign && parser.match(TokenType::EQUAL))
         {
             expression();
-            emit_bytes(set_op, arg);
+            emit_operand(set_op, static_cast<std::size_t>(arg));
         }
         else
         {
-            emit_bytes(get_op, arg);
+            emit_operand(get_op, static_cast<std::size_t>(arg));
         }
     }
 
@@ -541,25 +872,79 @@ private:
 
         if (found == -2)
         {
-            error("Can't read local variable in its own initializer.");
+            parser.error("Can't read local variable in its own initializer.");
         }
 
         return found;
     }
 
+    // Finds `token` among the locals of the functions enclosing the one `state` compiles, which are the
+    // first `depth` entries of `enclosing`, and threads an upvalue for it through every function in
+    // between. The index of `state`'s upvalue, or -1 when it is no such local.
+    auto resolve_upvalue(CompilerState& state, std::size_t depth, const Token& token) -> int
+    {
+        if (depth == 0)
+        {
+            return -1;
+        }
+
+        auto& outer = enclosing[depth - 1].state;
+        auto capture = Function::Capture{ .index = 0, .is_local = true };
+        const auto local = outer.find(token);
+        if (local == -2)
+        {
+            // The variable is in scope, so it must not be taken for a global of the same name.
+            parser.error("Can't read local variable in its own initializer.");
+            return 0;
+        }
+        if (local >= 0)
+        {
+            outer.capture_local(static_cast<std::size_t>(local));
+            capture.index = static_cast<std::uint8_t>(local);
+        }
+        else if (const auto upvalue = resolve_upvalue(outer, depth - 1, token); upvalue >= 0)
+        {
+            capture = Function::Capture{ .index = static_cast<std::uint8_t>(upvalue), .is_local = false };
+        }
+        else
+        {
+            return -1;
+        }
+
+        const auto index = state.add_upvalue(capture);
+        if (!index)
+        {
+            parser.error("Too many closure variables in function.");
+            return 0;
+        }
+        return static_cast<int>(*index);
+    }
+
 
     auto grouping([[maybe_unused]] bool can_assign) -> void
     {
         expression();
-        consume(TokenType::RIGHT_PAREN, "Expect ')' after expression.");
+        parser.consume(TokenType::RIGHT_PAREN, "Expect ')' after expression.");
     }
 
     auto unary([[maybe_unused]] bool can_assign) -> void
     {
         const auto operator_type = parser.previous.get_type();
+        const auto before_operand = last_instruction;
+        const auto operand_start = current_chunk().mark();
 
         parse_precedence(Precedence::UNARY);
 
+        if (last_instruction == operand_start.code)
+        {
+            const auto operand = literal_operand(operand_start.code);
+            if (const auto folded = operand ? folding::unary(operator_type, *operand) : std::nullopt)
+            {
+                replace_with_literal(operand_start, before_operand, *folded);
+                return;
+            }
+        }
+
         switch (operator_type)
         {
         case TokenType::MINUS: emit_byte(OpCode::Negate); break;
@@ -572,8 +957,33 @@ private:
     auto binary([[maybe_unused]] bool can_assign) -> void
     {
         const auto operator_type = parser.previous.get_type();
+        // Only meaningful if the left operand turns out to be a literal, i.e. the last instruction.
+        const auto lhs_start = last_instruction;
+        const auto before_lhs = previous_instruction;
+        const auto lhs_expression = infix_lhs;
+        const auto rhs_start = current_chunk().mark();
+
         ParseRule rule = get_rule(operator_type);
-        parse_precedence(static_cast<Precedence>(static_cast<std::underlying_type_t<Precedence>>(rule.precedence) + 1));
+        parse_precedence(next_precedence(rule.precedence));
+
+        if (previous_instruction == lhs_start && last_instruction == rhs_start.code)
+        {
+            const auto lhs = literal_operand(lhs_start);
+            const auto rhs = literal_operand(rhs_start.code);
+            if (lhs && rhs)
+            {
+                if (const auto folded = folding::binary(operator_type, *lhs, *rhs, heap))
+                {
+                    // The constants added since the left operand's expression began are the operands' own,
+                    // unless that expression emitted more than the literal.
+                    const auto operands = lhs_expression.code == lhs_start
+                                          ? lhs_expression
+                                          : Chunk::Mark{ .code = lhs_start, .constants = rhs_start.constants };
+                    replace_with_literal(operands, before_lhs, *folded);
+                    return;
+                }
+            }
+        }
 
         switch (operator_type)
         {
@@ -594,51 +1004,42 @@ private:
 
     auto parse_precedence(Precedence precedence) -> void
     {
-        advance();
+        parser.advance();
         const auto type = parser.previous.get_type();
         auto prefix_rule = get_rule(type).prefix;
         if (prefix_rule == nullptr)
         {
-            error("Expected expression.");
+            parser.error("Expected expression.");
             return;
         }
 
         const auto can_assign = precedence <= Precedence::ASSIGNMENT;
+        const auto start = current_chunk().mark();
 
         std::invoke(prefix_rule, this, can_assign);
 
 
         while (precedence <= get_rule(parser.current.get_type()).precedence)
         {
-            advance();
+            parser.advance();
             auto infix_rule = get_rule(parser.previous.get_type()).infix;
+            infix_lhs = start;
             std::invoke(infix_rule, this, can_assign);
         }
 
-        if (can_assign && match(TokenType::EQUAL))
+        if (can_assign && parser.match(TokenType::EQUAL))
         {
-            error("Invalid assignment target.");
+            parser.error("Invalid assignment target.");
         }
     }
 
-    [[nodiscard]] auto check(TokenType type) const -> bool
-    {
-        return parser.current.get_type() == type;
-    }
-
-    auto match(TokenType type) -> bool
+    auto declaration() -> void
     {
-        if (!check(type))
+        if (parser.match(TokenType::FUN))
         {
-            return false;
+            fun_declaration();
         }
-        advance();
-        return true;
-    }
-
-    auto declaration() -> void
-    {
-        if (match(TokenType::VAR))
+        else if (parser.match(TokenType::VAR))
         {
             var_declaration();
         }
@@ -649,80 +1050,55 @@ private:
 
         if (parser.panic_mode)
         {
-            synchronize();
+            parser.synchronize();
         }
     }
 
     auto print_statement() -> void
     {
         expression();
-        consume(TokenType::SEMICOLON, "Expect ';' after value.");
+        parser.consume(TokenType::SEMICOLON, "Expect ';' after value.");
         emit_byte(OpCode::Print);
     }
 
     auto while_statement() -> void
     {
         const auto loop_start = current_chunk().size();
-        consume(TokenType::LEFT_PAREN, "Expect '(' after 'while'.");
+        mark_jump_target();
+        parser.consume(TokenType::LEFT_PAREN, "Expect '(' after 'while'.");
         expression();
-        consume(TokenType::RIGHT_PAREN, "Expect ')' after condition.");
+        parser.consume(TokenType::RIGHT_PAREN, "Expect ')' after condition.");
 
-        const auto exit_jump = emit_jump(OpCode::JumpIfFalse);
-        emit_byte(OpCode::Pop);
+        const auto exit_jump = emit_jump(OpCode::JumpIfFalsePop);
         statement();
         emit_loop(loop_start);
 
         patch_jump(static_cast<int>(exit_jump));
-        emit_byte(OpCode::Pop);
-    }
-
-    auto synchronize() -> void
-    {
-        parser.panic_mode = false;
-
-        while (parser.current.get_type() != TokenType::Eof)
-        {
-            if (parser.previous.get_type() == TokenType::SEMICOLON)
-            {
-                return;
-            }
-            switch (parser.current.get_type())
-            {
-            case TokenType::CLASS:
-            case TokenType::FUN:
-            case TokenType::VAR:
-            case TokenType::FOR:
-            case TokenType::IF:
-            case TokenType::WHILE:
-            case TokenType::PRINT:
-            case TokenType::RETURN: return;
-
-            default:; // Do nothing.
-            }
-
-            advance();
-        }
     }
 
     auto statement() -> void
     {
-        if (match(TokenType::PRINT))
+        if (parser.match(TokenType::PRINT))
         {
             print_statement();
         }
-        else if (match(TokenType::FOR))
+        else if (parser.match(TokenType::FOR))
         {
             for_statement();
         }
-        else if (match(TokenType::IF))
+        else if (parser.match(TokenType::IF))
         {
             if_statement();
         }
-        else if (match(TokenType::WHILE))
+        else if (parser.match(TokenType::RETURN))
+        {
+            return_statement();
+        }
+        else if (parser.match(TokenType::WHILE))
         {
             while_statement();
         }
-        else if (match(TokenType::LEFT_BRACE))
+        else if (parser.match(TokenType::LEFT_BRACE))
         {
             begin_scope();
             block();
@@ -734,48 +1110,19 @@ private:
         }
     }
 
-    auto error_at_current(std::string_view message) -> void
-    {
-        error_at(parser.previous, message);
-    }
-
-    auto error(std::string_view message) -> void
-    {
-        error_at(parser.previous, message);
-    }
-
-    auto error_at(const Token& token, std::string_view message) -> void
-    {
-        if (parser.panic_mode)
-        {
-            return;
-        }
-
-        parser.panic_mode = true;
-        std::cout << " Error";
-
-        if (token.get_type() == TokenType::Eof)
-        {
-            std::cout << " at end";
-        }
-        else if (token.get_type() == TokenType::ERROR)
-        {
-        }
-        else
-        {
-            std::cout << " at '" << token.get_lexme() << "'";
-        }
-
-        std::cout << ": " << message << '\n';
-        parser.had_error = true;
-    }
-
     auto end_compiler() -> void
     {
         emit_return();
+        if (!parser.had_error && optimization >= Optimization::Peephole)
+        {
+            peephole_stats += Peephole{ current_chunk() }.run();
+        }
         if (!parser.had_error && debug::enabled)
         {
-            debug::Debug::dissassemble_chunk(current_chunk(), "code");
+            const auto& function = current_state.func();
+            debug::Debug::dissassemble_chunk(current_chunk(), current_state.get_function_type() == FunctionType::Script
+                                                              ? "code"
+                                                              : function.get_name());
         }
     }
 
@@ -787,26 +1134,114 @@ private:
     auto end_scope() -> void
     {
         current_state.end_scope();
-        current_state.clean_scope([&] { emit_byte(OpCode::Pop); });
+        current_state.clean_scope([&](const Local& local)
+                                  { emit_byte(local.is_captured() ? OpCode::CloseUpvalue : OpCode::Pop); });
     }
 
+    // Falling off the end of a function returns nil; the script leaves nothing behind.
     auto emit_return() -> void
     {
+        if (current_state.get_function_type() == FunctionType::Function)
+        {
+            emit_byte(OpCode::Nil);
+        }
         emit_byte(OpCode::Return);
     }
 
     template <typename T>
     auto emit_byte(T byte) -> void
     {
+        if constexpr (std::is_same_v<T, OpCode>)
+        {
+            if (fuse(byte))
+            {
+                return;
+            }
+            previous_instruction = last_instruction;
+            last_instruction = current_chunk().size();
+        }
+
         current_chunk().write(byte, parser.previous.get_line());
     }
 
+    // Peephole pass over the last two instructions emitted: folds `op` into them when together they
+    // form a superinstruction. Fusion never spans a jump target, since a jump could land in the middle.
+    auto fuse(OpCode op) -> bool
+    {
+        auto& chunk = current_chunk();
+        const auto fusable = [&](std::size_t start) { return start != no_instruction && jump_target <= start; };
+        const auto opcode_at = [&](std::size_t offset) { return static_cast<OpCode>(chunk.read(offset)); };
+
+        if (op == OpCode::Not && fusable(last_instruction))
+        {
+            switch (opcode_at(last_instruction))
+            {
+            case OpCode::Equal: chunk.set(last_instruction, static_cast<std::byte>(OpCode::NotEqual)); return true;
+            case OpCode::Less: chunk.set(last_instruction, static_cast<std::byte>(OpCode::GreaterEqual)); return true;
+            case OpCode::Greater: chunk.set(last_instruction, static_cast<std::byte>(OpCode::LessEqual)); return true;
+            default: return false;
+            }
+        }
+
+        if (!fusable(previous_instruction))
+        {
+            return false;
+        }
+
+        // GetLocal slot, Constant k, Add => AddLocalConst slot k
+        if (op == OpCode::Add && opcode_at(previous_instruction) == OpCode::GetLocal
+            && opcode_at(last_instruction) == OpCode::Constant)
+        {
+            const auto slot = chunk.read(previous_instruction + 1);
+            const auto constant = chunk.read(last_instruction + 1);
+            chunk.set(previous_instruction, static_cast<std::byte>(OpCode::AddLocalConst));
+            chunk.set(previous_instruction + 1, slot);
+            chunk.set(previous_instruction + 2, constant);
+            chunk.truncate(previous_instruction + 3);
+            last_instruction = previous_instruction;
+            previous_instruction = no_instruction;
+            return true;
+        }
+
+        // AddLocalConst slot k, Setlocal slot, Pop => IncrLocal slot k
+        if (op == OpCode::Pop && opcode_at(previous_instruction) == OpCode::AddLocalConst
+            && opcode_at(last_instruction) == OpCode::Setlocal
+            && chunk.read(previous_instruction + 1) == chunk.read(last_instruction + 1))
+        {
+            chunk.set(previous_instruction, static_cast<std::byte>(OpCode::IncrLocal));
+            chunk.truncate(previous_instruction + 3);
+            last_instruction = previous_instruction;
+            previous_instruction = no_instruction;
+            return true;
+        }
+
+        return false;
+    }
+
     template <typename... T>
     auto emit_bytes(T... bytes) -> void
     {
         (emit_byte(bytes), ...);
     }
 
+    // Emits `op` with a one-byte operand, switching to its long form when the operand does not fit.
+    auto emit_operand(OpCode op, std::size_t operand) -> void
+    {
+        if (operand <= std::numeric_limits<std::uint8_t>::max())
+        {
+            emit_bytes(op, static_cast<std::uint8_t>(operand));
+            return;
+        }
+
+        const auto [long_op, width] = long_form(op);
+        emit_byte(long_op);
+        for (auto shift = 8 * width; shift > 0;)
+        {
+            shift -= 8;
+            emit_byte(static_cast<std::uint8_t>((operand >> shift) & 0xFF));
+        }
+    }
+
     auto emit_loop(std::size_t loop_start) -> void
     {
         emit_byte(OpCode::Loop);
@@ -814,7 +1249,7 @@ private:
 
         if (offset > std::numeric_limits<std::uint16_t>::max())
         {
-            error("Loop body too large.");
+            parser.error("Loop body too large.");
         }
 
         emit_byte((offset >> 8) & 0XFF);
@@ -833,50 +1268,70 @@ private:
 
 
     std::vector<ParseRule> rules{
-        { .prefix = &Compiler::grouping, .infix = nullptr, .precedence = Precedence::NONE },        // LEFT_PAREN
-        { .prefix = nullptr, .infix = nullptr, .precedence = Precedence::NONE },                    // RIGHT_PAREN
-        { .prefix = nullptr, .infix = nullptr, .precedence = Precedence::NONE },                    // LEFT_BRACE
-        { .prefix = nullptr, .infix = nullptr, .precedence = Precedence::NONE },                    // RIGHT_BRACE
-        { .prefix = nullptr, .infix = nullptr, .precedence = Precedence::NONE },                    // COMMA
-        { .prefix = nullptr, .infix = nullptr, .precedence = Precedence::NONE },                    // DOT
-        { .prefix = &Compiler::unary, .infix = &Compiler::binary, .precedence = Precedence::TERM }, // MINUS
-        { .prefix = nullptr, .infix = &Compiler::binary, .precedence = Precedence::TERM },          // PLUS
-        { .prefix = nullptr, .infix = nullptr, .precedence = Precedence::NONE },                    // SEMICOLON
-        { .prefix = nullptr, .infix = &Compiler::binary, .precedence = Precedence::FACTOR },        // SLASH
-        { .prefix = nullptr, .infix = &Compiler::binary, .precedence = Precedence::FACTOR },        // STAR
-        { .prefix = &Compiler::unary, .infix = nullptr, .precedence = Precedence::NONE },           // BANG
-        { .prefix = nullptr, .infix = &Compiler::binary, .precedence = Precedence::EQUALITY },      // BANG_EQUAL
-        { .prefix = nullptr, .infix = nullptr, .precedence = Precedence::NONE },                    // EQUAL
-        { .prefix = nullptr, .infix = &Compiler::binary, .precedence = Precedence::EQUALITY },      // EQUAL_EQUAL
-        { .prefix = nullptr, .infix = &Compiler::binary, .precedence = Precedence::COMPARISON },    // GREATER
-        { .prefix = nullptr, .infix = &Compiler::binary, .precedence = Precedence::COMPARISON },    // GREATER_EQUAL
-        { .prefix = nullptr, .infix = &Compiler::binary, .precedence = Precedence::COMPARISON },    // LESS
-        { .prefix = nullptr, .infix = nullptr, .precedence = Precedence::COMPARISON },              // LESS_EQUAL
-        { .prefix = &Compiler::variable, .infix = nullptr, .precedence = Precedence::NONE },        // IDENTIFIER
-        { .prefix = &Compiler::string, .infix = nullptr, .precedence = Precedence::NONE },          // STRING
-        { .prefix = &Compiler::number, .infix = nullptr, .precedence = Precedence::NONE },          // NUMBER
-        { .prefix = nullptr, .infix = &Compiler::and_, .precedence = Precedence::AND },             // AND
-        { .prefix = nullptr, .infix = nullptr, .precedence = Precedence::NONE },                    // CLASS
-        { .prefix = nullptr, .infix = nullptr, .precedence = Precedence::NONE },                    // ELSE
-        { .prefix = &Compiler::literal, .infix = nullptr, .precedence = Precedence::NONE },         // FALSE
-        { .prefix = nullptr, .infix = nullptr, .precedence = Precedence::NONE },                    // FOR
-        { .prefix = nullptr, .infix = nullptr, .precedence = Precedence::NONE },                    // FUN
-        { .prefix = nullptr, .infix = nullptr, .precedence = Precedence::NONE },                    // IF
-        { .prefix = &Compiler::literal, .infix = nullptr, .precedence = Precedence::NONE },         // NIL
-        { .prefix = nullptr, .infix = &Compiler::or_, .precedence = Precedence::OR },               // OR
-        { .prefix = nullptr, .infix = nullptr, .precedence = Precedence::NONE },                    // PRINT
-        { .prefix = nullptr, .infix = nullptr, .precedence = Precedence::NONE },                    // RETURN
-        { .prefix = nullptr, .infix = nullptr, .precedence = Precedence::NONE },                    // SUPER
-        { .prefix = nullptr, .infix = nullptr, .precedence = Precedence::NONE },                    // THIS
-        { .prefix = &Compiler::literal, .infix = nullptr, .precedence = Precedence::NONE },         // TRUE
-        { .prefix = nullptr, .infix = nullptr, .precedence = Precedence::NONE },                    // VAR
-        { .prefix = nullptr, .infix = nullptr, .precedence = Precedence::NONE },                    // WHILE
-        { .prefix = nullptr, .infix = nullptr, .precedence = Precedence::NONE },                    // ERROR
-        { .prefix = nullptr, .infix = nullptr, .precedence = Precedence::NONE },                    // Eof
+        { .prefix = &Compiler::grouping, .infix = &Compiler::call, .precedence = Precedence::CALL }, // LEFT_PAREN
+        { .prefix = nullptr, .infix = nullptr, .precedence = Precedence::NONE },                     // RIGHT_PAREN
+        { .prefix = nullptr, .infix = nullptr, .precedence = Precedence::NONE },                     // LEFT_BRACE
+        { .prefix = nullptr, .infix = nullptr, .precedence = Precedence::NONE },                     // RIGHT_BRACE
+        { .prefix = nullptr, .infix = nullptr, .precedence = Precedence::NONE },                     // COMMA
+        { .prefix = nullptr, .infix = nullptr, .precedence = Precedence::NONE },                     // DOT
+        { .prefix = &Compiler::unary, .infix = &Compiler::binary, .precedence = Precedence::TERM },  // MINUS
+        { .prefix = nullptr, .infix = &Compiler::binary, .precedence = Precedence::TERM },           // PLUS
+        { .prefix = nullptr, .infix = nullptr, .precedence = Precedence::NONE },                     // SEMICOLON
+        { .prefix = nullptr, .infix = &Compiler::binary, .precedence = Precedence::FACTOR },         // SLASH
+        { .prefix = nullptr, .infix = &Compiler::binary, .precedence = Precedence::FACTOR },         // STAR
+        { .prefix = &Compiler::unary, .infix = nullptr, .precedence = Precedence::NONE },            // BANG
+        { .prefix = nullptr, .infix = &Compiler::binary, .precedence = Precedence::EQUALITY },       // BANG_EQUAL
+        { .prefix = nullptr, .infix = nullptr, .precedence = Precedence::NONE },                     // EQUAL
+        { .prefix = nullptr, .infix = &Compiler::binary, .precedence = Precedence::EQUALITY },       // EQUAL_EQUAL
+        { .prefix = nullptr, .infix = &Compiler::binary, .precedence = Precedence::COMPARISON },     // GREATER
+        { .prefix = nullptr, .infix = &Compiler::binary, .precedence = Precedence::COMPARISON },     // GREATER_EQUAL
+        { .prefix = nullptr, .infix = &Compiler::binary, .precedence = Precedence::COMPARISON },     // LESS
+        { .prefix = nullptr, .infix = &Compiler::binary, .precedence = Precedence::COMPARISON },     // LESS_EQUAL
+        { .prefix = &Compiler::variable, .infix = nullptr, .precedence = Precedence::NONE },         // IDENTIFIER
+        { .prefix = &Compiler::string, .infix = nullptr, .precedence = Precedence::NONE },           // STRING
+        { .prefix = &Compiler::number, .infix = nullptr, .precedence = Precedence::NONE },           // NUMBER
+        { .prefix = nullptr, .infix = &Compiler::and_, .precedence = Precedence::AND },              // AND
+        { .prefix = nullptr, .infix = nullptr, .precedence = Precedence::NONE },                     // CLASS
+        { .prefix = nullptr, .infix = nullptr, .precedence = Precedence::NONE },                     // ELSE
+        { .prefix = &Compiler::literal, .infix = nullptr, .precedence = Precedence::NONE },          // FALSE
+        { .prefix = nullptr, .infix = nullptr, .precedence = Precedence::NONE },                     // FOR
+        { .prefix = nullptr, .infix = nullptr, .precedence = Precedence::NONE },                     // FUN
+        { .prefix = nullptr, .infix = nullptr, .precedence = Precedence::NONE },                     // IF
+        { .prefix = &Compiler::literal, .infix = nullptr, .precedence = Precedence::NONE },          // NIL
+        { .prefix = nullptr, .infix = &Compiler::or_, .precedence = Precedence::OR },                // OR
+        { .prefix = nullptr, .infix = nullptr, .precedence = Precedence::NONE },                     // PRINT
+        { .prefix = nullptr, .infix = nullptr, .precedence = Precedence::NONE },                     // RETURN
+        { .prefix = nullptr, .infix = nullptr, .precedence = Precedence::NONE },                     // SUPER
+        { .prefix = nullptr, .infix = nullptr, .precedence = Precedence::NONE },                     // THIS
+        { .prefix = &Compiler::literal, .infix = nullptr, .precedence = Precedence::NONE },          // TRUE
+        { .prefix = nullptr, .infix = nullptr, .precedence = Precedence::NONE },                     // VAR
+        { .prefix = nullptr, .infix = nullptr, .precedence = Precedence::NONE },                     // WHILE
+        { .prefix = nullptr, .infix = nullptr, .precedence = Precedence::NONE },                     // ERROR
+        { .prefix = nullptr, .infix = nullptr, .precedence = Precedence::NONE },                     // Eof
     };
 
 
+    static constexpr auto no_instruction = std::numeric_limits<std::size_t>::max();
+    // What the 24-bit operand of ConstantLong can address.
+    static constexpr std::size_t max_constants = std::size_t{ 1 } << 24;
+    // What the operand of Call can count.
+    static constexpr std::size_t max_arguments = std::numeric_limits<std::uint8_t>::max();
+
+    std::string_view source;
     Parser parser;
-    Scanner scanner;
     CompilerState current_state;
+    // The functions whose compilation is suspended by a nested one, innermost last.
+    std::vector<EnclosingFunction> enclosing;
+    Heap& heap;
+    Globals& globals;
+    // Slots of the globals defined by top-level declarations compiled so far.
+    std::vector<bool> defined_globals;
+    std::size_t last_instruction = no_instruction;
+    std::size_t previous_instruction = no_instruction;
+    std::size_t jump_target = 0;
+    // Where the left operand of the infix rule being parsed begins.
+    Chunk::Mark infix_lhs{};
+    Optimization optimization = Optimization::None;
+    PeepholeStats peephole_stats;
+    AstStats ast_stats;
 };
\ No newline at end of file
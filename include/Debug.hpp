@@ -4,15 +4,18 @@
 #include "Value.hpp"
 
 #include <cstddef>
+#include <cstdint>
 #include <iomanip>
 #include <iostream>
 #include <string_view>
-#include <type_traits>
-#include <variant>
 
 namespace debug
 {
+#if defined(AXOLOTL_DEBUG_PRINT_CODE)
     static constexpr bool enabled = true;
+#else
+    static constexpr bool enabled = false;
+#endif
 
     class Debug
     {
@@ -22,23 +25,14 @@ namespace debug
             std::cout << "== " << name << " ==\n";
             for (std::size_t offset = 0; offset < chunk.data.size();)
             {
-                offset = dissassemble_instruction(chunk, offset);
+                offset = chunk.engine == Engine::Register ? dissassemble_register_instruction(chunk, offset)
+                                                          : dissassemble_instruction(chunk, offset);
             }
         }
 
         static std::size_t dissassemble_instruction(const Chunk& chunk, std::size_t offset)
         {
-            std::cout << std::right << std::setw(4) << std::setfill('0') << offset << ' ' << std::setfill(' ');
-
-            if (offset > 0 && chunk.lines[offset] == chunk.lines[offset - 1])
-            {
-                std::cout << "   | ";
-            }
-            else
-            {
-                std::cout << std::right << std::setw(4) << std::setfill(' ') << chunk.lines[offset];
-                std::cout << ' ';
-            }
+            print_location(chunk, offset);
 
             const auto instruction = static_cast<OpCode>(chunk.data[offset]);
             switch (instruction)
@@ -63,10 +57,45 @@ namespace debug
             case OpCode::GetGlobal: return constant_instruction("GET_GLOBAL", chunk, offset);
             case OpCode::DefineGlobal: return constant_instruction("DEFINE_GLOBAL", chunk, offset);
             case OpCode::SetGlobal: return constant_instruction("SET_GLOBAL", chunk, offset);
+            case OpCode::GetGlobalSlot: return byte_instruction("GET_GLOBAL_SLOT", chunk, offset);
+            case OpCode::SetGlobalSlot: return byte_instruction("SET_GLOBAL_SLOT", chunk, offset);
+            case OpCode::DefineGlobalSlot: return byte_instruction("DEFINE_GLOBAL_SLOT", chunk, offset);
+            case OpCode::ConstantLong: return constant_instruction("CONSTANT_LONG", chunk, offset, 3);
+            case OpCode::GetGlobalLong: return constant_instruction("GET_GLOBAL_LONG", chunk, offset, 3);
+            case OpCode::DefineGlobalLong: return constant_instruction("DEFINE_GLOBAL_LONG", chunk, offset, 3);
+            case OpCode::SetGlobalLong: return constant_instruction("SET_GLOBAL_LONG", chunk, offset, 3);
+            case OpCode::GetGlobalSlotLong: return byte_instruction("GET_GLOBAL_SLOT_LONG", chunk, offset, 2);
+            case OpCode::SetGlobalSlotLong: return byte_instruction("SET_GLOBAL_SLOT_LONG", chunk, offset, 2);
+            case OpCode::DefineGlobalSlotLong: return byte_instruction("DEFINE_GLOBAL_SLOT_LONG", chunk, offset, 2);
             case OpCode::Equal: return simple_instruction("EQUAL", offset);
             case OpCode::Greater: return simple_instruction("GREATER", offset);
             case OpCode::Less: return simple_instruction("LESS", offset);
             case OpCode::Not: return simple_instruction("NOT", offset);
+            case OpCode::NotEqual: return simple_instruction("NOT_EQUAL", offset);
+            case OpCode::GreaterEqual: return simple_instruction("GREATER_EQUAL", offset);
+            case OpCode::LessEqual: return simple_instruction("LESS_EQUAL", offset);
+            case OpCode::JumpIfFalsePop: return jump_instruction("JUMP_IF_FALSE_POP", 1, chunk, offset);
+            case OpCode::JumpIfTruePop: return jump_instruction("JUMP_IF_TRUE_POP", 1, chunk, offset);
+            case OpCode::Call: return byte_instruction("CALL", chunk, offset);
+            case OpCode::TailCall: return byte_instruction("TAIL_CALL", chunk, offset);
+            case OpCode::GetUpvalue: return byte_instruction("GET_UPVALUE", chunk, offset);
+            case OpCode::SetUpvalue: return byte_instruction("SET_UPVALUE", chunk, offset);
+            case OpCode::CloseUpvalue: return simple_instruction("CLOSE_UPVALUE", offset);
+            case OpCode::Closure: return constant_instruction("CLOSURE", chunk, offset);
+            case OpCode::ClosureLong: return constant_instruction("CLOSURE_LONG", chunk, offset, 3);
+            case OpCode::AddLocalConst: return local_constant_instruction("ADD_LOCAL_CONST", chunk, offset);
+            case OpCode::IncrLocal: return local_constant_instruction("INCR_LOCAL", chunk, offset);
+            case OpCode::AddNumber: return simple_instruction("ADD_NUMBER", offset);
+            case OpCode::SubtractNumber: return simple_instruction("SUBTRACT_NUMBER", offset);
+            case OpCode::MultiplyNumber: return simple_instruction("MULTIPLY_NUMBER", offset);
+            case OpCode::DivideNumber: return simple_instruction("DIVIDE_NUMBER", offset);
+            case OpCode::GreaterNumber: return simple_instruction("GREATER_NUMBER", offset);
+            case OpCode::LessNumber: return simple_instruction("LESS_NUMBER", offset);
+            case OpCode::GreaterEqualNumber: return simple_instruction("GREATER_EQUAL_NUMBER", offset);
+            case OpCode::LessEqualNumber: return simple_instruction("LESS_EQUAL_NUMBER", offset);
+            case OpCode::AddLocalConstNumber:
+                return local_constant_instruction("ADD_LOCAL_CONST_NUMBER", chunk, offset);
+            case OpCode::IncrLocalNumber: return local_constant_instruction("INCR_LOCAL_NUMBER", chunk, offset);
             default:
                 std::cout << "[DEBUG] Unknown opcode: " << static_cast<int>(instruction) << '\n';
                 return offset + 1;
@@ -75,19 +104,149 @@ namespace debug
             return offset;
         }
 
-        static std::size_t byte_instruction(std::string_view name, const Chunk& chunk, std::size_t offset)
+        static std::size_t dissassemble_register_instruction(const Chunk& chunk, std::size_t offset)
+        {
+            print_location(chunk, offset);
+
+            const auto word = chunk.word_at(offset);
+            switch (registers::opcode(word))
+            {
+            case RegOp::LoadConstant: return register_constant_instruction("LOAD_CONSTANT", chunk, offset);
+            case RegOp::LoadNil: return register_instruction("LOAD_NIL", 1, chunk, offset);
+            case RegOp::LoadTrue: return register_instruction("LOAD_TRUE", 1, chunk, offset);
+            case RegOp::LoadFalse: return register_instruction("LOAD_FALSE", 1, chunk, offset);
+            case RegOp::Move: return register_instruction("MOVE", 2, chunk, offset);
+            case RegOp::GetGlobal: return register_constant_instruction("GET_GLOBAL", chunk, offset);
+            case RegOp::DefineGlobal: return register_constant_instruction("DEFINE_GLOBAL", chunk, offset);
+            case RegOp::SetGlobal: return register_constant_instruction("SET_GLOBAL", chunk, offset);
+            case RegOp::GetGlobalSlot: return register_slot_instruction("GET_GLOBAL_SLOT", chunk, offset);
+            case RegOp::DefineGlobalSlot: return register_slot_instruction("DEFINE_GLOBAL_SLOT", chunk, offset);
+            case RegOp::SetGlobalSlot: return register_slot_instruction("SET_GLOBAL_SLOT", chunk, offset);
+            case RegOp::Equal: return register_instruction("EQUAL", 3, chunk, offset);
+            case RegOp::Greater: return register_instruction("GREATER", 3, chunk, offset);
+            case RegOp::Less: return register_instruction("LESS", 3, chunk, offset);
+            case RegOp::Add: return register_instruction("ADD", 3, chunk, offset);
+            case RegOp::Subtract: return register_instruction("SUBTRACT", 3, chunk, offset);
+            case RegOp::Multiply: return register_instruction("MULTIPLY", 3, chunk, offset);
+            case RegOp::Divide: return register_instruction("DIVIDE", 3, chunk, offset);
+            case RegOp::Not: return register_instruction("NOT", 2, chunk, offset);
+            case RegOp::Negate: return register_instruction("NEGATE", 2, chunk, offset);
+            case RegOp::Print: return register_print_instruction("PRINT", chunk, offset);
+            case RegOp::Jump: return register_jump_instruction("JUMP", false, chunk, offset);
+            case RegOp::JumpIfFalse: return register_jump_instruction("JUMP_IF_FALSE", true, chunk, offset);
+            case RegOp::JumpIfTrue: return register_jump_instruction("JUMP_IF_TRUE", true, chunk, offset);
+            case RegOp::Loop: return register_jump_instruction("LOOP", false, chunk, offset);
+            case RegOp::Return: simple_instruction("RETURN", offset); return offset + registers::instruction_size;
+            default:
+                std::cout << "[DEBUG] Unknown opcode: " << static_cast<int>(registers::opcode(word)) << '\n';
+                return offset + registers::instruction_size;
+            }
+        }
+
+        // Prints A and then B, C as register ("r1") or constant ("k0") operands.
+        static std::size_t register_instruction(std::string_view name, int operands, const Chunk& chunk,
+                                                std::size_t offset)
+        {
+            const auto word = chunk.word_at(offset);
+            std::cout << std::left << std::setw(16) << name << " r" << static_cast<int>(registers::arg_a(word));
+            if (operands > 1)
+            {
+                print_rk(chunk, registers::arg_b(word));
+            }
+            if (operands > 2)
+            {
+                print_rk(chunk, registers::arg_c(word));
+            }
+            std::cout << '\n';
+            return offset + registers::instruction_size;
+        }
+
+        static std::size_t register_print_instruction(std::string_view name, const Chunk& chunk, std::size_t offset)
+        {
+            std::cout << std::left << std::setw(16) << name;
+            print_rk(chunk, registers::arg_b(chunk.word_at(offset)));
+            std::cout << '\n';
+            return offset + registers::instruction_size;
+        }
+
+        static std::size_t register_constant_instruction(std::string_view name, const Chunk& chunk, std::size_t offset)
+        {
+            const auto word = chunk.word_at(offset);
+            const auto constant = registers::arg_bx(word);
+            std::cout << std::left << std::setw(16) << name << " r" << static_cast<int>(registers::arg_a(word)) << " k"
+                      << constant << ' ';
+            print_value(chunk.constants[constant]);
+            std::cout << '\n';
+            return offset + registers::instruction_size;
+        }
+
+        static std::size_t register_slot_instruction(std::string_view name, const Chunk& chunk, std::size_t offset)
+        {
+            const auto word = chunk.word_at(offset);
+            std::cout << std::left << std::setw(16) << name << " r" << static_cast<int>(registers::arg_a(word)) << " g"
+                      << registers::arg_bx(word) << '\n';
+            return offset + registers::instruction_size;
+        }
+
+        static std::size_t register_jump_instruction(std::string_view name, bool conditional, const Chunk& chunk,
+                                                     std::size_t offset)
         {
-            const auto slot = chunk.data[offset + 1];
+            const auto word = chunk.word_at(offset);
+            const auto next = offset + registers::instruction_size;
+            std::cout << std::left << std::setw(16) << name << ' ';
+            if (conditional)
+            {
+                std::cout << 'r' << static_cast<int>(registers::arg_a(word)) << ' ';
+            }
+            std::cout << offset << " -> "
+                      << static_cast<std::ptrdiff_t>(next)
+                         + registers::arg_sbx(word) * static_cast<std::ptrdiff_t>(registers::instruction_size)
+                      << '\n';
+            return next;
+        }
 
-            std::cout << std::left << std::setw(16) << name << ' ' << std::setw(4) << static_cast<int>(slot) << '\n';
-            return offset + 2;
+        static void print_rk(const Chunk& chunk, std::uint8_t operand)
+        {
+            if (!registers::is_constant(operand))
+            {
+                std::cout << " r" << static_cast<int>(operand);
+                return;
+            }
+
+            const auto constant = static_cast<std::size_t>(operand - registers::constant_flag);
+            std::cout << " k" << constant << '(';
+            print_value(chunk.constants[constant]);
+            std::cout << ')';
+        }
+
+        static void print_location(const Chunk& chunk, std::size_t offset)
+        {
+            std::cout << std::right << std::setw(4) << std::setfill('0') << offset << ' ' << std::setfill(' ');
+
+            if (offset > 0 && chunk.get_line(offset) == chunk.get_line(offset - 1))
+            {
+                std::cout << "   | ";
+            }
+            else
+            {
+                std::cout << std::right << std::setw(4) << std::setfill(' ') << chunk.get_line(offset);
+                std::cout << ' ';
+            }
+        }
+
+        static std::size_t byte_instruction(std::string_view name, const Chunk& chunk, std::size_t offset,
+                                            std::size_t width = 1)
+        {
+            const auto slot = operand(chunk, offset, width);
+
+            std::cout << std::left << std::setw(16) << name << ' ' << std::setw(4) << slot << '\n';
+            return offset + 1 + width;
         }
 
         static std::size_t jump_instruction(std::string_view name, int sign, const Chunk& chunk, std::size_t offset)
         {
-            auto jump = static_cast<uint16_t>(chunk.data[offset + 1] << 8);
-            jump |= static_cast<std::uint16_t>(chunk.data[offset + 2]);
-            std::cout << std::left << std::setw(16) << name << std::setw(4) << offset << " -> "
+            const auto jump = static_cast<std::uint16_t>(operand(chunk, offset, 2));
+            std::cout << std::left << std::setw(16) << name << ' ' << std::setw(4) << offset << " -> "
                       << (offset + 3 + sign * jump) << '\n';
             return offset + 3;
         }
@@ -98,31 +257,40 @@ namespace debug
             return offset + 1;
         }
 
-        static std::size_t constant_instruction(std::string_view name, const Chunk& chunk, std::size_t offset)
+        static std::size_t constant_instruction(std::string_view name, const Chunk& chunk, std::size_t offset,
+                                                std::size_t width = 1)
         {
-            const auto constant = static_cast<std::size_t>(chunk.data[offset + 1]);
+            const auto constant = operand(chunk, offset, width);
             std::cout << std::left << std::setw(16) << std::setfill(' ') << name << ' ' << constant << ' ';
             print_value(chunk.constants[constant]);
             std::cout << '\n';
-            return offset + 2;
+            return offset + 1 + width;
         }
 
-        template <typename T>
-        static void print_value(const T& value)
+        // The big-endian operand following the opcode at `offset`.
+        static std::size_t operand(const Chunk& chunk, std::size_t offset, std::size_t width)
         {
-            std::visit(
-            []<typename value_t>(const value_t& value)
+            std::size_t value = 0;
+            for (std::size_t i = 1; i <= width; i++)
             {
-                if constexpr (std::is_same_v<value_t, Function>)
-                {
-                    std::cout << "<Fn " << value.get_name() << '>';
-                }
-                else
-                {
-                    std::cout << '\'' << value << '\'';
-                }
-            },
-            value);
+                value = (value << 8) | static_cast<std::size_t>(chunk.data[offset + i]);
+            }
+            return value;
+        }
+
+        static std::size_t local_constant_instruction(std::string_view name, const Chunk& chunk, std::size_t offset)
+        {
+            const auto slot = static_cast<int>(chunk.data[offset + 1]);
+            const auto constant = static_cast<std::size_t>(chunk.data[offset + 2]);
+            std::cout << std::left << std::setw(16) << name << ' ' << std::setw(4) << slot << ' ' << constant << ' ';
+            print_value(chunk.constants[constant]);
+            std::cout << '\n';
+            return offset + 3;
+        }
+
+        static void print_value(const Value& value)
+        {
+            std::cout << '\'' << value << '\'';
         }
     };
 } // namespace debug
\ No newline at end of file
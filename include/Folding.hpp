@@ -0,0 +1,75 @@
+#pragma once
+
+#include "Memory.hpp"
+#include "Object.hpp"
+#include "Scanner.hpp"
+#include "Value.hpp"
+
+#include <optional>
+#include <string>
+
+// Compile-time evaluation of operators applied to literals, shared by both code generators.
+// Each fold computes exactly what the VM would, and gives up on anything the VM would report
+// as a runtime error so that the error still happens, on the right line, when the code runs.
+namespace folding
+{
+    [[nodiscard]] inline auto is_falsey(const Value& value) noexcept -> bool
+    {
+        return values::is<Nil>(value) || (values::is<Boolean>(value) && !values::as<Boolean>(value));
+    }
+
+    [[nodiscard]] inline auto unary(TokenType operator_type, const Value& operand) -> std::optional<Value>
+    {
+        switch (operator_type)
+        {
+        case TokenType::BANG: return values::make(is_falsey(operand));
+        case TokenType::MINUS:
+            if (!values::is<Number>(operand))
+            {
+                return std::nullopt;
+            }
+            return values::make(-values::as<Number>(operand));
+        default: return std::nullopt;
+        }
+    }
+
+    // Strings concatenated here become constants, so they are interned in the old generation.
+    [[nodiscard]] inline auto binary(TokenType operator_type, const Value& lhs, const Value& rhs, Heap& heap)
+    -> std::optional<Value>
+    {
+        switch (operator_type)
+        {
+        case TokenType::EQUAL_EQUAL: return values::make(lhs == rhs);
+        case TokenType::BANG_EQUAL: return values::make(!(lhs == rhs));
+        default: break;
+        }
+
+        if (operator_type == TokenType::PLUS && values::is<ObjString>(lhs) && values::is<ObjString>(rhs))
+        {
+            auto chars = std::string{ values::as<ObjString>(lhs)->view() };
+            chars += values::as<ObjString>(rhs)->view();
+            return values::make(heap.make_string(chars));
+        }
+
+        if (!values::is<Number>(lhs) || !values::is<Number>(rhs))
+        {
+            return std::nullopt;
+        }
+
+        const auto a = values::as<Number>(lhs);
+        const auto b = values::as<Number>(rhs);
+        switch (operator_type)
+        {
+        // >= and <= negate the opposite comparison, like the instructions they replace, so NaN folds the same way.
+        case TokenType::GREATER: return values::make(a > b);
+        case TokenType::GREATER_EQUAL: return values::make(!(a < b));
+        case TokenType::LESS: return values::make(a < b);
+        case TokenType::LESS_EQUAL: return values::make(!(a > b));
+        case TokenType::PLUS: return values::make(a + b);
+        case TokenType::MINUS: return values::make(a - b);
+        case TokenType::STAR: return values::make(a * b);
+        case TokenType::SLASH: return values::make(a / b);
+        default: return std::nullopt;
+        }
+    }
+} // namespace folding
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "Object.hpp"
+#include "Table.hpp"
+#include "Value.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+// Global variables, stored in a flat array indexed by slots the compiler resolves ahead of time.
+// The name -> slot table is only consulted by the compiler, by late-bound accesses and for error messages.
+class Globals
+{
+public:
+    // Returns the slot reserved for `name`, reserving a new (still undefined) one on first use.
+    auto declare(ObjString* name) -> std::size_t
+    {
+        const auto [slot, inserted] = slots.try_emplace(name, values.size());
+        if (inserted)
+        {
+            values.emplace_back(Nil{});
+            names.push_back(name);
+            defined.push_back(false);
+        }
+        return *slot;
+    }
+
+    [[nodiscard]] auto find(ObjString* name) const -> std::optional<std::size_t>
+    {
+        const auto* slot = slots.find(name);
+        if (slot == nullptr)
+        {
+            return std::nullopt;
+        }
+        return *slot;
+    }
+
+    auto define(std::size_t slot, const Value& value) -> void
+    {
+        values[slot] = value;
+        defined[slot] = true;
+    }
+
+    [[nodiscard]] auto is_defined(std::size_t slot) const noexcept -> bool
+    {
+        return defined[slot];
+    }
+
+    // Unchecked: only valid for slots known to be defined.
+    [[nodiscard]] auto operator[](std::size_t slot) noexcept -> Value&
+    {
+        return values[slot];
+    }
+
+    [[nodiscard]] auto name(std::size_t slot) const noexcept -> ObjString*
+    {
+        return names[slot];
+    }
+
+    [[nodiscard]] auto size() const noexcept -> std::size_t
+    {
+        return values.size();
+    }
+
+private:
+    std::vector<Value> values;
+    std::vector<ObjString*> names;
+    std::vector<bool> defined;
+    Table<std::size_t> slots;
+};
@@ -0,0 +1,743 @@
+#pragma once
+
+#include "Chunk.hpp"
+#include "Object.hpp"
+#include "Table.hpp"
+#include "Value.hpp"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <variant>
+#include <vector>
+
+struct GcConfig
+{
+    std::size_t initial_threshold = 1024 * 1024;
+    double growth_factor = 2.0;
+    // Size of the bump-allocated nursery for runtime string temporaries; 0 allocates everything in the old generation.
+    std::size_t nursery_size = 256 * 1024;
+    // Spread each major collection over many bounded slices instead of stopping the world.
+    bool incremental = false;
+    std::chrono::microseconds max_pause{ 200 };
+};
+
+// Pause durations bucketed by powers of two: bucket 0 counts pauses under 1us, bucket i those in [2^(i-1), 2^i) us.
+class PauseHistogram
+{
+public:
+    static constexpr std::size_t bucket_count = 24;
+
+    auto record(std::chrono::nanoseconds pause) noexcept -> void
+    {
+        const auto micros = static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(pause).count());
+        buckets[std::min<std::size_t>(std::bit_width(micros), bucket_count - 1)]++;
+    }
+
+    [[nodiscard]] auto get_buckets() const noexcept -> const std::array<std::size_t, bucket_count>&
+    {
+        return buckets;
+    }
+
+    // Upper bound of the bucket holding the given percentile (0-100), in microseconds.
+    [[nodiscard]] auto percentile(double percent) const noexcept -> std::chrono::microseconds
+    {
+        std::size_t total = 0;
+        for (const auto count : buckets)
+        {
+            total += count;
+        }
+
+        const auto wanted = static_cast<double>(total) * percent / 100.0;
+        std::size_t seen = 0;
+        for (std::size_t bucket = 0; bucket < bucket_count; bucket++)
+        {
+            seen += buckets[bucket];
+            if (static_cast<double>(seen) >= wanted)
+            {
+                return std::chrono::microseconds{ std::uint64_t{ 1 } << bucket };
+            }
+        }
+
+        return std::chrono::microseconds{ std::uint64_t{ 1 } << (bucket_count - 1) };
+    }
+
+private:
+    std::array<std::size_t, bucket_count> buckets{};
+};
+
+struct GcStats
+{
+    std::size_t bytes_allocated = 0;
+    std::size_t bytes_freed = 0;
+    std::size_t collections = 0;
+    std::size_t minor_collections = 0;
+    std::size_t incremental_steps = 0;
+    std::size_t bytes_promoted = 0;
+    std::chrono::nanoseconds last_pause{ 0 };
+    std::chrono::nanoseconds max_pause{ 0 };
+    std::chrono::nanoseconds total_pause{ 0 };
+    PauseHistogram pause_histogram;
+};
+
+// Which roots the collector has to scan again before finishing an incremental mark.
+enum class RootKind : std::uint8_t
+{
+    // Scanned at the start of a cycle and once more, atomically, at its end (the value stack, compiler state).
+    Volatile,
+    // Scanned once per cycle; every later store into them must go through Heap::write_barrier (globals).
+    Barriered,
+};
+
+// Owns every heap object and reclaims them with a precise mark-and-sweep collector.
+// Anything holding values between allocations (the VM, a running compiler) registers a root marker.
+//
+// In incremental mode a major collection is a tri-colour mark split into slices of at most
+// GcConfig::max_pause, followed by an equally sliced sweep. Objects allocated while marking are gray,
+// barriered roots shade every value stored into them, and volatile roots are rescanned before the
+// white objects are released.
+//
+// Strings built at runtime start in a bump-allocated nursery. A minor collection promotes the ones still
+// referenced into the old generation and rewrites the slots pointing at them, then frees the rest in bulk.
+// Only mutable slots passed to mark_slot may reference young objects, along with the fields of old objects
+// passed to object_write_barrier, which remembers them for the next minor collection. Strings created for
+// the compiler are always old, so constant pools never have to be rewritten.
+class Heap
+{
+public:
+    using RootMarker = std::function<void(Heap&)>;
+
+    class Roots
+    {
+    public:
+        Roots(Heap& heap, std::size_t id) : heap{ &heap }, id{ id }
+        {
+        }
+
+        Roots(const Roots&) = delete;
+        Roots& operator=(const Roots&) = delete;
+
+        Roots(Roots&& other) noexcept : heap{ std::exchange(other.heap, nullptr) }, id{ other.id }
+        {
+        }
+
+        Roots& operator=(Roots&& other) = delete;
+
+        ~Roots()
+        {
+            if (heap != nullptr)
+            {
+                heap->remove_roots(id);
+            }
+        }
+
+    private:
+        Heap* heap;
+        std::size_t id;
+    };
+
+    explicit Heap(GcConfig config = {}) : config{ config }, next_gc{ config.initial_threshold }
+    {
+        reset_nursery();
+    }
+
+    Heap(const Heap&) = delete;
+    Heap& operator=(const Heap&) = delete;
+
+    Heap(Heap&&) = delete;
+    Heap& operator=(Heap&&) = delete;
+
+    ~Heap()
+    {
+        strings.clear();
+        free_list(objects);
+        free_list(sweep_list);
+    }
+
+    template <typename T, typename... Args>
+    [[nodiscard]] auto allocate(Args&&... args) -> T*
+    {
+        collect_if_needed();
+        return track(new T(std::forward<Args>(args)...));
+    }
+
+    // Returns the unique string object holding these characters, copying them only on first use.
+    // The result is always in the old generation so it can be stored in constant pools.
+    [[nodiscard]] auto make_string(std::string_view chars) -> ObjString*
+    {
+        const auto hash = ObjString::hash_string(chars);
+        auto* string = find_string(chars, hash);
+        if (string != nullptr && string->is_young)
+        {
+            // Promote it (if anything still uses it) rather than creating a second object with the same contents.
+            minor_collect();
+            string = find_string(chars, hash);
+        }
+
+        if (string != nullptr)
+        {
+            return string;
+        }
+
+        collect_if_needed();
+        return intern(allocate_old_string(chars, hash));
+    }
+
+    // The interned string holding these characters, if there is one, for lookups that must not allocate.
+    [[nodiscard]] auto find_interned(std::string_view chars) const -> ObjString*
+    {
+        return find_string(chars, ObjString::hash_string(chars));
+    }
+
+    // Interned concatenation for the interpreter. The result is allocated in the nursery.
+    [[nodiscard]] auto concatenate(std::string_view lhs, std::string_view rhs) -> ObjString*
+    {
+        // Both operands may move during a collection, so copy them out before allocating.
+        scratch.assign(lhs);
+        scratch.append(rhs);
+
+        const auto hash = ObjString::hash_string(scratch);
+        if (auto* string = find_string(scratch, hash); string != nullptr)
+        {
+            return string;
+        }
+
+        return intern(allocate_young_string(scratch, hash));
+    }
+
+    [[nodiscard]] auto add_roots(RootMarker marker, RootKind kind = RootKind::Volatile) -> Roots
+    {
+        const auto id = next_root_id++;
+        root_markers.push_back(RootEntry{ .id = id, .kind = kind, .marker = std::move(marker) });
+        return Roots{ *this, id };
+    }
+
+    // Must be called whenever a value is stored into a barriered root while the program runs.
+    auto write_barrier(const Value& value) -> void
+    {
+        if (phase == GcPhase::Marking)
+        {
+            mark_value(value);
+        }
+    }
+
+    // Must be called whenever a value is stored into a field of a heap object (a closed upvalue). Old objects
+    // holding a young one are remembered, as minor collections only scan the roots otherwise.
+    auto object_write_barrier(Obj* object, const Value& value) -> void
+    {
+        write_barrier(value);
+        if (value.is_obj() && value.as_obj()->is_young && !object->is_young && !object->is_remembered)
+        {
+            object->is_remembered = true;
+            remembered.push_back(object);
+        }
+    }
+
+    // Gives an in-progress incremental cycle a slice of work. Called by the interpreter between instructions.
+    auto safepoint() -> void
+    {
+        if (phase != GcPhase::Idle && ++safepoints_since_step >= safepoint_interval)
+        {
+            step();
+        }
+    }
+
+    // Marks a slot the collector may rewrite (stack slots, global values).
+    auto mark_slot(Value& value) -> void
+    {
+        if (!value.is_obj())
+        {
+            return;
+        }
+
+        if (minor_in_progress && value.as_obj()->is_young)
+        {
+            value = Value{ promote(value.as_obj()) };
+        }
+
+        mark_object(value.as_obj());
+    }
+
+    auto mark_value(const Value& value) -> void
+    {
+        if (value.is_obj())
+        {
+            mark_object(value.as_obj());
+        }
+    }
+
+    auto mark_object(Obj* object) -> void
+    {
+        // Young objects are never swept: they are kept alive by being promoted, which allocates them marked.
+        if (minor_in_progress || object == nullptr || object->is_marked || object->is_young)
+        {
+            return;
+        }
+
+        object->is_marked = true;
+        gray_stack.push_back(object);
+    }
+
+    // Runs a whole major collection (finishing the current incremental cycle, if any) without yielding.
+    auto collect() -> void
+    {
+        minor_collect();
+
+        const auto start = std::chrono::steady_clock::now();
+
+        if (phase == GcPhase::Idle)
+        {
+            begin_marking();
+        }
+        if (phase == GcPhase::Marking)
+        {
+            trace_references();
+            finish_marking();
+        }
+        sweep(std::nullopt);
+
+        record_pause(std::chrono::steady_clock::now() - start);
+    }
+
+    // Performs one slice of an incremental major collection, starting a new cycle if none is running.
+    auto step() -> void
+    {
+        const auto start = std::chrono::steady_clock::now();
+        const auto deadline = start + config.max_pause;
+        safepoints_since_step = 0;
+
+        if (phase == GcPhase::Idle)
+        {
+            begin_marking();
+        }
+
+        if (phase == GcPhase::Marking && trace_references(deadline))
+        {
+            finish_marking();
+        }
+
+        if (phase == GcPhase::Sweeping)
+        {
+            sweep(deadline);
+        }
+
+        gc_stats.incremental_steps++;
+        record_pause(std::chrono::steady_clock::now() - start);
+    }
+
+    // Evacuates the nursery: reachable young strings are copied to the old generation, the rest are dropped.
+    auto minor_collect() -> void
+    {
+        if (nursery_top == nursery.get())
+        {
+            return;
+        }
+
+        const auto start = std::chrono::steady_clock::now();
+
+        minor_in_progress = true;
+        for (auto& root : root_markers)
+        {
+            std::invoke(root.marker, *this);
+        }
+        for (auto* object : remembered)
+        {
+            object->is_remembered = false;
+            mark_young_fields(object);
+        }
+        remembered.clear();
+        minor_in_progress = false;
+
+        // The intern set is weak: promoted strings take the place of their young copy (same contents, so
+        // same hash and same bucket), dead ones disappear.
+        strings.prune(
+        [](ObjString*& string)
+        {
+            if (!string->is_young)
+            {
+                return true;
+            }
+            if (string->next == nullptr)
+            {
+                return false;
+            }
+            string = static_cast<ObjString*>(string->next);
+            return true;
+        });
+
+        reset_nursery();
+
+        gc_stats.minor_collections++;
+        record_pause(std::chrono::steady_clock::now() - start);
+    }
+
+    auto set_config(GcConfig new_config) -> void
+    {
+        minor_collect();
+        config = new_config;
+        reset_nursery();
+        update_threshold();
+    }
+
+    [[nodiscard]] auto get_config() const noexcept -> GcConfig
+    {
+        return config;
+    }
+
+    [[nodiscard]] auto stats() const noexcept -> const GcStats&
+    {
+        return gc_stats;
+    }
+
+    [[nodiscard]] auto live_bytes() const noexcept -> std::size_t
+    {
+        return bytes_allocated;
+    }
+
+private:
+    [[nodiscard]] auto find_string(std::string_view chars, std::uint32_t hash) const -> ObjString*
+    {
+        return strings.find_string(chars, hash);
+    }
+
+    auto intern(ObjString* string) -> ObjString*
+    {
+        strings.try_emplace(string);
+        return string;
+    }
+
+    enum class GcPhase : std::uint8_t
+    {
+        Idle,
+        Marking,
+        Sweeping,
+    };
+
+    struct RootEntry
+    {
+        std::size_t id;
+        RootKind kind;
+        RootMarker marker;
+    };
+
+    auto collect_if_needed() -> void
+    {
+#if defined(AXOLOTL_DEBUG_STRESS_GC)
+        const auto wanted = true;
+#else
+        const auto wanted = phase != GcPhase::Idle || bytes_allocated > next_gc;
+#endif
+        if (!wanted)
+        {
+            return;
+        }
+
+        if (config.incremental)
+        {
+            step();
+        }
+        else
+        {
+            collect();
+        }
+    }
+
+    template <typename T>
+    auto track(T* object) -> T*
+    {
+        // Objects created while marking are gray: the cycle must not free them, nor what they reference.
+        object->is_marked = phase == GcPhase::Marking;
+        if (object->is_marked)
+        {
+            gray_stack.push_back(object);
+        }
+        object->next = objects;
+        objects = object;
+
+        const auto size = size_of(object);
+        bytes_allocated += size;
+        gc_stats.bytes_allocated += size;
+
+        return object;
+    }
+
+    auto allocate_old_string(std::string_view chars, std::uint32_t hash) -> ObjString*
+    {
+        return track(ObjString::construct(::operator new(ObjString::allocation_size(chars.size())), chars, hash));
+    }
+
+    auto allocate_young_string(std::string_view chars, std::uint32_t hash) -> ObjString*
+    {
+        const auto size = align(ObjString::allocation_size(chars.size()));
+        if (size > config.nursery_size / 4)
+        {
+            collect_if_needed();
+            return allocate_old_string(chars, hash);
+        }
+
+#if defined(AXOLOTL_DEBUG_STRESS_GC)
+        collect();
+#endif
+        if (static_cast<std::size_t>(nursery_end - nursery_top) < size)
+        {
+            minor_collect();
+            collect_if_needed();
+        }
+
+        auto* string = ObjString::construct(nursery_top, chars, hash);
+        string->is_young = true;
+        nursery_top += size;
+        gc_stats.bytes_allocated += size;
+        return string;
+    }
+
+    // Copies a young object into the old generation once and leaves a forwarding address behind.
+    auto promote(Obj* object) -> Obj*
+    {
+        if (object->next != nullptr)
+        {
+            return object->next;
+        }
+
+        auto* string = static_cast<ObjString*>(object);
+        auto* copy = allocate_old_string(string->view(), string->get_hash());
+        gc_stats.bytes_promoted += size_of(copy);
+        object->next = copy;
+        return copy;
+    }
+
+    auto reset_nursery() -> void
+    {
+        if (nursery_capacity != config.nursery_size)
+        {
+            nursery = std::make_unique<std::byte[]>(config.nursery_size);
+            nursery_capacity = config.nursery_size;
+        }
+        nursery_top = nursery.get();
+        nursery_end = nursery.get() + nursery_capacity;
+    }
+
+    [[nodiscard]] static constexpr auto align(std::size_t size) noexcept -> std::size_t
+    {
+        return (size + alignof(std::max_align_t) - 1) & ~(alignof(std::max_align_t) - 1);
+    }
+
+    auto update_threshold() noexcept -> void
+    {
+        next_gc = std::max(static_cast<std::size_t>(static_cast<double>(bytes_allocated) * config.growth_factor),
+                           config.initial_threshold);
+    }
+
+    auto remove_roots(std::size_t id) -> void
+    {
+        std::erase_if(root_markers, [id](const RootEntry& entry) { return entry.id == id; });
+    }
+
+    auto begin_marking() -> void
+    {
+        phase = GcPhase::Marking;
+        for (auto& root : root_markers)
+        {
+            std::invoke(root.marker, *this);
+        }
+    }
+
+    // Drains the gray stack, stopping early once the deadline has passed. Returns true when it is empty.
+    auto trace_references(std::optional<std::chrono::steady_clock::time_point> deadline = std::nullopt) -> bool
+    {
+        std::size_t traced = 0;
+        while (!gray_stack.empty())
+        {
+            auto* object = gray_stack.back();
+            gray_stack.pop_back();
+            blacken_object(object);
+
+            if (deadline && ++traced % clock_check_interval == 0 && std::chrono::steady_clock::now() >= *deadline)
+            {
+                return gray_stack.empty();
+            }
+        }
+        return true;
+    }
+
+    // The atomic end of the mark phase: rescan what the write barrier does not cover, then drop weak references.
+    // The remembered set is emptied first, so that the sweep never frees an object still in it.
+    auto finish_marking() -> void
+    {
+        minor_collect();
+        for (auto& root : root_markers)
+        {
+            if (root.kind == RootKind::Volatile)
+            {
+                std::invoke(root.marker, *this);
+            }
+        }
+        trace_references();
+        remove_white_strings();
+
+        phase = GcPhase::Sweeping;
+        sweep_list = std::exchange(objects, nullptr);
+        bytes_before_sweep = bytes_allocated;
+    }
+
+    auto blacken_object(Obj* object) -> void
+    {
+        switch (object->type)
+        {
+        case ObjType::String: break;
+        case ObjType::Function:
+            for (const auto& constant : static_cast<ObjFunction*>(object)->function.chunk().get_constants())
+            {
+                mark_value(constant);
+            }
+            break;
+        case ObjType::Native: mark_object(static_cast<ObjNative*>(object)->name); break;
+        case ObjType::Closure:
+        {
+            auto* closure = static_cast<ObjClosure*>(object);
+            mark_object(closure->function);
+            for (auto* upvalue : closure->upvalues)
+            {
+                mark_object(upvalue);
+            }
+            break;
+        }
+        case ObjType::Upvalue: mark_value(static_cast<ObjUpvalue*>(object)->closed); break;
+        }
+    }
+
+    // Promotes the young objects a remembered object refers to, during a minor collection.
+    auto mark_young_fields(Obj* object) -> void
+    {
+        if (object->type == ObjType::Upvalue)
+        {
+            mark_slot(static_cast<ObjUpvalue*>(object)->closed);
+        }
+    }
+
+    // The intern set holds weak references: strings nothing else reaches are dropped before sweeping.
+    auto remove_white_strings() -> void
+    {
+        strings.prune([](const ObjString* string) { return string->is_marked || string->is_young; });
+    }
+
+    // Frees the white objects of the list detached by finish_marking; survivors are turned white and relinked.
+    // Everything allocated meanwhile goes to the regular list, so the sweep never sees it.
+    auto sweep(std::optional<std::chrono::steady_clock::time_point> deadline) -> void
+    {
+        std::size_t swept = 0;
+        while (sweep_list != nullptr)
+        {
+            auto* object = sweep_list;
+            sweep_list = object->next;
+
+            if (object->is_marked)
+            {
+                object->is_marked = false;
+                object->next = objects;
+                objects = object;
+            }
+            else
+            {
+                bytes_allocated -= size_of(object);
+                free_object(object);
+            }
+
+            if (deadline && ++swept % clock_check_interval == 0 && std::chrono::steady_clock::now() >= *deadline)
+            {
+                return;
+            }
+        }
+
+        gc_stats.bytes_freed += bytes_before_sweep - std::min(bytes_before_sweep, bytes_allocated);
+        gc_stats.collections++;
+        phase = GcPhase::Idle;
+        update_threshold();
+    }
+
+    auto record_pause(std::chrono::steady_clock::duration elapsed) -> void
+    {
+        const auto pause = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed);
+        gc_stats.last_pause = pause;
+        gc_stats.max_pause = std::max(gc_stats.max_pause, pause);
+        gc_stats.total_pause += pause;
+        gc_stats.pause_histogram.record(pause);
+    }
+
+    static auto free_list(Obj* object) -> void
+    {
+        while (object != nullptr)
+        {
+            auto* next = object->next;
+            free_object(object);
+            object = next;
+        }
+    }
+
+    [[nodiscard]] static auto size_of(const Obj* object) noexcept -> std::size_t
+    {
+        switch (object->type)
+        {
+        case ObjType::String: return ObjString::allocation_size(static_cast<const ObjString*>(object)->view().size());
+        case ObjType::Function: return sizeof(ObjFunction);
+        case ObjType::Native: return sizeof(ObjNative);
+        case ObjType::Closure:
+            return sizeof(ObjClosure) + static_cast<const ObjClosure*>(object)->upvalue_count * sizeof(ObjUpvalue*);
+        case ObjType::Upvalue: return sizeof(ObjUpvalue);
+        }
+
+        return 0;
+    }
+
+    static auto free_object(Obj* object) -> void
+    {
+        switch (object->type)
+        {
+        case ObjType::String:
+            static_cast<ObjString*>(object)->~ObjString();
+            ::operator delete(object);
+            break;
+        case ObjType::Function: delete static_cast<ObjFunction*>(object); break;
+        case ObjType::Native: delete static_cast<ObjNative*>(object); break;
+        case ObjType::Closure: delete static_cast<ObjClosure*>(object); break;
+        case ObjType::Upvalue: delete static_cast<ObjUpvalue*>(object); break;
+        }
+    }
+
+    static constexpr std::size_t clock_check_interval = 64;
+    static constexpr std::size_t safepoint_interval = 1024;
+
+    GcConfig config;
+    GcStats gc_stats;
+    std::size_t bytes_allocated = 0;
+    std::size_t next_gc;
+
+    GcPhase phase = GcPhase::Idle;
+    Obj* objects = nullptr;
+    Obj* sweep_list = nullptr;
+    std::size_t bytes_before_sweep = 0;
+    std::size_t safepoints_since_step = 0;
+    std::vector<Obj*> gray_stack;
+    // Old objects that may hold young ones, see object_write_barrier.
+    std::vector<Obj*> remembered;
+    Table<std::monostate> strings;
+
+    std::unique_ptr<std::byte[]> nursery;
+    std::size_t nursery_capacity = 0;
+    std::byte* nursery_top = nullptr;
+    std::byte* nursery_end = nullptr;
+    bool minor_in_progress = false;
+    std::string scratch;
+
+    std::vector<RootEntry> root_markers;
+    std::size_t next_root_id = 0;
+};
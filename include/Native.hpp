@@ -0,0 +1,192 @@
+#pragma once
+
+#include "Memory.hpp"
+#include "Object.hpp"
+#include "Value.hpp"
+
+#include <cstddef>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+// Binds ordinary C++ functions to the NativeFn interface. natives::Binder<&f>::call checks the arguments
+// against f's parameter types, converts them and calls f, all without allocating:
+//
+//     auto hypot(Number x, Number y) -> Number;
+//     vm.define_native<&hypot>("hypot");
+//
+// Parameters may be a Number, a Boolean, a string or a Value, which takes anything. A leading Heap&
+// parameter receives the heap; string arguments must be copied out (as Heap::concatenate does) before
+// allocating. The result may be any of those, or void for nil.
+namespace natives
+{
+    template <typename T>
+    struct Parameter;
+
+    template <>
+    struct Parameter<Number>
+    {
+        static constexpr std::string_view expected = "a number";
+
+        [[nodiscard]] static auto accepts(const Value& value) noexcept -> bool
+        {
+            return values::is<Number>(value);
+        }
+
+        [[nodiscard]] static auto convert(const Value& value) noexcept -> Number
+        {
+            return values::as<Number>(value);
+        }
+    };
+
+    template <>
+    struct Parameter<Boolean>
+    {
+        static constexpr std::string_view expected = "a boolean";
+
+        [[nodiscard]] static auto accepts(const Value& value) noexcept -> bool
+        {
+            return values::is<Boolean>(value);
+        }
+
+        [[nodiscard]] static auto convert(const Value& value) noexcept -> Boolean
+        {
+            return values::as<Boolean>(value);
+        }
+    };
+
+    template <>
+    struct Parameter<ObjString*>
+    {
+        static constexpr std::string_view expected = "a string";
+
+        [[nodiscard]] static auto accepts(const Value& value) noexcept -> bool
+        {
+            return values::is<ObjString>(value);
+        }
+
+        [[nodiscard]] static auto convert(const Value& value) noexcept -> ObjString*
+        {
+            return values::as<ObjString>(value);
+        }
+    };
+
+    template <>
+    struct Parameter<const ObjString*> : Parameter<ObjString*>
+    {
+    };
+
+    template <>
+    struct Parameter<Value>
+    {
+        static constexpr std::string_view expected = "a value";
+
+        [[nodiscard]] static auto accepts([[maybe_unused]] const Value& value) noexcept -> bool
+        {
+            return true;
+        }
+
+        [[nodiscard]] static auto convert(const Value& value) noexcept -> const Value&
+        {
+            return value;
+        }
+    };
+
+    template <typename T>
+    [[nodiscard]] auto to_value(const T& result) -> Value
+    {
+        if constexpr (std::is_same_v<T, Value>)
+        {
+            return result;
+        }
+        else
+        {
+            return values::make(result);
+        }
+    }
+
+    template <auto F, bool takes_heap, typename R, typename... Args>
+    struct Binding
+    {
+        static constexpr std::size_t arity = sizeof...(Args);
+
+        static auto call(Heap& heap, std::span<const Value> arguments) -> NativeResult
+        {
+            return call(heap, arguments, std::index_sequence_for<Args...>{});
+        }
+
+    private:
+        template <typename Arg>
+        using parameter = Parameter<std::remove_cvref_t<Arg>>;
+
+        template <std::size_t... Index>
+        static auto call([[maybe_unused]] Heap& heap, [[maybe_unused]] std::span<const Value> arguments,
+                         std::index_sequence<Index...>) -> NativeResult
+        {
+            // The VM has checked the argument count; the first argument of the wrong type stops the call.
+            auto error = std::optional<NativeError>{};
+            static_cast<void>(((error = check<Index, Args>(arguments[Index])) || ...));
+            if (error)
+            {
+                return std::unexpected{ *error };
+            }
+
+            const auto invoke = [&]() -> decltype(auto)
+            {
+                if constexpr (takes_heap)
+                {
+                    return F(heap, parameter<Args>::convert(arguments[Index])...);
+                }
+                else
+                {
+                    return F(parameter<Args>::convert(arguments[Index])...);
+                }
+            };
+
+            if constexpr (std::is_void_v<R>)
+            {
+                invoke();
+                return Value{ Nil{} };
+            }
+            else
+            {
+                return to_value(invoke());
+            }
+        }
+
+        template <std::size_t Index, typename Arg>
+        static auto check(const Value& argument) noexcept -> std::optional<NativeError>
+        {
+            if (parameter<Arg>::accepts(argument))
+            {
+                return std::nullopt;
+            }
+            return NativeError{ .argument = Index, .expected = parameter<Arg>::expected };
+        }
+    };
+
+    template <auto F, typename Signature = decltype(F)>
+    struct Binder;
+
+    template <auto F, typename R, typename... Args>
+    struct Binder<F, R (*)(Args...)> : Binding<F, false, R, Args...>
+    {
+    };
+
+    template <auto F, typename R, typename... Args>
+    struct Binder<F, R (*)(Args...) noexcept> : Binding<F, false, R, Args...>
+    {
+    };
+
+    template <auto F, typename R, typename... Args>
+    struct Binder<F, R (*)(Heap&, Args...)> : Binding<F, true, R, Args...>
+    {
+    };
+
+    template <auto F, typename R, typename... Args>
+    struct Binder<F, R (*)(Heap&, Args...) noexcept> : Binding<F, true, R, Args...>
+    {
+    };
+} // namespace natives
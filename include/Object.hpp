@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <string_view>
+
+enum class ObjType : std::uint8_t
+{
+    String,
+    Function,
+    Native,
+    Closure,
+    Upvalue,
+};
+
+struct Obj
+{
+    explicit Obj(ObjType type) noexcept : type{ type }
+    {
+    }
+
+    ObjType type;
+    bool is_marked = false;
+    bool is_young = false;
+    // Whether the object is in the heap's remembered set, for holding a young object in one of its fields.
+    bool is_remembered = false;
+    // Links old objects together; a young object uses it as its forwarding address once promoted.
+    Obj* next = nullptr;
+};
+
+class ObjString : public Obj
+{
+public:
+    static constexpr auto object_type = ObjType::String;
+
+    // The characters live inline, right after the header, so a string is exactly one allocation.
+    [[nodiscard]] static constexpr auto allocation_size(std::size_t length) noexcept -> std::size_t
+    {
+        return sizeof(ObjString) + length;
+    }
+
+    static auto construct(void* memory, std::string_view chars, std::uint32_t hash) -> ObjString*
+    {
+        auto* string = ::new (memory) ObjString{ chars.size(), hash };
+        std::memcpy(string->chars(), chars.data(), chars.size());
+        return string;
+    }
+
+    [[nodiscard]] auto view() const noexcept -> std::string_view
+    {
+        return { reinterpret_cast<const char*>(this) + sizeof(ObjString), length };
+    }
+
+    [[nodiscard]] auto get_hash() const noexcept -> std::uint32_t
+    {
+        return hash;
+    }
+
+    // FNV-1a, computed once when the string is interned.
+    [[nodiscard]] static constexpr auto hash_string(std::string_view chars) noexcept -> std::uint32_t
+    {
+        std::uint32_t result = 2166136261U;
+        for (const auto c : chars)
+        {
+            result ^= static_cast<std::uint8_t>(c);
+            result *= 16777619U;
+        }
+        return result;
+    }
+
+private:
+    ObjString(std::size_t length, std::uint32_t hash) : Obj{ object_type }, length{ length }, hash{ hash }
+    {
+    }
+
+    auto chars() noexcept -> char*
+    {
+        return reinterpret_cast<char*>(this) + sizeof(ObjString);
+    }
+
+    std::size_t length;
+    std::uint32_t hash;
+};
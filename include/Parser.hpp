@@ -0,0 +1,195 @@
+#pragma once
+
+#include "Scanner.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <string_view>
+
+enum class Precedence : std::uint8_t
+{
+    NONE,
+    ASSIGNMENT, // =
+    OR,         // or
+    AND,        // and
+    EQUALITY,   // == !=
+    COMPARISON, // < > <= >=
+    TERM,       // + -
+    FACTOR,     // * /
+    UNARY,      // ! -
+    CALL,       // . ()
+    PRIMARY
+};
+
+[[nodiscard]] constexpr auto next_precedence(Precedence precedence) noexcept -> Precedence
+{
+    return static_cast<Precedence>(static_cast<std::uint8_t>(precedence) + 1);
+}
+
+// Token stream and error reporting shared by the code generators.
+class Parser
+{
+public:
+    explicit Parser(std::string_view source) : scanner{ source }
+    {
+    }
+
+    auto advance() -> void
+    {
+        previous = current;
+
+        for (;;)
+        {
+            current = scanner.scan_token();
+            if (current.get_type() != TokenType::ERROR)
+            {
+                break;
+            }
+            error_at_current(current.get_lexme());
+        }
+    }
+
+    auto consume(TokenType token_type, std::string_view message) -> void
+    {
+        if (current.get_type() == token_type)
+        {
+            advance();
+            return;
+        }
+
+        error_at_current(message);
+    }
+
+    [[nodiscard]] auto check(TokenType type) const -> bool
+    {
+        return current.get_type() == type;
+    }
+
+    auto match(TokenType type) -> bool
+    {
+        if (!check(type))
+        {
+            return false;
+        }
+        advance();
+        return true;
+    }
+
+    // Whether `name =` appears before the expression starting at the current token can end: at the next `;`
+    // or `{`, or at a `)` or `,` that closes no parenthesis opened inside it. May look past the end of the
+    // expression, as in `a + 1 + (a = 2)` when asked at the first `+`.
+    [[nodiscard]] auto assigns_ahead(std::string_view name) const -> bool
+    {
+        auto lookahead = scanner;
+        auto token = current;
+        auto depth = std::size_t{ 0 };
+        auto after_name = false;
+
+        for (;;)
+        {
+            switch (token.get_type())
+            {
+            case TokenType::SEMICOLON:
+            case TokenType::LEFT_BRACE:
+            case TokenType::Eof: return false;
+            case TokenType::LEFT_PAREN: depth++; break;
+            case TokenType::RIGHT_PAREN:
+                if (depth == 0)
+                {
+                    return false;
+                }
+                depth--;
+                break;
+            case TokenType::COMMA:
+                if (depth == 0)
+                {
+                    return false;
+                }
+                break;
+            case TokenType::EQUAL:
+                if (after_name)
+                {
+                    return true;
+                }
+                break;
+            default:; // Do nothing.
+            }
+
+            after_name = token.get_type() == TokenType::IDENTIFIER && token.get_lexme() == name;
+            token = lookahead.scan_token();
+        }
+    }
+
+    auto synchronize() -> void
+    {
+        panic_mode = false;
+
+        while (current.get_type() != TokenType::Eof)
+        {
+            if (previous.get_type() == TokenType::SEMICOLON)
+            {
+                return;
+            }
+            switch (current.get_type())
+            {
+            case TokenType::CLASS:
+            case TokenType::FUN:
+            case TokenType::VAR:
+            case TokenType::FOR:
+            case TokenType::IF:
+            case TokenType::WHILE:
+            case TokenType::PRINT:
+            case TokenType::RETURN: return;
+
+            default:; // Do nothing.
+            }
+
+            advance();
+        }
+    }
+
+    auto error_at_current(std::string_view message) -> void
+    {
+        error_at(current, message);
+    }
+
+    auto error(std::string_view message) -> void
+    {
+        error_at(previous, message);
+    }
+
+    auto error_at(const Token& token, std::string_view message) -> void
+    {
+        if (panic_mode)
+        {
+            return;
+        }
+
+        panic_mode = true;
+        std::cout << " Error";
+
+        if (token.get_type() == TokenType::Eof)
+        {
+            std::cout << " at end";
+        }
+        else if (token.get_type() == TokenType::ERROR)
+        {
+        }
+        else
+        {
+            std::cout << " at '" << token.get_lexme() << "'";
+        }
+
+        std::cout << ": " << message << '\n';
+        had_error = true;
+    }
+
+    Token previous{ Token{ TokenType::Eof } };
+    Token current{ Token{ TokenType::Eof } };
+    bool had_error = false;
+    bool panic_mode = false;
+
+private:
+    Scanner scanner;
+};
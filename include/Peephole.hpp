@@ -0,0 +1,399 @@
+#pragma once
+
+#include "Chunk.hpp"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// How much work Compiler::compile puts into the code it produces.
+enum class Optimization : std::uint8_t
+{
+    None,
+    // Rewrites the finished chunk with the Peephole passes.
+    Peephole,
+    // Compiles through an ast tree optimized by AstOptimizer, then runs the Peephole passes too.
+    Ast,
+};
+
+struct PeepholeStats
+{
+    std::size_t jumps_threaded = 0;
+    std::size_t jumps_to_next_removed = 0;
+    std::size_t constant_pops_removed = 0;
+    std::size_t conditions_inverted = 0;
+    std::size_t bytes_before = 0;
+    std::size_t bytes_after = 0;
+
+    // Totals over several chunks: a script and its functions.
+    auto operator+=(const PeepholeStats& other) noexcept -> PeepholeStats&
+    {
+        jumps_threaded += other.jumps_threaded;
+        jumps_to_next_removed += other.jumps_to_next_removed;
+        constant_pops_removed += other.constant_pops_removed;
+        conditions_inverted += other.conditions_inverted;
+        bytes_before += other.bytes_before;
+        bytes_after += other.bytes_after;
+        return *this;
+    }
+};
+
+// Optimization passes over a finished stack-engine chunk, run to a fixed point:
+//  - jumps landing on an unconditional jump go straight to its destination;
+//  - jumps to the instruction that follows them anyway disappear;
+//  - a side-effect free push immediately popped again disappears;
+//  - Not followed by a conditional jump becomes the opposite jump.
+// The chunk is decoded into a list of instructions whose jumps refer to other instructions rather than
+// offsets, so removing code never invalidates them; offsets and line runs are recomputed when the
+// instructions are encoded back. Code only ever shrinks, so every jump still fits its 16-bit operand.
+class Peephole
+{
+public:
+    explicit Peephole(Chunk& chunk) : chunk{ chunk }
+    {
+    }
+
+    auto run() -> PeepholeStats
+    {
+        stats = PeepholeStats{ .bytes_before = chunk.size() };
+
+        decode();
+        for (auto changed = true; changed;)
+        {
+            changed = thread_jumps();
+            changed |= remove_jumps_to_next();
+            changed |= remove_constant_pops();
+            changed |= invert_conditions();
+        }
+        encode();
+
+        stats.bytes_after = chunk.size();
+        return stats;
+    }
+
+private:
+    struct Instruction
+    {
+        OpCode op;
+        std::array<std::byte, 3> operands;
+        std::size_t line;
+        // For jumps, the index of the instruction they land on (instructions.size() for the end of the code).
+        std::size_t target;
+        bool removed;
+    };
+
+    // Longest chain of jumps followed when threading, so that a jump cycle cannot hang the optimizer.
+    static constexpr std::size_t max_thread_length = 16;
+
+    [[nodiscard]] static constexpr auto is_jump(OpCode op) noexcept -> bool
+    {
+        return op == OpCode::Jump || op == OpCode::Loop || is_conditional(op);
+    }
+
+    [[nodiscard]] static constexpr auto is_conditional(OpCode op) noexcept -> bool
+    {
+        return op == OpCode::JumpIfFalse || op == OpCode::JumpIfFalsePop || op == OpCode::JumpIfTruePop;
+    }
+
+    // Pushes a value without any other effect.
+    [[nodiscard]] static constexpr auto is_pure_push(OpCode op) noexcept -> bool
+    {
+        switch (op)
+        {
+        case OpCode::Constant:
+        case OpCode::ConstantLong:
+        case OpCode::Nil:
+        case OpCode::True:
+        case OpCode::False:
+        case OpCode::GetLocal:
+        case OpCode::GetUpvalue:
+        case OpCode::GetGlobalSlot:
+        case OpCode::GetGlobalSlotLong: return true;
+        default: return false;
+        }
+    }
+
+    auto decode() -> void
+    {
+        std::vector<std::size_t> offsets;
+        for (std::size_t offset = 0; offset < chunk.size();)
+        {
+            const auto op = static_cast<OpCode>(chunk.read(offset));
+            auto& instruction = instructions.emplace_back(Instruction{
+            .op = op, .operands = {}, .line = chunk.get_line(offset), .target = 0, .removed = false });
+            for (std::size_t i = 0; i < operand_size(op); i++)
+            {
+                instruction.operands[i] = chunk.read(offset + 1 + i);
+            }
+
+            offsets.push_back(offset);
+            offset += 1 + operand_size(op);
+        }
+        offsets.push_back(chunk.size());
+
+        index_of.assign(chunk.size() + 1, 0);
+        for (std::size_t index = 0; index < offsets.size(); index++)
+        {
+            index_of[offsets[index]] = index;
+        }
+
+        inbound.assign(instructions.size() + 1, 0);
+        for (std::size_t index = 0; index < instructions.size(); index++)
+        {
+            auto& instruction = instructions[index];
+            if (!is_jump(instruction.op))
+            {
+                continue;
+            }
+
+            const auto distance = (static_cast<std::size_t>(instruction.operands[0]) << 8)
+                                  | static_cast<std::size_t>(instruction.operands[1]);
+            const auto next = offsets[index + 1];
+            instruction.target = index_of[instruction.op == OpCode::Loop ? next - distance : next + distance];
+            inbound[instruction.target]++;
+        }
+    }
+
+    auto encode() -> void
+    {
+        std::vector<std::size_t> offsets(instructions.size() + 1);
+        std::size_t offset = 0;
+        for (std::size_t index = 0; index < instructions.size(); index++)
+        {
+            offsets[index] = offset;
+            if (!instructions[index].removed)
+            {
+                offset += 1 + operand_size(instructions[index].op);
+            }
+        }
+        offsets.back() = offset;
+
+        chunk.clear_code();
+        for (std::size_t index = 0; index < instructions.size(); index++)
+        {
+            auto instruction = instructions[index];
+            if (instruction.removed)
+            {
+                continue;
+            }
+
+            if (is_jump(instruction.op))
+            {
+                const auto next = offsets[index] + 3;
+                const auto target = offsets[live_at(instruction.target)];
+                // Threading can turn a forward jump backwards and the other way around.
+                if (!is_conditional(instruction.op))
+                {
+                    instruction.op = target < next ? OpCode::Loop : OpCode::Jump;
+                }
+                const auto distance = target < next ? next - target : target - next;
+                instruction.operands[0] = static_cast<std::byte>((distance >> 8) & 0xFF);
+                instruction.operands[1] = static_cast<std::byte>(distance & 0xFF);
+            }
+
+            chunk.write(instruction.op, instruction.line);
+            for (std::size_t i = 0; i < operand_size(instruction.op); i++)
+            {
+                chunk.write(instruction.operands[i], instruction.line);
+            }
+        }
+    }
+
+    // The first instruction still there at or after `index`.
+    [[nodiscard]] auto live_at(std::size_t index) const noexcept -> std::size_t
+    {
+        while (index < instructions.size() && instructions[index].removed)
+        {
+            index++;
+        }
+        return index;
+    }
+
+    [[nodiscard]] auto next_live(std::size_t index) const noexcept -> std::size_t
+    {
+        return live_at(index + 1);
+    }
+
+    // Whether some jump lands on `index`, directly or on removed instructions just before it.
+    [[nodiscard]] auto is_jump_target(std::size_t index) const noexcept -> bool
+    {
+        for (auto candidate = index;; candidate--)
+        {
+            if (inbound[candidate] != 0)
+            {
+                return true;
+            }
+            if (candidate == 0 || !instructions[candidate - 1].removed)
+            {
+                return false;
+            }
+        }
+    }
+
+    auto retarget(Instruction& jump, std::size_t target) -> void
+    {
+        inbound[jump.target]--;
+        jump.target = target;
+        inbound[target]++;
+    }
+
+    auto remove(std::size_t index) -> void
+    {
+        auto& instruction = instructions[index];
+        instruction.removed = true;
+        if (is_jump(instruction.op))
+        {
+            inbound[instruction.target]--;
+        }
+    }
+
+    // Jump, Loop: anything landing on them can go directly where they go. A JumpIfFalse landing on
+    // another one tests the same value, so it can skip it too. Conditional jumps only exist forwards.
+    auto thread_jumps() -> bool
+    {
+        auto changed = false;
+        for (std::size_t index = 0; index < instructions.size(); index++)
+        {
+            auto& jump = instructions[index];
+            if (jump.removed || !is_jump(jump.op))
+            {
+                continue;
+            }
+
+            auto target = live_at(jump.target);
+            for (std::size_t hops = 0; target < instructions.size() && hops < max_thread_length; hops++)
+            {
+                const auto& next = instructions[target];
+                const auto follows = next.op == OpCode::Jump || next.op == OpCode::Loop
+                                     || (jump.op == OpCode::JumpIfFalse && next.op == OpCode::JumpIfFalse);
+                if (!follows || target == index)
+                {
+                    break;
+                }
+                target = live_at(next.target);
+            }
+
+            if (target == live_at(jump.target) || (is_conditional(jump.op) && target <= index))
+            {
+                continue;
+            }
+
+            retarget(jump, target);
+            stats.jumps_threaded++;
+            changed = true;
+        }
+        return changed;
+    }
+
+    auto remove_jumps_to_next() -> bool
+    {
+        auto changed = false;
+        for (std::size_t index = 0; index < instructions.size(); index++)
+        {
+            auto& jump = instructions[index];
+            if (jump.removed || !is_jump(jump.op) || live_at(jump.target) != next_live(index))
+            {
+                continue;
+            }
+
+            if (jump.op == OpCode::JumpIfFalsePop || jump.op == OpCode::JumpIfTruePop)
+            {
+                // Both ways lead to the same place; only the pop remains.
+                inbound[jump.target]--;
+                jump.op = OpCode::Pop;
+            }
+            else
+            {
+                remove(index);
+            }
+            stats.jumps_to_next_removed++;
+            changed = true;
+        }
+        return changed;
+    }
+
+    // A jump may land on the push (it then lands after the pop, which is equivalent), but not on the pop.
+    auto remove_constant_pops() -> bool
+    {
+        auto changed = false;
+        for (std::size_t index = 0; index < instructions.size(); index++)
+        {
+            if (instructions[index].removed || !is_pure_push(instructions[index].op))
+            {
+                continue;
+            }
+
+            const auto pop = next_live(index);
+            if (pop == instructions.size() || instructions[pop].op != OpCode::Pop || is_jump_target(pop))
+            {
+                continue;
+            }
+
+            remove(index);
+            remove(pop);
+            stats.constant_pops_removed++;
+            changed = true;
+        }
+        return changed;
+    }
+
+    // Not, JumpIfFalsePop L => JumpIfTruePop L. Also Not, JumpIfFalse L, Pop, where L starts with a Pop:
+    // the condition is dropped on both paths, so it only decides the branch, and the pair becomes
+    // JumpIfTruePop to just past L's Pop. A jump may land on the Not, which computes the same, but not on
+    // anything after it.
+    auto invert_conditions() -> bool
+    {
+        auto changed = false;
+        for (std::size_t index = 0; index < instructions.size(); index++)
+        {
+            if (instructions[index].removed || instructions[index].op != OpCode::Not)
+            {
+                continue;
+            }
+
+            const auto jump_index = next_live(index);
+            if (jump_index == instructions.size() || is_jump_target(jump_index))
+            {
+                continue;
+            }
+
+            auto& jump = instructions[jump_index];
+            if (jump.op == OpCode::JumpIfFalsePop)
+            {
+                jump.op = OpCode::JumpIfTruePop;
+            }
+            else if (jump.op == OpCode::JumpIfFalse)
+            {
+                const auto fallthrough = next_live(jump_index);
+                const auto target = live_at(jump.target);
+                if (fallthrough == instructions.size() || instructions[fallthrough].op != OpCode::Pop
+                    || is_jump_target(fallthrough) || target == instructions.size()
+                    || instructions[target].op != OpCode::Pop)
+                {
+                    continue;
+                }
+
+                jump.op = OpCode::JumpIfTruePop;
+                retarget(jump, next_live(target));
+                remove(fallthrough);
+            }
+            else
+            {
+                continue;
+            }
+
+            remove(index);
+            stats.conditions_inverted++;
+            changed = true;
+        }
+        return changed;
+    }
+
+    Chunk& chunk;
+    PeepholeStats stats;
+    std::vector<Instruction> instructions;
+    std::vector<std::size_t> index_of;
+    // Number of jumps landing on each instruction, by the index they were given (which may be removed).
+    std::vector<std::size_t> inbound;
+};
@@ -0,0 +1,903 @@
+#pragma once
+
+#include "Chunk.hpp"
+#include "Debug.hpp"
+#include "Folding.hpp"
+#include "Globals.hpp"
+#include "Memory.hpp"
+#include "Parser.hpp"
+#include "Scanner.hpp"
+#include "Value.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+// Code generator for the register engine. Locals are pinned to registers in declaration order and
+// temporaries are allocated above them, so `i = i + 1` on a local compiles to a single ADD r0 r0 k0.
+class RegisterCompiler
+{
+public:
+    RegisterCompiler(std::string_view source, Heap& heap, Globals& globals)
+    : parser{ source }, heap{ heap }, globals{ globals }
+    {
+    }
+
+    // Whether the script can be compiled for the register engine, which has no call frames: it declares
+    // and returns from no function and calls nothing. Any `(` after a token that can end an expression is
+    // taken for a call, so a few scripts without one, such as `if (c) (x);`, are turned down too.
+    [[nodiscard]] static auto supports(std::string_view source) -> bool
+    {
+        auto scanner = Scanner{ source };
+        auto previous = TokenType::Eof;
+        for (auto token = scanner.scan_token(); token.get_type() != TokenType::Eof; token = scanner.scan_token())
+        {
+            switch (token.get_type())
+            {
+            case TokenType::FUN:
+            case TokenType::RETURN: return false;
+            case TokenType::LEFT_PAREN:
+                if (ends_expression(previous))
+                {
+                    return false;
+                }
+                break;
+            default:; // Do nothing.
+            }
+            previous = token.get_type();
+        }
+        return true;
+    }
+
+    std::optional<Chunk> compile()
+    {
+        // Constants are only reachable through the chunk being built until the VM takes it over.
+        const auto roots = heap.add_roots(
+        [this](Heap& gc)
+        {
+            for (const auto& constant : chunk.get_constants())
+            {
+                gc.mark_value(constant);
+            }
+        });
+
+        parser.advance();
+
+        while (!parser.match(TokenType::Eof))
+        {
+            declaration();
+        }
+
+        end_compiler();
+
+        if (parser.had_error)
+        {
+            return std::nullopt;
+        }
+
+        return chunk;
+    }
+
+private:
+    // Where the value of an expression lives. Nothing is copied into a register until the consumer
+    // says where it wants the value, which is what lets results land directly in their destination.
+    struct Operand
+    {
+        enum class Kind : std::uint8_t
+        {
+            Nil,
+            True,
+            False,
+            Constant,  // index is a constant slot.
+            Local,     // index is the register of a local variable.
+            Temporary, // index is a register allocated for this value.
+            Pending,   // index is the offset of an emitted instruction whose A register is not set yet.
+        };
+
+        Kind kind = Kind::Nil;
+        std::size_t index = 0;
+    };
+
+    using PrefixFn = Operand (RegisterCompiler::*)(bool);
+    using InfixFn = Operand (RegisterCompiler::*)(Operand, bool);
+
+    struct Rule
+    {
+        PrefixFn prefix;
+        InfixFn infix;
+        Precedence precedence;
+    };
+
+    struct Local
+    {
+        std::string_view name;
+        int depth = -1;
+    };
+
+    auto declaration() -> void
+    {
+        if (parser.match(TokenType::VAR))
+        {
+            var_declaration();
+        }
+        else if (parser.match(TokenType::FUN))
+        {
+            unsupported_function();
+        }
+        else
+        {
+            statement();
+        }
+
+        if (parser.panic_mode)
+        {
+            parser.synchronize();
+        }
+    }
+
+    auto statement() -> void
+    {
+        if (parser.match(TokenType::PRINT))
+        {
+            print_statement();
+        }
+        else if (parser.match(TokenType::RETURN))
+        {
+            unsupported_function();
+        }
+        else if (parser.match(TokenType::FOR))
+        {
+            for_statement();
+        }
+        else if (parser.match(TokenType::IF))
+        {
+            if_statement();
+        }
+        else if (parser.match(TokenType::WHILE))
+        {
+            while_statement();
+        }
+        else if (parser.match(TokenType::LEFT_BRACE))
+        {
+            begin_scope();
+            block();
+            end_scope();
+        }
+        else
+        {
+            expression_statement();
+        }
+    }
+
+    auto block() -> void
+    {
+        while (!parser.check(TokenType::RIGHT_BRACE) && !parser.check(TokenType::Eof))
+        {
+            declaration();
+        }
+
+        parser.consume(TokenType::RIGHT_BRACE, "Expect '}' after block.");
+    }
+
+    auto var_declaration() -> void
+    {
+        parser.consume(TokenType::IDENTIFIER, "Expect variable name.");
+        const auto name = parser.previous;
+
+        if (scope_depth == 0)
+        {
+            auto* global_name = heap.make_string(name.get_lexme());
+            heap.write_barrier(values::make(global_name));
+            const auto global = globals.declare(global_name);
+
+            auto value = parser.match(TokenType::EQUAL) ? expression() : Operand{};
+            value = to_register(value);
+            if (global <= std::numeric_limits<std::uint16_t>::max())
+            {
+                emit_bx(RegOp::DefineGlobalSlot, value.index, global);
+            }
+            else
+            {
+                emit_bx(RegOp::DefineGlobal, value.index, make_constant(values::make(global_name)));
+            }
+            release(value);
+
+            if (global >= defined_globals.size())
+            {
+                defined_globals.resize(global + 1);
+            }
+            defined_globals[global] = true;
+        }
+        else
+        {
+            const auto target = declare_local(name);
+            auto value = parser.match(TokenType::EQUAL) ? expression() : Operand{};
+            discharge_to(value, target);
+            release(value);
+            locals.back().depth = static_cast<int>(scope_depth);
+        }
+
+        parser.consume(TokenType::SEMICOLON, "Expect ';' after variable declaration.");
+    }
+
+    auto print_statement() -> void
+    {
+        auto value = expression();
+        parser.consume(TokenType::SEMICOLON, "Expect ';' after value.");
+        const auto operand = to_rk(value);
+        emit(RegOp::Print, 0, operand);
+        release(value);
+    }
+
+    auto expression_statement() -> void
+    {
+        auto value = expression();
+        parser.consume(TokenType::SEMICOLON, "Expect ';' after expression.");
+        if (value.kind == Operand::Kind::Pending)
+        {
+            value = to_register(value);
+        }
+        release(value);
+    }
+
+    auto if_statement() -> void
+    {
+        parser.consume(TokenType::LEFT_PAREN, "Expect '(' after 'if'.");
+        const auto condition = to_register(expression());
+        parser.consume(TokenType::RIGHT_PAREN, "Expect ')' after condition.");
+
+        const auto then_jump = emit_jump(RegOp::JumpIfFalse, condition.index);
+        release(condition);
+        statement();
+
+        if (parser.match(TokenType::ELSE))
+        {
+            const auto else_jump = emit_jump(RegOp::Jump);
+            patch_jump(then_jump);
+            statement();
+            patch_jump(else_jump);
+        }
+        else
+        {
+            patch_jump(then_jump);
+        }
+    }
+
+    auto while_statement() -> void
+    {
+        const auto loop_start = chunk.size();
+        parser.consume(TokenType::LEFT_PAREN, "Expect '(' after 'while'.");
+        const auto condition = to_register(expression());
+        parser.consume(TokenType::RIGHT_PAREN, "Expect ')' after condition.");
+
+        const auto exit_jump = emit_jump(RegOp::JumpIfFalse, condition.index);
+        release(condition);
+        statement();
+        emit_loop(loop_start);
+
+        patch_jump(exit_jump);
+    }
+
+    auto for_statement() -> void
+    {
+        begin_scope();
+
+        parser.consume(TokenType::LEFT_PAREN, "Expect '(' after 'for'.");
+
+        if (parser.match(TokenType::SEMICOLON))
+        {
+        }
+        else if (parser.match(TokenType::VAR))
+        {
+            var_declaration();
+        }
+        else
+        {
+            expression_statement();
+        }
+
+        auto loop_start = chunk.size();
+        std::optional<std::size_t> exit_jump;
+
+        if (!parser.match(TokenType::SEMICOLON))
+        {
+            const auto condition = to_register(expression());
+            parser.consume(TokenType::SEMICOLON, "Expect ';' after loop condition.");
+
+            exit_jump = emit_jump(RegOp::JumpIfFalse, condition.index);
+            release(condition);
+        }
+
+        if (!parser.match(TokenType::RIGHT_PAREN))
+        {
+            const auto body_jump = emit_jump(RegOp::Jump);
+            const auto increment_start = chunk.size();
+            auto increment = expression();
+            if (increment.kind == Operand::Kind::Pending)
+            {
+                increment = to_register(increment);
+            }
+            release(increment);
+
+            parser.consume(TokenType::RIGHT_PAREN, "Expect ')' after for clauses.");
+
+            emit_loop(loop_start);
+            loop_start = increment_start;
+            patch_jump(body_jump);
+        }
+
+        statement();
+        emit_loop(loop_start);
+
+        if (exit_jump)
+        {
+            patch_jump(*exit_jump);
+        }
+
+        end_scope();
+    }
+
+    auto expression() -> Operand
+    {
+        return parse_precedence(Precedence::ASSIGNMENT);
+    }
+
+    auto parse_precedence(Precedence precedence) -> Operand
+    {
+        parser.advance();
+        const auto prefix_rule = get_rule(parser.previous.get_type()).prefix;
+        if (prefix_rule == nullptr)
+        {
+            parser.error("Expected expression.");
+            return {};
+        }
+
+        const auto can_assign = precedence <= Precedence::ASSIGNMENT;
+        const auto start = chunk.mark();
+        auto operand = std::invoke(prefix_rule, this, can_assign);
+
+        while (precedence <= get_rule(parser.current.get_type()).precedence)
+        {
+            parser.advance();
+            const auto infix_rule = get_rule(parser.previous.get_type()).infix;
+            infix_lhs = start;
+            operand = std::invoke(infix_rule, this, operand, can_assign);
+        }
+
+        if (can_assign && parser.match(TokenType::EQUAL))
+        {
+            parser.error("Invalid assignment target.");
+        }
+
+        return operand;
+    }
+
+    auto number([[maybe_unused]] bool can_assign) -> Operand
+    {
+        Number value{};
+        std::from_chars(parser.previous.get_lexme().begin(), parser.previous.get_lexme().end(), value);
+        return { .kind = Operand::Kind::Constant, .index = make_constant(values::make(value)) };
+    }
+
+    auto string([[maybe_unused]] bool can_assign) -> Operand
+    {
+        const auto lexme = parser.previous.get_lexme();
+        const auto constant = make_constant(values::make(heap.make_string(lexme.substr(1, lexme.size() - 2))));
+        return { .kind = Operand::Kind::Constant, .index = constant };
+    }
+
+    auto literal([[maybe_unused]] bool can_assign) -> Operand
+    {
+        switch (parser.previous.get_type())
+        {
+        case TokenType::FALSE: return { .kind = Operand::Kind::False };
+        case TokenType::TRUE: return { .kind = Operand::Kind::True };
+        default: return { .kind = Operand::Kind::Nil };
+        }
+    }
+
+    auto call(Operand callee, [[maybe_unused]] bool can_assign) -> Operand
+    {
+        unsupported_function();
+        return callee;
+    }
+
+    // Register code has no call frames; Compiler::compile sends scripts with functions to the stack engine
+    // (see supports). The rest of the declaration is skipped as after any other error.
+    auto unsupported_function() -> void
+    {
+        parser.error("The register engine does not support functions.");
+    }
+
+    auto grouping([[maybe_unused]] bool can_assign) -> Operand
+    {
+        auto operand = expression();
+        parser.consume(TokenType::RIGHT_PAREN, "Expect ')' after expression.");
+        return operand;
+    }
+
+    auto variable(bool can_assign) -> Operand
+    {
+        const auto name = parser.previous;
+        const auto local = resolve_local(name);
+
+        if (local)
+        {
+            const Operand target{ .kind = Operand::Kind::Local, .index = *local };
+            if (can_assign && parser.match(TokenType::EQUAL))
+            {
+                auto value = expression();
+                discharge_to(value, *local);
+                release(value);
+            }
+            return target;
+        }
+
+        const auto slot = resolve_global(name);
+        const auto global = slot ? *slot : identifier_constant(name);
+        if (can_assign && parser.match(TokenType::EQUAL))
+        {
+            const auto value = to_register(expression());
+            emit_bx(slot ? RegOp::SetGlobalSlot : RegOp::SetGlobal, value.index, global);
+            return value;
+        }
+
+        return pending(registers::encode_bx(slot ? RegOp::GetGlobalSlot : RegOp::GetGlobal, 0, global));
+    }
+
+    // Same rule as the stack compiler: slots only for globals certain to be defined when this code runs.
+    [[nodiscard]] auto resolve_global(const Token& name) -> std::optional<std::size_t>
+    {
+        auto* const interned = heap.find_interned(name.get_lexme());
+        const auto slot = interned != nullptr ? globals.find(interned) : std::nullopt;
+        if (!slot || *slot > std::numeric_limits<std::uint16_t>::max())
+        {
+            return std::nullopt;
+        }
+
+        if (!globals.is_defined(*slot) && (*slot >= defined_globals.size() || !defined_globals[*slot]))
+        {
+            return std::nullopt;
+        }
+
+        return slot;
+    }
+
+    auto unary([[maybe_unused]] bool can_assign) -> Operand
+    {
+        const auto operator_type = parser.previous.get_type();
+        const auto operand_start = chunk.mark();
+
+        auto operand = parse_precedence(Precedence::UNARY);
+        if (const auto value = literal_value(operand))
+        {
+            if (const auto folded = folding::unary(operator_type, *value))
+            {
+                drop_constants(operand_start);
+                return literal_operand(*folded);
+            }
+        }
+
+        const auto rk = to_rk(operand);
+        release(operand);
+
+        return pending(registers::encode(operator_type == TokenType::MINUS ? RegOp::Negate : RegOp::Not, 0, rk));
+    }
+
+    auto binary(Operand lhs, [[maybe_unused]] bool can_assign) -> Operand
+    {
+        const auto operator_type = parser.previous.get_type();
+        const auto lhs_value = literal_value(lhs);
+        const auto lhs_expression = infix_lhs;
+        const auto lhs_start = chunk.mark();
+        // A local used in place would be read after the right operand runs, so `a + (a = 2)` must copy it first.
+        if (lhs.kind == Operand::Kind::Local && parser.assigns_ahead(locals[lhs.index].name))
+        {
+            lhs = to_temporary(lhs);
+        }
+        const auto b = to_rk(lhs);
+
+        auto rhs = parse_precedence(next_precedence(get_rule(operator_type).precedence));
+        if (const auto rhs_value = literal_value(rhs); lhs_value && rhs_value)
+        {
+            if (const auto folded = folding::binary(operator_type, *lhs_value, *rhs_value, heap))
+            {
+                // A literal operand emits nothing but, for a constant too far out for an RK operand, the load
+                // of lhs into a temporary.
+                release(lhs);
+                chunk.truncate(lhs_start.code);
+                drop_constants(lhs_expression.code == lhs_start.code ? lhs_expression : lhs_start);
+                return literal_operand(*folded);
+            }
+        }
+
+        const auto c = to_rk(rhs);
+
+        release(rhs);
+        release(lhs);
+
+        switch (operator_type)
+        {
+        case TokenType::BANG_EQUAL: return negated(pending(registers::encode(RegOp::Equal, 0, b, c)));
+        case TokenType::EQUAL_EQUAL: return pending(registers::encode(RegOp::Equal, 0, b, c));
+        case TokenType::GREATER: return pending(registers::encode(RegOp::Greater, 0, b, c));
+        case TokenType::GREATER_EQUAL: return negated(pending(registers::encode(RegOp::Less, 0, b, c)));
+        case TokenType::LESS: return pending(registers::encode(RegOp::Less, 0, b, c));
+        case TokenType::LESS_EQUAL: return negated(pending(registers::encode(RegOp::Greater, 0, b, c)));
+        case TokenType::PLUS: return pending(registers::encode(RegOp::Add, 0, b, c));
+        case TokenType::MINUS: return pending(registers::encode(RegOp::Subtract, 0, b, c));
+        case TokenType::STAR: return pending(registers::encode(RegOp::Multiply, 0, b, c));
+        case TokenType::SLASH: return pending(registers::encode(RegOp::Divide, 0, b, c));
+        default: return {}; // Unreachable.
+        }
+    }
+
+    // `and` and `or` leave whichever operand decided the result in one shared register.
+    auto and_(Operand lhs, [[maybe_unused]] bool can_assign) -> Operand
+    {
+        return logical(lhs, RegOp::JumpIfFalse, Precedence::AND);
+    }
+
+    auto or_(Operand lhs, [[maybe_unused]] bool can_assign) -> Operand
+    {
+        return logical(lhs, RegOp::JumpIfTrue, Precedence::OR);
+    }
+
+    auto logical(Operand lhs, RegOp short_circuit, Precedence precedence) -> Operand
+    {
+        const auto result = to_temporary(lhs);
+        const auto end_jump = emit_jump(short_circuit, result.index);
+
+        auto rhs = parse_precedence(precedence);
+        discharge_to(rhs, result.index);
+        release(rhs);
+
+        patch_jump(end_jump);
+        return result;
+    }
+
+    auto negated(Operand operand) -> Operand
+    {
+        const auto rk = to_rk(operand);
+        release(operand);
+        return pending(registers::encode(RegOp::Not, 0, rk));
+    }
+
+    // Makes the operand's value available in `target`, emitting at most one instruction.
+    auto discharge_to(const Operand& operand, std::size_t target) -> void
+    {
+        switch (operand.kind)
+        {
+        case Operand::Kind::Nil: emit(RegOp::LoadNil, target); break;
+        case Operand::Kind::True: emit(RegOp::LoadTrue, target); break;
+        case Operand::Kind::False: emit(RegOp::LoadFalse, target); break;
+        case Operand::Kind::Constant: emit_bx(RegOp::LoadConstant, target, operand.index); break;
+        case Operand::Kind::Local:
+        case Operand::Kind::Temporary:
+            if (operand.index != target)
+            {
+                emit(RegOp::Move, target, static_cast<std::uint8_t>(operand.index));
+            }
+            break;
+        case Operand::Kind::Pending:
+        {
+            const auto word = registers::with_a(chunk.word_at(operand.index), static_cast<std::uint8_t>(target));
+            chunk.set_word(operand.index, word);
+            break;
+        }
+        }
+    }
+
+    // Locals are used in place; everything else gets a fresh temporary.
+    auto to_register(const Operand& operand) -> Operand
+    {
+        if (operand.kind == Operand::Kind::Local || operand.kind == Operand::Kind::Temporary)
+        {
+            return operand;
+        }
+
+        return to_temporary(operand);
+    }
+
+    auto to_temporary(const Operand& operand) -> Operand
+    {
+        if (operand.kind == Operand::Kind::Temporary)
+        {
+            return operand;
+        }
+
+        const auto target = allocate_register();
+        discharge_to(operand, target);
+        return { .kind = Operand::Kind::Temporary, .index = target };
+    }
+
+    // Encodes the operand for a B or C field, loading it into a register only when it cannot be
+    // referenced directly. Updates `operand` so the caller can release whatever was allocated.
+    auto to_rk(Operand& operand) -> std::uint8_t
+    {
+        switch (operand.kind)
+        {
+        case Operand::Kind::Nil: operand = constant_operand(values::make(Nil{})); break;
+        case Operand::Kind::True: operand = constant_operand(values::make(true)); break;
+        case Operand::Kind::False: operand = constant_operand(values::make(false)); break;
+        default: break;
+        }
+
+        if (operand.kind == Operand::Kind::Constant && operand.index < registers::max_rk_constants)
+        {
+            return static_cast<std::uint8_t>(registers::constant_flag | operand.index);
+        }
+
+        operand = to_register(operand);
+        return static_cast<std::uint8_t>(operand.index);
+    }
+
+    [[nodiscard]] auto literal_value(const Operand& operand) const -> std::optional<Value>
+    {
+        switch (operand.kind)
+        {
+        case Operand::Kind::Nil: return values::make(Nil{});
+        case Operand::Kind::True: return values::make(true);
+        case Operand::Kind::False: return values::make(false);
+        case Operand::Kind::Constant: return chunk.get_constants()[operand.index];
+        default: return std::nullopt;
+        }
+    }
+
+    // Takes back the constants added since `start` once the literals using them are folded away, unless code
+    // emitted since then, such as the store of `(a = 1)`, may use them too.
+    auto drop_constants(const Chunk::Mark& start) -> void
+    {
+        if (chunk.size() == start.code)
+        {
+            chunk.truncate_constants(start.constants);
+        }
+    }
+
+    auto literal_operand(const Value& value) -> Operand
+    {
+        if (values::is<Boolean>(value))
+        {
+            return { .kind = values::as<Boolean>(value) ? Operand::Kind::True : Operand::Kind::False };
+        }
+        return constant_operand(value);
+    }
+
+    auto constant_operand(const Value& value) -> Operand
+    {
+        return { .kind = Operand::Kind::Constant, .index = make_constant(value) };
+    }
+
+    auto allocate_register() -> std::size_t
+    {
+        if (free_register == registers::max_registers)
+        {
+            parser.error("Too many registers in use.");
+            return 0;
+        }
+
+        register_count = std::max(register_count, free_register + 1);
+        return free_register++;
+    }
+
+    // Temporaries are released in reverse order of allocation, so only the topmost one can be freed.
+    auto release(const Operand& operand) -> void
+    {
+        if (operand.kind == Operand::Kind::Temporary && operand.index + 1 == free_register)
+        {
+            free_register--;
+        }
+    }
+
+    auto declare_local(const Token& name) -> std::size_t
+    {
+        for (auto local = locals.rbegin(); local != locals.rend(); ++local)
+        {
+            if (local->depth != -1 && local->depth < static_cast<int>(scope_depth))
+            {
+                break;
+            }
+
+            if (local->name == name.get_lexme())
+            {
+                parser.error("Already a variable with this name in this scope.");
+            }
+        }
+
+        locals.push_back({ .name = name.get_lexme(), .depth = -1 });
+        return allocate_register();
+    }
+
+    auto resolve_local(const Token& name) -> std::optional<std::size_t>
+    {
+        for (auto i = locals.size(); i-- > 0;)
+        {
+            if (locals[i].name == name.get_lexme())
+            {
+                if (locals[i].depth == -1)
+                {
+                    parser.error("Can't read local variable in its own initializer.");
+                }
+                return i;
+            }
+        }
+
+        return std::nullopt;
+    }
+
+    auto begin_scope() noexcept -> void
+    {
+        scope_depth++;
+    }
+
+    auto end_scope() -> void
+    {
+        scope_depth--;
+
+        while (!locals.empty() && locals.back().depth > static_cast<int>(scope_depth))
+        {
+            locals.pop_back();
+        }
+
+        // Leaving a scope frees its registers without emitting anything.
+        free_register = locals.size();
+    }
+
+    auto identifier_constant(const Token& token) -> std::size_t
+    {
+        return make_constant(values::make(heap.make_string(token.get_lexme())));
+    }
+
+    auto make_constant(const Value& value) -> std::size_t
+    {
+        const auto constant = chunk.add_constant(value);
+        if (constant > std::numeric_limits<std::uint16_t>::max())
+        {
+            parser.error("Too many constants in one chunk.");
+            return 0;
+        }
+        return constant;
+    }
+
+    auto emit(RegOp op, std::size_t a, std::uint8_t b = 0, std::uint8_t c = 0) -> void
+    {
+        chunk.write_word(registers::encode(op, static_cast<std::uint8_t>(a), b, c), parser.previous.get_line());
+    }
+
+    auto emit_bx(RegOp op, std::size_t a, std::size_t bx) -> void
+    {
+        chunk.write_word(registers::encode_bx(op, static_cast<std::uint8_t>(a), static_cast<std::uint16_t>(bx)),
+                         parser.previous.get_line());
+    }
+
+    auto pending(std::uint32_t word) -> Operand
+    {
+        const auto offset = chunk.size();
+        chunk.write_word(word, parser.previous.get_line());
+        return { .kind = Operand::Kind::Pending, .index = offset };
+    }
+
+    auto emit_jump(RegOp op, std::size_t condition = 0) -> std::size_t
+    {
+        const auto offset = chunk.size();
+        emit(op, condition);
+        return offset;
+    }
+
+    auto patch_jump(std::size_t offset) -> void
+    {
+        set_jump_target(offset, chunk.size());
+    }
+
+    auto emit_loop(std::size_t loop_start) -> void
+    {
+        set_jump_target(emit_jump(RegOp::Loop), loop_start);
+    }
+
+    auto set_jump_target(std::size_t offset, std::size_t target) -> void
+    {
+        const auto distance = (static_cast<std::ptrdiff_t>(target) - static_cast<std::ptrdiff_t>(offset))
+                              / static_cast<std::ptrdiff_t>(registers::instruction_size)
+                              - 1;
+
+        if (distance < std::numeric_limits<std::int16_t>::min() || distance > std::numeric_limits<std::int16_t>::max())
+        {
+            parser.error("Too much code to jump over.");
+        }
+
+        chunk.set_word(offset, registers::with_bx(chunk.word_at(offset), static_cast<std::uint16_t>(distance)));
+    }
+
+    auto end_compiler() -> void
+    {
+        emit(RegOp::Return, 0);
+        chunk.set_registers(register_count);
+
+        if (!parser.had_error && debug::enabled)
+        {
+            debug::Debug::dissassemble_chunk(chunk, "code");
+        }
+    }
+
+    [[nodiscard]] static constexpr auto ends_expression(TokenType type) noexcept -> bool
+    {
+        switch (type)
+        {
+        case TokenType::IDENTIFIER:
+        case TokenType::STRING:
+        case TokenType::NUMBER:
+        case TokenType::TRUE:
+        case TokenType::FALSE:
+        case TokenType::NIL:
+        case TokenType::RIGHT_PAREN: return true;
+        default: return false;
+        }
+    }
+
+    [[nodiscard]] auto get_rule(TokenType type) const -> const Rule&
+    {
+        return rules[static_cast<std::size_t>(type)];
+    }
+
+    std::vector<Rule> rules{
+        { .prefix = &RegisterCompiler::grouping, .infix = &RegisterCompiler::call, .precedence = Precedence::CALL }, // LEFT_PAREN
+        { .prefix = nullptr, .infix = nullptr, .precedence = Precedence::NONE }, // RIGHT_PAREN
+        { .prefix = nullptr, .infix = nullptr, .precedence = Precedence::NONE }, // LEFT_BRACE
+        { .prefix = nullptr, .infix = nullptr, .precedence = Precedence::NONE }, // RIGHT_BRACE
+        { .prefix = nullptr, .infix = nullptr, .precedence = Precedence::NONE }, // COMMA
+        { .prefix = nullptr, .infix = nullptr, .precedence = Precedence::NONE }, // DOT
+        { .prefix = &RegisterCompiler::unary, .infix = &RegisterCompiler::binary, .precedence = Precedence::TERM }, // MINUS
+        { .prefix = nullptr, .infix = &RegisterCompiler::binary, .precedence = Precedence::TERM }, // PLUS
+        { .prefix = nullptr, .infix = nullptr, .precedence = Precedence::NONE }, // SEMICOLON
+        { .prefix = nullptr, .infix = &RegisterCompiler::binary, .precedence = Precedence::FACTOR }, // SLASH
+        { .prefix = nullptr, .infix = &RegisterCompiler::binary, .precedence = Precedence::FACTOR }, // STAR
+        { .prefix = &RegisterCompiler::unary, .infix = nullptr, .precedence = Precedence::NONE }, // BANG
+        { .prefix = nullptr, .infix = &RegisterCompiler::binary, .precedence = Precedence::EQUALITY }, // BANG_EQUAL
+        { .prefix = nullptr, .infix = nullptr, .precedence = Precedence::NONE }, // EQUAL
+        { .prefix = nullptr, .infix = &RegisterCompiler::binary, .precedence = Precedence::EQUALITY }, // EQUAL_EQUAL
+        { .prefix = nullptr, .infix = &RegisterCompiler::binary, .precedence = Precedence::COMPARISON }, // GREATER
+        { .prefix = nullptr, .infix = &RegisterCompiler::binary, .precedence = Precedence::COMPARISON }, // GREATER_EQUAL
+        { .prefix = nullptr, .infix = &RegisterCompiler::binary, .precedence = Precedence::COMPARISON }, // LESS
+        { .prefix = nullptr, .infix = &RegisterCompiler::binary, .precedence = Precedence::COMPARISON }, // LESS_EQUAL
+        { .prefix = &RegisterCompiler::variable, .infix = nullptr, .precedence = Precedence::NONE }, // IDENTIFIER
+        { .prefix = &RegisterCompiler::string, .infix = nullptr, .precedence = Precedence::NONE }, // STRING
+        { .prefix = &RegisterCompiler::number, .infix = nullptr, .precedence = Precedence::NONE }, // NUMBER
+        { .prefix = nullptr, .infix = &RegisterCompiler::and_, .precedence = Precedence::AND }, // AND
+        { .prefix = nullptr, .infix = nullptr, .precedence = Precedence::NONE }, // CLASS
+        { .prefix = nullptr, .infix = nullptr, .precedence = Precedence::NONE }, // ELSE
+        { .prefix = &RegisterCompiler::literal, .infix = nullptr, .precedence = Precedence::NONE }, // FALSE
+        { .prefix = nullptr, .infix = nullptr, .precedence = Precedence::NONE }, // FOR
+        { .prefix = nullptr, .infix = nullptr, .precedence = Precedence::NONE }, // FUN
+        { .prefix = nullptr, .infix = nullptr, .precedence = Precedence::NONE }, // IF
+        { .prefix = &RegisterCompiler::literal, .infix = nullptr, .precedence = Precedence::NONE }, // NIL
+        { .prefix = nullptr, .infix = &RegisterCompiler::or_, .precedence = Precedence::OR }, // OR
+        { .prefix = nullptr, .infix = nullptr, .precedence = Precedence::NONE }, // PRINT
+        { .prefix = nullptr, .infix = nullptr, .precedence = Precedence::NONE }, // RETURN
+        { .prefix = nullptr, .infix = nullptr, .precedence = Precedence::NONE }, // SUPER
+        { .prefix = nullptr, .infix = nullptr, .precedence = Precedence::NONE }, // THIS
+        { .prefix = &RegisterCompiler::literal, .infix = nullptr, .precedence = Precedence::NONE }, // TRUE
+        { .prefix = nullptr, .infix = nullptr, .precedence = Precedence::NONE }, // VAR
+        { .prefix = nullptr, .infix = nullptr, .precedence = Precedence::NONE }, // WHILE
+        { .prefix = nullptr, .infix = nullptr, .precedence = Precedence::NONE }, // ERROR
+        { .prefix = nullptr, .infix = nullptr, .precedence = Precedence::NONE }, // Eof
+    };
+
+    Parser parser;
+    Heap& heap;
+    Globals& globals;
+    Chunk chunk;
+    // Slots of the globals defined by top-level declarations compiled so far.
+    std::vector<bool> defined_globals;
+    std::vector<Local> locals;
+    std::size_t scope_depth = 0;
+    std::size_t free_register = 0;
+    std::size_t register_count = 0;
+    // Where the left operand of the infix rule being parsed begins.
+    Chunk::Mark infix_lhs{};
+};
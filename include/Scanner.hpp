@@ -282,6 +282,11 @@ private:
 
     auto check_keyword(std::size_t beg, std::string_view rest, TokenType type) -> TokenType
     {
+        if (current - start != beg + rest.length())
+        {
+            return TokenType::IDENTIFIER;
+        }
+
         const auto expected = std::string_view{ source.begin() + start + beg, source.begin() + start + beg + rest.length() };
         if (rest == expected)
         {
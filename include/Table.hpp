@@ -0,0 +1,233 @@
+#pragma once
+
+#include "Object.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Open-addressing hash table keyed by interned strings. Since keys are unique per contents they are
+// compared by pointer, and probing starts from the hash cached in the string, so a lookup never touches
+// the characters. Linear probing over a power-of-two array; erased entries leave a tombstone that keeps
+// probe chains intact until the next rehash.
+template <typename V>
+class Table
+{
+public:
+    static constexpr double default_max_load = 0.75;
+
+    explicit Table(double max_load = default_max_load) noexcept : max_load{ max_load }
+    {
+    }
+
+    [[nodiscard]] auto find(const ObjString* key) noexcept -> V*
+    {
+        auto* entry = find_entry(key);
+        return entry != nullptr && entry->key == key ? &entry->value : nullptr;
+    }
+
+    [[nodiscard]] auto find(const ObjString* key) const noexcept -> const V*
+    {
+        return const_cast<Table*>(this)->find(key);
+    }
+
+    // Inserts `value` unless the key is present; returns the stored value and whether it was inserted.
+    auto try_emplace(ObjString* key, V value = {}) -> std::pair<V*, bool>
+    {
+        if (const auto found = find(key); found != nullptr)
+        {
+            return { found, false };
+        }
+
+        grow_if_needed();
+
+        auto* entry = find_entry(key);
+        if (entry->key == nullptr)
+        {
+            used++;
+        }
+        count++;
+        entry->key = key;
+        entry->value = std::move(value);
+        return { &entry->value, true };
+    }
+
+    auto erase(const ObjString* key) noexcept -> bool
+    {
+        auto* entry = find_entry(key);
+        if (entry == nullptr || entry->key != key)
+        {
+            return false;
+        }
+
+        entry->key = tombstone();
+        entry->value = V{};
+        count--;
+        return true;
+    }
+
+    // Content lookup, the one place keys are compared by their characters: finds the interned string
+    // equal to `chars`, if any.
+    [[nodiscard]] auto find_string(std::string_view chars, std::uint32_t hash) const noexcept -> ObjString*
+    {
+        if (entries.empty())
+        {
+            return nullptr;
+        }
+
+        const auto mask = entries.size() - 1;
+        for (auto index = hash & mask;; index = (index + 1) & mask)
+        {
+            auto* key = entries[index].key;
+            if (key == nullptr)
+            {
+                return nullptr;
+            }
+            if (key != tombstone() && key->get_hash() == hash && key->view() == chars)
+            {
+                return key;
+            }
+        }
+    }
+
+    // Visits every key; entries for which `keep` returns false are erased. `keep` may also replace the key
+    // with another one of the same hash (the collector swaps in promoted copies this way).
+    template <typename F>
+    auto prune(F keep) -> void
+    {
+        for (auto& entry : entries)
+        {
+            if (entry.key != nullptr && entry.key != tombstone() && !keep(entry.key))
+            {
+                entry.key = tombstone();
+                entry.value = V{};
+                count--;
+            }
+        }
+    }
+
+    auto clear() noexcept -> void
+    {
+        entries.clear();
+        count = 0;
+        used = 0;
+    }
+
+    [[nodiscard]] auto size() const noexcept -> std::size_t
+    {
+        return count;
+    }
+
+    [[nodiscard]] auto capacity() const noexcept -> std::size_t
+    {
+        return entries.size();
+    }
+
+    // Fraction of the slots, tombstones included, that may be in use before the table grows; must be in
+    // (0, 1). Lower trades memory for shorter probe sequences.
+    auto set_max_load(double load) -> void
+    {
+        max_load = load;
+        if (entries.empty())
+        {
+            return;
+        }
+
+        auto new_capacity = min_capacity;
+        while (static_cast<double>(count + 1) > static_cast<double>(new_capacity) * max_load)
+        {
+            new_capacity *= 2;
+        }
+        rehash(new_capacity);
+    }
+
+private:
+    struct Entry
+    {
+        ObjString* key = nullptr;
+        [[no_unique_address]] V value{};
+    };
+
+    static constexpr std::size_t min_capacity = 8;
+
+    // Never dereferenced: only ever compared against.
+    [[nodiscard]] static auto tombstone() noexcept -> ObjString*
+    {
+        return reinterpret_cast<ObjString*>(alignof(ObjString));
+    }
+
+    // Returns the entry holding `key`, or the one an insertion should use: the first tombstone on the
+    // probe sequence if there was one, otherwise the empty slot that ended it.
+    [[nodiscard]] auto find_entry(const ObjString* key) noexcept -> Entry*
+    {
+        if (entries.empty())
+        {
+            return nullptr;
+        }
+
+        Entry* first_tombstone = nullptr;
+        const auto mask = entries.size() - 1;
+        for (auto index = key->get_hash() & mask;; index = (index + 1) & mask)
+        {
+            auto& entry = entries[index];
+            if (entry.key == key)
+            {
+                return &entry;
+            }
+            if (entry.key == nullptr)
+            {
+                return first_tombstone != nullptr ? first_tombstone : &entry;
+            }
+            if (entry.key == tombstone() && first_tombstone == nullptr)
+            {
+                first_tombstone = &entry;
+            }
+        }
+    }
+
+    // Called before an insertion that may take an empty slot. When that would pass the load limit the table
+    // is rebuilt, doubling in size unless it is mostly tombstones, which the rebuild simply drops.
+    auto grow_if_needed() -> void
+    {
+        if (static_cast<double>(used + 1) <= static_cast<double>(entries.size()) * max_load)
+        {
+            return;
+        }
+
+        auto new_capacity = entries.empty() ? min_capacity : entries.size();
+        if (static_cast<double>(count + 1) > static_cast<double>(new_capacity) * max_load / 2)
+        {
+            new_capacity *= 2;
+        }
+        rehash(new_capacity);
+    }
+
+    auto rehash(std::size_t new_capacity) -> void
+    {
+        auto old_entries = std::exchange(entries, std::vector<Entry>(new_capacity));
+        used = count;
+
+        const auto mask = new_capacity - 1;
+        for (auto& entry : old_entries)
+        {
+            if (entry.key == nullptr || entry.key == tombstone())
+            {
+                continue;
+            }
+
+            auto index = entry.key->get_hash() & mask;
+            while (entries[index].key != nullptr)
+            {
+                index = (index + 1) & mask;
+            }
+            entries[index] = std::move(entry);
+        }
+    }
+
+    std::vector<Entry> entries;
+    std::size_t count = 0; // Live entries.
+    std::size_t used = 0;  // Live entries plus tombstones: what probe lengths depend on.
+    double max_load;
+};
@@ -1,30 +1,55 @@
 #pragma once
 
+#include "Object.hpp"
 
+#include <bit>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <expected>
+#include <limits>
 #include <memory>
+#include <optional>
+#include <ostream>
+#include <span>
 #include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
 #include <variant>
 #include <vector>
 
 using Number = double;
 using Boolean = bool;
-using String = std::string;
 
+struct Nil
+{
+    auto operator==(const Nil& other) const -> bool = default;
+};
+
+// A compiled function body. Copies share the same chunk, so a copy costs a reference count; the compiler
+// only writes to the chunk before it is wrapped in an ObjFunction, and the VM's run-time state in it (global
+// cache, quickened instructions) is meant to be shared by everything running the code.
 class Function
 {
 public:
-    Function();
-
-    Function(const Function& other);
-    Function& operator=(const Function& other);
-
-    Function(Function&& other) noexcept;
-    Function& operator=(Function&& other) noexcept;
+    // Where a closure over the function finds a variable it captures, when it is created: a local slot of
+    // the enclosing function, or one of the enclosing closure's own upvalues.
+    struct Capture
+    {
+        std::uint8_t index;
+        bool is_local;
 
-    bool operator==(const Function& other) const;
+        auto operator==(const Capture& other) const -> bool = default;
+    };
 
+    Function();
 
-    ~Function();
+    // Identity: two functions are equal when they share their code, whatever their names.
+    [[nodiscard]] auto operator==(const Function& other) const noexcept -> bool
+    {
+        return chunk_ptr == other.chunk_ptr;
+    }
 
     [[nodiscard]] auto chunk() const noexcept -> class Chunk&;
 
@@ -33,49 +58,344 @@ public:
         return name;
     }
 
+    auto set_name(std::string function_name) -> void
+    {
+        name = std::move(function_name);
+    }
+
+    [[nodiscard]] auto get_arity() const noexcept -> std::size_t
+    {
+        return arity;
+    }
+
+    auto set_arity(std::size_t count) noexcept -> void
+    {
+        arity = count;
+    }
+
+    // One per upvalue; a function without any runs without a closure.
+    [[nodiscard]] auto get_captures() const noexcept -> const std::vector<Capture>&
+    {
+        return captures;
+    }
+
+    auto add_capture(Capture capture) -> void
+    {
+        captures.push_back(capture);
+    }
 
 private:
     std::size_t arity = 0;
-    std::unique_ptr<class Chunk> chunk_ptr;
+    std::vector<Capture> captures;
+    std::shared_ptr<class Chunk> chunk_ptr;
     std::string name;
 };
 
-using Value = std::variant<Boolean, Number, String, Function>;
+// A compiled function as a value. Always allocated in the old generation: the code only ever holds old
+// strings in its constants, so it never has to be rewritten by a minor collection.
+class ObjFunction : public Obj
+{
+public:
+    static constexpr auto object_type = ObjType::Function;
+
+    explicit ObjFunction(Function function) : Obj{ object_type }, function{ std::move(function) }
+    {
+    }
+
+    Function function;
+};
+
+#if defined(AXOLOTL_NAN_BOXING)
+
+// A value is a single 64-bit word. Numbers are stored as plain doubles; every other kind is encoded
+// in the payload of a quiet NaN that no arithmetic operation produces: nil and booleans use small tags,
+// objects set the sign bit and keep their address in the low 48 bits.
+class Value
+{
+public:
+    constexpr Value() noexcept = default;
+
+    constexpr explicit Value([[maybe_unused]] Nil nil) noexcept
+    {
+    }
+
+    constexpr explicit Value(Boolean boolean) noexcept : bits{ boolean ? true_bits : false_bits }
+    {
+    }
+
+    constexpr explicit Value(Number number) noexcept : bits{ std::bit_cast<std::uint64_t>(number) }
+    {
+    }
+
+    explicit Value(Obj* obj) noexcept : bits{ sign_bit | quiet_nan | reinterpret_cast<std::uintptr_t>(obj) }
+    {
+    }
+
+    [[nodiscard]] constexpr auto is_nil() const noexcept -> bool
+    {
+        return bits == nil_bits;
+    }
+
+    [[nodiscard]] constexpr auto is_bool() const noexcept -> bool
+    {
+        return (bits | 1U) == true_bits;
+    }
+
+    [[nodiscard]] constexpr auto is_number() const noexcept -> bool
+    {
+        return (bits & quiet_nan) != quiet_nan;
+    }
+
+    [[nodiscard]] constexpr auto is_obj() const noexcept -> bool
+    {
+        return (bits & (quiet_nan | sign_bit)) == (quiet_nan | sign_bit);
+    }
+
+    [[nodiscard]] constexpr auto as_bool() const noexcept -> Boolean
+    {
+        return bits == true_bits;
+    }
+
+    [[nodiscard]] constexpr auto as_number() const noexcept -> Number
+    {
+        return std::bit_cast<Number>(bits);
+    }
+
+    [[nodiscard]] auto as_obj() const noexcept -> Obj*
+    {
+        return reinterpret_cast<Obj*>(static_cast<std::uintptr_t>(bits & ~(sign_bit | quiet_nan)));
+    }
+
+    [[nodiscard]] auto operator==(const Value& other) const noexcept -> bool
+    {
+        if (is_number() && other.is_number())
+        {
+            return as_number() == other.as_number();
+        }
+
+        // Strings are interned, so every other kind compares by identity.
+        return bits == other.bits;
+    }
+
+private:
+    static constexpr std::uint64_t sign_bit = 0x8000000000000000;
+    static constexpr std::uint64_t quiet_nan = 0x7ffc000000000000;
+
+    static constexpr std::uint64_t nil_bits = quiet_nan | 1U;
+    static constexpr std::uint64_t false_bits = quiet_nan | 2U;
+    static constexpr std::uint64_t true_bits = quiet_nan | 3U;
+
+    std::uint64_t bits = nil_bits;
+};
+
+static_assert(sizeof(Value) == sizeof(std::uint64_t));
+
+#else
+
+class Value
+{
+public:
+    constexpr Value() noexcept = default;
+
+    template <typename T>
+        requires std::same_as<T, Nil> || std::same_as<T, Boolean> || std::same_as<T, Number> || std::same_as<T, Obj*>
+    constexpr explicit Value(T value) noexcept : data{ value }
+    {
+    }
+
+    [[nodiscard]] constexpr auto is_nil() const noexcept -> bool
+    {
+        return std::holds_alternative<Nil>(data);
+    }
+
+    [[nodiscard]] constexpr auto is_bool() const noexcept -> bool
+    {
+        return std::holds_alternative<Boolean>(data);
+    }
+
+    [[nodiscard]] constexpr auto is_number() const noexcept -> bool
+    {
+        return std::holds_alternative<Number>(data);
+    }
+
+    [[nodiscard]] constexpr auto is_obj() const noexcept -> bool
+    {
+        return std::holds_alternative<Obj*>(data);
+    }
+
+    [[nodiscard]] constexpr auto as_bool() const noexcept -> Boolean
+    {
+        return *std::get_if<Boolean>(&data);
+    }
+
+    [[nodiscard]] constexpr auto as_number() const noexcept -> Number
+    {
+        return *std::get_if<Number>(&data);
+    }
+
+    [[nodiscard]] constexpr auto as_obj() const noexcept -> Obj*
+    {
+        return *std::get_if<Obj*>(&data);
+    }
+
+    [[nodiscard]] constexpr auto operator==(const Value& other) const noexcept -> bool
+    {
+        return data == other.data;
+    }
+
+private:
+    std::variant<Nil, Boolean, Number, Obj*> data;
+};
+
+#endif
+
 using ValueArray = std::vector<Value>;
 
-namespace values
+auto operator<<(std::ostream& stream, const Value& value) -> std::ostream&;
+
+class Heap;
+
+// Why a native function rejected its arguments: the (0-based) argument and what it should have been.
+struct NativeError
 {
-    template <typename T, typename... Ts>
-    struct IsTypeInVariant;
+    std::size_t argument;
+    std::string_view expected;
+};
+
+using NativeResult = std::expected<Value, NativeError>;
+
+// A function implemented by the host. Its arguments are a view of the caller's stack, valid until the
+// function allocates; the heap is there for functions that build strings.
+using NativeFn = auto (*)(Heap& heap, std::span<const Value> arguments) -> NativeResult;
+
+// A native function as a value, registered with Vm::define_native. Like functions, it is old and its name
+// is an old string.
+class ObjNative : public Obj
+{
+public:
+    static constexpr auto object_type = ObjType::Native;
 
-    template <typename T, typename... Ts>
-    struct IsTypeInVariant<T, std::variant<Ts...>> : std::disjunction<std::is_same<T, Ts>...>
+    ObjNative(NativeFn function, std::optional<std::size_t> arity, ObjString* name)
+    : Obj{ object_type }, function{ function }, arity{ arity }, name{ name }
     {
-    };
+    }
+
+    NativeFn function;
+    // Nothing for a function taking any number of arguments.
+    std::optional<std::size_t> arity;
+    ObjString* name;
+};
+
+// A variable captured by closures. While the frame declaring it runs, the variable stays on the VM's
+// stack and the upvalue is open: it refers to the slot by index, since the stack may move when it
+// grows. Closing it, when the variable goes out of scope, moves the value into `closed`.
+class ObjUpvalue : public Obj
+{
+public:
+    static constexpr auto object_type = ObjType::Upvalue;
+    static constexpr auto closed_slot = std::numeric_limits<std::size_t>::max();
+
+    explicit ObjUpvalue(std::size_t slot) noexcept : Obj{ object_type }, slot{ slot }
+    {
+    }
+
+    [[nodiscard]] auto is_open() const noexcept -> bool
+    {
+        return slot != closed_slot;
+    }
+
+    std::size_t slot;
+    Value closed;
+    // The open upvalues form a list sorted by slot, highest first.
+    ObjUpvalue* next_open = nullptr;
+};
+
+// A function together with the variables it captured. Functions capturing nothing are called directly,
+// without one.
+class ObjClosure : public Obj
+{
+public:
+    static constexpr auto object_type = ObjType::Closure;
+
+    explicit ObjClosure(ObjFunction* function)
+    : Obj{ object_type }, function{ function }, upvalue_count{ function->function.get_captures().size() },
+      upvalues(upvalue_count, nullptr)
+    {
+    }
+
+    ObjFunction* function;
+    // Fixed at creation; kept apart from the vector so the heap can size the object without reaching into it.
+    std::size_t upvalue_count;
+    std::vector<ObjUpvalue*> upvalues;
+};
+
+namespace values
+{
+    template <typename T>
+    concept IsPrimitive = std::same_as<T, Nil> || std::same_as<T, Boolean> || std::same_as<T, Number>;
+
+    template <typename T>
+    concept IsObject = std::derived_from<T, Obj>;
 
     template <typename T>
-    concept IsInVariant = IsTypeInVariant<T, Value>::value;
+    concept IsValueType = IsPrimitive<T> || IsObject<T>;
 
     template <typename T>
-        requires IsInVariant<T>
+        requires IsValueType<T>
     static constexpr auto as(const Value& value)
     {
-        return std::get<T>(value);
+        if constexpr (std::is_same_v<T, Nil>)
+        {
+            return Nil{};
+        }
+        else if constexpr (std::is_same_v<T, Boolean>)
+        {
+            return value.as_bool();
+        }
+        else if constexpr (std::is_same_v<T, Number>)
+        {
+            return value.as_number();
+        }
+        else
+        {
+            return static_cast<T*>(value.as_obj());
+        }
     }
 
     template <typename T>
-        requires IsInVariant<T>
+        requires IsPrimitive<T>
     static constexpr auto make(const T& val) -> Value
     {
-        Value value = val;
-        return value;
+        return Value{ val };
+    }
+
+    template <typename T>
+        requires IsObject<T>
+    static constexpr auto make(T* obj) -> Value
+    {
+        return Value{ static_cast<Obj*>(obj) };
     }
 
     template <typename T>
-        requires IsInVariant<T>
+        requires IsValueType<T>
     static constexpr bool is(const Value& value)
     {
-        return std::get_if<T>(&value) != nullptr;
+        if constexpr (std::is_same_v<T, Nil>)
+        {
+            return value.is_nil();
+        }
+        else if constexpr (std::is_same_v<T, Boolean>)
+        {
+            return value.is_bool();
+        }
+        else if constexpr (std::is_same_v<T, Number>)
+        {
+            return value.is_number();
+        }
+        else
+        {
+            return value.is_obj() && value.as_obj()->type == T::object_type;
+        }
     }
 
-} // namespace values
\ No newline at end of file
+} // namespace values
@@ -2,16 +2,30 @@
 
 #include "Chunk.hpp"
 #include "Compiler.hpp"
+#include "Globals.hpp"
+#include "Memory.hpp"
+#include "Native.hpp"
+#include "Value.hpp"
 
+#include <algorithm>
 #include <array>
 #include <cstddef>
 #include <cstdint>
 #include <functional>
 #include <iostream>
-#include <map>
+#include <limits>
+#include <optional>
+#include <ranges>
+#include <span>
 #include <string>
+#include <string_view>
 #include <type_traits>
-#include <variant>
+#include <utility>
+#include <vector>
+
+#if defined(AXOLOTL_COMPUTED_GOTO) && defined(__GNUC__)
+#define AXOLOTL_THREADED_DISPATCH
+#endif
 
 enum class InterpretResult : std::uint8_t
 {
@@ -21,18 +35,71 @@ enum class InterpretResult : std::uint8_t
 };
 
 
-template <typename T, std::size_t Size>
+// Sizes of a Vm's value stack, in values.
+struct VmConfig
+{
+    // Allocated up front.
+    std::size_t initial_stack_size = 256;
+    // The stack grows up to this many; a program needing more fails with a runtime error. Equal to the
+    // initial size, the stack never reallocates.
+    std::size_t max_stack_size = 64 * 1024;
+    // Deepest nesting of function calls, counting the script.
+    std::size_t max_frames = 256;
+};
+
+// Pushes are not bounds checked: room for them is made with reserve, once for a whole run of code.
+template <typename T>
 class Stack
 {
 public:
+    Stack(std::size_t initial_size, std::size_t max_size) : data(initial_size), max_size{ max_size }
+    {
+    }
+
+    // Makes sure `count` more values fit above the top, growing the storage if allowed. Values are
+    // addressed by index, so only pointers and references into the stack taken before a call that
+    // grows it become stale.
+    [[nodiscard]] auto reserve(std::size_t count) -> bool
+    {
+        const auto needed = stack_top + count;
+        if (needed <= data.size())
+        {
+            return true;
+        }
+        if (needed > max_size)
+        {
+            return false;
+        }
+
+        data.resize(std::min(std::max(needed, 2 * data.size()), max_size));
+        return true;
+    }
+
     void push(const T& value)
     {
         data[stack_top++] = value;
     }
 
+    void push(T&& value)
+    {
+        data[stack_top++] = std::move(value);
+    }
+
     T pop()
     {
-        return data[--stack_top];
+        return std::move(data[--stack_top]);
+    }
+
+    // Drops the top value without handing it out.
+    void drop() noexcept
+    {
+        --stack_top;
+    }
+
+    // Drops everything from `index` up.
+    void truncate(std::size_t index) noexcept
+    {
+        stack_top = index;
     }
 
     void reset()
@@ -40,7 +107,12 @@ public:
         stack_top = 0;
     }
 
-    [[nodiscard]] auto at(std::size_t index) const noexcept -> T
+    [[nodiscard]] auto at(std::size_t index) const noexcept -> const T&
+    {
+        return data[index];
+    }
+
+    [[nodiscard]] auto at(std::size_t index) noexcept -> T&
     {
         return data[index];
     }
@@ -50,24 +122,109 @@ public:
         data[index] = value;
     }
 
+    auto set(std::size_t index, T&& value) -> void
+    {
+        data[index] = std::move(value);
+    }
+
     [[nodiscard]] auto top() const noexcept -> std::size_t
     {
         return stack_top;
     }
 
+    [[nodiscard]] auto live() noexcept -> std::span<T>
+    {
+        return { data.data(), stack_top };
+    }
+
 private:
-    std::array<T, Size> data{};
+    std::vector<T> data;
     std::size_t stack_top = 0;
+    std::size_t max_size;
+};
+
+// A running function. The innermost frame's ip is kept in Vm::ip, and only written back here when it calls
+// another function or a runtime error reports where each frame was.
+struct CallFrame
+{
+    // Nothing for the script.
+    const ObjFunction* function;
+    // Nothing unless the function captures variables.
+    ObjClosure* closure;
+    Chunk* chunk;
+    std::size_t ip;
+    // Where the frame's slot 0 is on the value stack: the callee, followed by the arguments and locals.
+    std::size_t base;
 };
 
 class Vm
 {
 public:
+    Vm() : Vm(VmConfig{})
+    {
+    }
+
+    explicit Vm(const VmConfig& config)
+    : roots{ heap.add_roots([this](Heap& gc) { mark_roots(gc); }) },
+      global_roots{ heap.add_roots([this](Heap& gc) { mark_globals(gc); }, RootKind::Barriered) },
+      stack{ config.initial_stack_size, std::max(config.initial_stack_size, config.max_stack_size) },
+      max_frames{ std::max<std::size_t>(config.max_frames, 1) }
+    {
+    }
+
+    [[nodiscard]] auto get_heap() noexcept -> Heap&
+    {
+        return heap;
+    }
+
+    [[nodiscard]] auto get_globals() noexcept -> Globals&
+    {
+        return globals;
+    }
+
+    // Makes a host function available to scripts as the global `name`, checking that calls pass `arity`
+    // arguments when given. Natives defined before a script is compiled are accessed by slot.
+    auto define_native(std::string_view name, NativeFn function, std::optional<std::size_t> arity = std::nullopt)
+    -> void
+    {
+        auto* native_name = heap.make_string(name);
+        const auto slot = globals.declare(native_name);
+        heap.write_barrier(values::make(native_name));
+        define_global(slot, values::make(heap.allocate<ObjNative>(function, arity, native_name)));
+    }
+
+    // Binds a C++ function by its signature, see natives::Binder.
+    template <auto F>
+    auto define_native(std::string_view name) -> void
+    {
+        define_native(name, &natives::Binder<F>::call, natives::Binder<F>::arity);
+    }
+
+    // Number of instructions dispatched so far; only maintained when built with AXOLOTL_COUNT_INSTRUCTIONS.
+    [[nodiscard]] auto get_instruction_count() const noexcept -> std::uint64_t
+    {
+        return instruction_count;
+    }
+
     [[nodiscard]] InterpretResult interpret(Chunk code)
     {
-        chunk = std::move(code);
+        script = std::move(code);
+        prepare(script);
+
+        // Every run starts from an empty stack; for register code, the register file is its bottom.
+        reset_stack();
+        chunk = &script;
+        closure = nullptr;
         ip = 0;
-        return run();
+        base = stack.top();
+        frames.push_back(CallFrame{ .function = nullptr, .closure = nullptr, .chunk = chunk, .ip = 0, .base = base });
+
+        if (!stack.reserve(script.stack_depth))
+        {
+            return runtime_error("Stack overflow.");
+        }
+
+        return script.get_engine() == Engine::Register ? run_registers() : run();
     }
 
     [[nodiscard]] InterpretResult interpret(Compiler& compiler)
@@ -78,265 +235,1290 @@ public:
             return InterpretResult::CompileError;
         }
 
-        chunk = compiled_chunk.value();
-        ip = 0;
-        return run();
+        return interpret(std::move(compiled_chunk).value());
     }
 
 private:
-    template <typename Func>
-    InterpretResult binary_op()
+    // The fused comparisons negate the plain ones instead of using >= and <=, so NaN operands
+    // behave exactly as they did with a separate Not.
+    struct not_less
     {
-        const auto lhs = stack.pop();
-        const auto rhs = stack.pop();
+        constexpr auto operator()(Number lhs, Number rhs) const noexcept -> bool
+        {
+            return !(lhs < rhs);
+        }
+    };
 
-        std::visit(
-        [&](const auto& lhs_val, const auto& rhs_val)
+    struct not_greater
+    {
+        constexpr auto operator()(Number lhs, Number rhs) const noexcept -> bool
         {
-            using LhsType = std::decay_t<decltype(lhs_val)>;
-            using RhsType = std::decay_t<decltype(rhs_val)>;
+            return !(lhs > rhs);
+        }
+    };
 
-            // Ensure the types are the same for the operation
-            if constexpr (std::is_same_v<LhsType, RhsType>)
-            {
-                if constexpr (std::is_same_v<LhsType, Number>)
-                {
-                    // Push the result of applying the function back onto the stack
-                    stack.push(Func{}(lhs_val, rhs_val));
-                }
-                else if constexpr (std::is_same_v<LhsType, String>)
-                {
-                    // Handle string concatenation
-                    stack.push(lhs_val + rhs_val);
-                }
-                else
-                {
-                    // Handle unsupported types
-                    throw std::runtime_error("Unsupported type for binary operation");
-                }
-            }
-            else
+    // Shared by both engines: applies Func to two operands, or reports a type mismatch and returns nothing.
+    template <typename Func>
+    [[nodiscard]] auto binary_value(const Value& lhs, const Value& rhs) -> std::optional<Value>
+    {
+        if (values::is<Number>(lhs) && values::is<Number>(rhs))
+        {
+            return values::make(Func{}(values::as<Number>(lhs), values::as<Number>(rhs)));
+        }
+
+        if constexpr (std::is_same_v<Func, std::plus<>>)
+        {
+            if (values::is<ObjString>(lhs) && values::is<ObjString>(rhs))
             {
-                // Handle type mismatch here
+                // Handle string concatenation
+                return values::make(
+                heap.concatenate(values::as<ObjString>(lhs)->view(), values::as<ObjString>(rhs)->view()));
             }
-        },
-        rhs, lhs);
+        }
+
+        if constexpr (std::is_same_v<Func, std::plus<>>)
+        {
+            runtime_error("Operands must be two numbers or two strings.");
+        }
+        else
+        {
+            runtime_error("Operands must be numbers.");
+        }
+        return std::nullopt;
+    }
+
+    // Generic arithmetic and comparisons. Having run on two numbers, the instruction quickens itself into
+    // `Quickened`, which skips the dispatch on operand types. The operands are read where they are and stay
+    // on the stack, and so rooted, until the result replaces them.
+    template <typename Func, OpCode Quickened>
+    InterpretResult binary_op()
+    {
+        const auto& rhs = peek(0);
+        const auto& lhs = peek(1);
 
+        if (values::is<Number>(lhs) && values::is<Number>(rhs))
+        {
+            rewrite(ip - 1, Quickened);
+            replace_top(2, values::make(Func{}(values::as<Number>(lhs), values::as<Number>(rhs))));
+            return InterpretResult::Ok;
+        }
+
+        auto result = binary_value<Func>(lhs, rhs);
+        if (!result)
+        {
+            return InterpretResult::RuntimeError;
+        }
+
+        replace_top(2, std::move(*result));
         return InterpretResult::Ok;
     }
 
+    // The guard of the quickened forms: when an operand is not a number after all, the instruction turns
+    // back into `Generic` and runs again as that.
+    template <typename Func, OpCode Generic>
+    auto number_op() -> void
+    {
+        const auto& rhs = peek(0);
+        const auto& lhs = peek(1);
+        if (!values::is<Number>(lhs) || !values::is<Number>(rhs)) [[unlikely]]
+        {
+            deoptimize(ip - 1, Generic);
+            return;
+        }
+
+        replace_top(2, values::make(Func{}(values::as<Number>(lhs), values::as<Number>(rhs))));
+    }
+
+    // AddLocalConst and IncrLocal, which quicken once the local and the constant were both numbers.
+    // Their operands have been read, so the instruction starts three bytes back.
+    auto add_local_const(std::size_t slot, const Value& constant, OpCode quickened) -> std::optional<Value>
+    {
+        const auto& local = stack.at(slot);
+        if (values::is<Number>(local) && values::is<Number>(constant))
+        {
+            rewrite(ip - 3, quickened);
+        }
+        return binary_value<std::plus<>>(local, constant);
+    }
+
+    // Instructions are only rewritten into forms of the same size, so offsets and jumps stay valid.
+    auto rewrite(std::size_t offset, OpCode op) noexcept -> void
+    {
+        chunk->data[offset] = static_cast<std::byte>(op);
+    }
+
+    auto deoptimize(std::size_t offset, OpCode generic) noexcept -> void
+    {
+        rewrite(offset, generic);
+        ip = offset;
+    }
+
+
+#if defined(AXOLOTL_COUNT_INSTRUCTIONS)
+#define VM_COUNT_INSTRUCTION() instruction_count++
+#else
+#define VM_COUNT_INSTRUCTION()
+#endif
+
+// With labels-as-values every handler ends in its own indirect jump to the next one,
+// which gives the branch predictor one site per opcode instead of a single shared switch.
+#if defined(AXOLOTL_THREADED_DISPATCH)
+#define VM_DISPATCH                                                                                                    \
+    VM_COUNT_INSTRUCTION();                                                                                            \
+    goto* dispatch_table[static_cast<std::size_t>(VM_FETCH())];
+#define VM_CASE(name) op_##name:
+#define VM_NEXT VM_DISPATCH
+#else
+#define VM_DISPATCH                                                                                                    \
+    VM_COUNT_INSTRUCTION();                                                                                            \
+    switch (VM_FETCH())
+#define VM_CASE(name) case Op::name:
+#define VM_NEXT continue
+#endif
+
+// Each engine defines VM_FETCH to decode its next opcode and names its opcode enum Op.
+#define VM_FETCH() read_byte_as<OpCode>()
 
     [[nodiscard]] InterpretResult run()
     {
+        using Op = OpCode;
+
+#if defined(AXOLOTL_THREADED_DISPATCH)
+        // Must list every OpCode, in declaration order.
+        static constexpr std::array<void*, opcode_count> dispatch_table{
+            &&op_Constant,
+            &&op_Nil,
+            &&op_True,
+            &&op_False,
+            &&op_Pop,
+            &&op_GetLocal,
+            &&op_Setlocal,
+            &&op_GetGlobal,
+            &&op_DefineGlobal,
+            &&op_SetGlobal,
+            &&op_Equal,
+            &&op_Greater,
+            &&op_Less,
+            &&op_Add,
+            &&op_Subtract,
+            &&op_Mutliply,
+            &&op_Divide,
+            &&op_Not,
+            &&op_Negate,
+            &&op_Print,
+            &&op_Jump,
+            &&op_JumpIfFalse,
+            &&op_Loop,
+            &&op_GetGlobalSlot,
+            &&op_SetGlobalSlot,
+            &&op_DefineGlobalSlot,
+            &&op_ConstantLong,
+            &&op_GetGlobalLong,
+            &&op_DefineGlobalLong,
+            &&op_SetGlobalLong,
+            &&op_GetGlobalSlotLong,
+            &&op_SetGlobalSlotLong,
+            &&op_DefineGlobalSlotLong,
+            &&op_NotEqual,
+            &&op_GreaterEqual,
+            &&op_LessEqual,
+            &&op_JumpIfFalsePop,
+            &&op_AddLocalConst,
+            &&op_IncrLocal,
+            &&op_JumpIfTruePop,
+            &&op_Call,
+            &&op_TailCall,
+            &&op_GetUpvalue,
+            &&op_SetUpvalue,
+            &&op_CloseUpvalue,
+            &&op_Closure,
+            &&op_ClosureLong,
+            &&op_AddNumber,
+            &&op_SubtractNumber,
+            &&op_MultiplyNumber,
+            &&op_DivideNumber,
+            &&op_GreaterNumber,
+            &&op_LessNumber,
+            &&op_GreaterEqualNumber,
+            &&op_LessEqualNumber,
+            &&op_AddLocalConstNumber,
+            &&op_IncrLocalNumber,
+            &&op_Return,
+        };
+#endif
+
         for (;;)
         {
-            const auto instruction = read_byte_as<OpCode>();
-            switch (instruction)
+            VM_DISPATCH
             {
-            case OpCode::Print:
+            VM_CASE(Print)
             {
-                std::visit(
-                []<typename value_t>(const value_t& value)
-                {
-                    if constexpr (std::is_same_v<value_t, Function>)
-                    {
-                        std::cout << "<Fn " << value.get_name() << '>';
-                    }
-                    else
-                    {
-                        std::cout << value << '\n';
-                    }
-                },
-                stack.pop());
-                break;
+                std::cout << stack.pop() << '\n';
+                VM_NEXT;
             }
-            case OpCode::Loop:
+            VM_CASE(Loop)
             {
                 const auto offset = read_short();
                 ip -= offset;
-                break;
+                heap.safepoint();
+                VM_NEXT;
             }
-            case OpCode::Return:
+            VM_CASE(Return)
             {
-                return InterpretResult::Ok;
+                if (frames.size() == 1)
+                {
+                    return InterpretResult::Ok;
+                }
+
+                auto result = stack.pop();
+                close_upvalues(base);
+                stack.truncate(base);
+                frames.pop_back();
+                const auto& caller = frames.back();
+                chunk = caller.chunk;
+                closure = caller.closure;
+                ip = caller.ip;
+                base = caller.base;
+                stack.push(std::move(result));
+                VM_NEXT;
             }
-            case OpCode::Jump:
+            VM_CASE(Jump)
             {
                 const auto offset = read_short();
                 ip += offset;
-                break;
+                VM_NEXT;
             }
-            case OpCode::JumpIfFalse:
+            VM_CASE(JumpIfFalse)
             {
                 const auto offset = read_short();
                 if (is_falsey(peek(0)))
                 {
                     ip += offset;
                 }
-                break;
+                VM_NEXT;
+            }
+            VM_CASE(Negate)
+            {
+                if (!values::is<Number>(peek(0)))
+                {
+                    return runtime_error("Operand must be a number.");
+                }
+                replace_top(1, values::make(-values::as<Number>(peek(0))));
+                VM_NEXT;
             }
-            case OpCode::Negate:
+            VM_CASE(Add)
             {
-                if (values::is<Number>(peek(0)))
+                if (binary_op<std::plus<>, Op::AddNumber>() != InterpretResult::Ok)
                 {
-                    // TODO: implement
-                    // runtime_error("Operand must be a number.");
                     return InterpretResult::RuntimeError;
                 }
-                stack.push(values::make(-values::as<Number>(stack.pop())));
-                break;
+                VM_NEXT;
             }
-            case OpCode::Add:
+            VM_CASE(Subtract)
             {
-                binary_op<std::plus<>>();
-                break;
+                if (binary_op<std::minus<>, Op::SubtractNumber>() != InterpretResult::Ok)
+                {
+                    return InterpretResult::RuntimeError;
+                }
+                VM_NEXT;
             }
-            case OpCode::Subtract:
+            VM_CASE(Mutliply)
             {
-                binary_op<std::minus<>>();
-                break;
+                if (binary_op<std::multiplies<>, Op::MultiplyNumber>() != InterpretResult::Ok)
+                {
+                    return InterpretResult::RuntimeError;
+                }
+                VM_NEXT;
             }
-            case OpCode::Mutliply:
+            VM_CASE(Divide)
             {
-                binary_op<std::multiplies<>>();
-                break;
+                if (binary_op<std::divides<>, Op::DivideNumber>() != InterpretResult::Ok)
+                {
+                    return InterpretResult::RuntimeError;
+                }
+                VM_NEXT;
             }
-            case OpCode::Divide:
+            VM_CASE(Not)
             {
-                binary_op<std::divides<>>();
-                break;
+                replace_top(1, values::make(is_falsey(peek(0))));
+                VM_NEXT;
             }
-            case OpCode::Not:
+            VM_CASE(Constant)
             {
-                stack.push(is_falsey(stack.pop()));
-                break;
+                stack.push(chunk->constants[read_byte_as<std::uint8_t>()]);
+                VM_NEXT;
             }
-            case OpCode::Constant:
+            VM_CASE(ConstantLong)
             {
-                const auto constant = chunk.constants[read_byte_as<std::uint8_t>()];
-                stack.push(constant);
-                break;
+                stack.push(chunk->constants[read_long()]);
+                VM_NEXT;
             }
-            case OpCode::Nil:
+            VM_CASE(Nil)
             {
-                stack.push(values::make(double{ 0 }));
-                break;
+                stack.push(values::make(Nil{}));
+                VM_NEXT;
             }
-            case OpCode::True:
+            VM_CASE(True)
             {
                 stack.push(values::make(true));
-                break;
+                VM_NEXT;
             }
-            case OpCode::False:
+            VM_CASE(False)
             {
                 stack.push(values::make(false));
-                break;
+                VM_NEXT;
             }
-            case OpCode::Pop:
+            VM_CASE(Pop)
             {
-                stack.pop();
-                break;
+                stack.drop();
+                VM_NEXT;
             }
-            case OpCode::GetLocal:
+            VM_CASE(GetLocal)
             {
-                const auto slot = read_byte_as<std::uint8_t>();
+                const auto slot = base + read_byte_as<std::size_t>();
                 stack.push(stack.at(slot));
-                break;
+                VM_NEXT;
             }
-            case OpCode::Setlocal:
+            VM_CASE(Setlocal)
             {
-                const auto slot = read_byte_as<std::uint8_t>();
+                const auto slot = base + read_byte_as<std::size_t>();
                 stack.set(slot, peek(0));
-                break;
+                VM_NEXT;
+            }
+            VM_CASE(GetUpvalue)
+            {
+                const auto* upvalue = closure->upvalues[read_byte_as<std::size_t>()];
+                stack.push(upvalue->is_open() ? stack.at(upvalue->slot) : upvalue->closed);
+                VM_NEXT;
             }
-            case OpCode::GetGlobal:
+            VM_CASE(SetUpvalue)
             {
-                const auto constant = chunk.constants[read_byte_as<std::uint8_t>()];
-                const auto name = std::get<String>(constant);
-                if (!globals.contains(name))
+                auto* upvalue = closure->upvalues[read_byte_as<std::size_t>()];
+                if (upvalue->is_open())
+                {
+                    stack.set(upvalue->slot, peek(0));
+                }
+                else
+                {
+                    upvalue->closed = peek(0);
+                    heap.object_write_barrier(upvalue, upvalue->closed);
+                }
+                VM_NEXT;
+            }
+            VM_CASE(CloseUpvalue)
+            {
+                close_upvalues(stack.top() - 1);
+                stack.drop();
+                VM_NEXT;
+            }
+            VM_CASE(Closure)
+            {
+                make_closure(read_byte_as<std::uint8_t>());
+                VM_NEXT;
+            }
+            VM_CASE(ClosureLong)
+            {
+                make_closure(read_long());
+                VM_NEXT;
+            }
+            VM_CASE(GetGlobal)
+            {
+                if (push_global(read_byte_as<std::uint8_t>()) != InterpretResult::Ok)
                 {
-                    // TODO: implement
-                    //  runtime error => Undefined variable ''.
                     return InterpretResult::RuntimeError;
                 }
-
-                stack.push(globals[name]);
-                break;
+                VM_NEXT;
+            }
+            VM_CASE(GetGlobalLong)
+            {
+                if (push_global(read_long()) != InterpretResult::Ok)
+                {
+                    return InterpretResult::RuntimeError;
+                }
+                VM_NEXT;
+            }
+            VM_CASE(DefineGlobal)
+            {
+                define_global(values::as<ObjString>(chunk->constants[read_byte_as<std::uint8_t>()]), stack.pop());
+                VM_NEXT;
+            }
+            VM_CASE(DefineGlobalLong)
+            {
+                define_global(values::as<ObjString>(chunk->constants[read_long()]), stack.pop());
+                VM_NEXT;
+            }
+            VM_CASE(SetGlobal)
+            {
+                if (set_named_global(read_byte_as<std::uint8_t>(), peek(0)) != InterpretResult::Ok)
+                {
+                    return InterpretResult::RuntimeError;
+                }
+                VM_NEXT;
+            }
+            VM_CASE(SetGlobalLong)
+            {
+                if (set_named_global(read_long(), peek(0)) != InterpretResult::Ok)
+                {
+                    return InterpretResult::RuntimeError;
+                }
+                VM_NEXT;
+            }
+            VM_CASE(GetGlobalSlot)
+            {
+                stack.push(globals[read_byte_as<std::uint8_t>()]);
+                VM_NEXT;
+            }
+            VM_CASE(GetGlobalSlotLong)
+            {
+                stack.push(globals[read_short()]);
+                VM_NEXT;
+            }
+            VM_CASE(SetGlobalSlot)
+            {
+                set_global(read_byte_as<std::uint8_t>(), peek(0));
+                VM_NEXT;
+            }
+            VM_CASE(SetGlobalSlotLong)
+            {
+                set_global(read_short(), peek(0));
+                VM_NEXT;
+            }
+            VM_CASE(DefineGlobalSlot)
+            {
+                define_global(read_byte_as<std::uint8_t>(), stack.pop());
+                VM_NEXT;
+            }
+            VM_CASE(DefineGlobalSlotLong)
+            {
+                define_global(read_short(), stack.pop());
+                VM_NEXT;
+            }
+            VM_CASE(Equal)
+            {
+                replace_top(2, values::make(peek(1) == peek(0)));
+                VM_NEXT;
+            }
+            VM_CASE(Greater)
+            {
+                if (binary_op<std::greater<>, Op::GreaterNumber>() != InterpretResult::Ok)
+                {
+                    return InterpretResult::RuntimeError;
+                }
+                VM_NEXT;
+            }
+            VM_CASE(Less)
+            {
+                if (binary_op<std::less<>, Op::LessNumber>() != InterpretResult::Ok)
+                {
+                    return InterpretResult::RuntimeError;
+                }
+                VM_NEXT;
+            }
+            VM_CASE(NotEqual)
+            {
+                replace_top(2, values::make(!(peek(1) == peek(0))));
+                VM_NEXT;
+            }
+            VM_CASE(GreaterEqual)
+            {
+                if (binary_op<not_less, Op::GreaterEqualNumber>() != InterpretResult::Ok)
+                {
+                    return InterpretResult::RuntimeError;
+                }
+                VM_NEXT;
+            }
+            VM_CASE(LessEqual)
+            {
+                if (binary_op<not_greater, Op::LessEqualNumber>() != InterpretResult::Ok)
+                {
+                    return InterpretResult::RuntimeError;
+                }
+                VM_NEXT;
+            }
+            VM_CASE(JumpIfFalsePop)
+            {
+                const auto offset = read_short();
+                if (is_falsey(stack.pop()))
+                {
+                    ip += offset;
+                }
+                VM_NEXT;
+            }
+            VM_CASE(JumpIfTruePop)
+            {
+                const auto offset = read_short();
+                if (!is_falsey(stack.pop()))
+                {
+                    ip += offset;
+                }
+                VM_NEXT;
+            }
+            VM_CASE(Call)
+            {
+                if (!call(read_byte_as<std::size_t>()))
+                {
+                    return InterpretResult::RuntimeError;
+                }
+                VM_NEXT;
+            }
+            VM_CASE(TailCall)
+            {
+                if (!tail_call(read_byte_as<std::size_t>()))
+                {
+                    return InterpretResult::RuntimeError;
+                }
+                VM_NEXT;
             }
-            case OpCode::DefineGlobal:
+            VM_CASE(AddLocalConst)
             {
-                const auto constant = chunk.constants[read_byte_as<std::uint8_t>()];
-                const auto name = std::get<String>(constant);
-                globals[name] = stack.pop();
-                break;
+                const auto slot = base + read_byte_as<std::size_t>();
+                const auto& constant = chunk->constants[read_byte_as<std::uint8_t>()];
+                auto result = add_local_const(slot, constant, Op::AddLocalConstNumber);
+                if (!result)
+                {
+                    return InterpretResult::RuntimeError;
+                }
+                stack.push(std::move(*result));
+                VM_NEXT;
             }
-            case OpCode::SetGlobal:
+            VM_CASE(IncrLocal)
             {
-                const auto constant = chunk.constants[read_byte_as<std::uint8_t>()];
-                const auto name = std::get<String>(constant);
-                if (!globals.contains(name))
+                const auto slot = base + read_byte_as<std::size_t>();
+                const auto& constant = chunk->constants[read_byte_as<std::uint8_t>()];
+                auto result = add_local_const(slot, constant, Op::IncrLocalNumber);
+                if (!result)
                 {
-                    // TODO: handle error
                     return InterpretResult::RuntimeError;
                 }
-                globals[name] = peek(0);
-                break;
+                stack.set(slot, std::move(*result));
+                VM_NEXT;
+            }
+            VM_CASE(AddNumber)
+            {
+                number_op<std::plus<>, Op::Add>();
+                VM_NEXT;
             }
-            case OpCode::Equal:
+            VM_CASE(SubtractNumber)
             {
-                const auto b = stack.pop();
-                const auto a = stack.pop();
-                stack.push(a == b);
-                break;
+                number_op<std::minus<>, Op::Subtract>();
+                VM_NEXT;
             }
-            case OpCode::Greater:
+            VM_CASE(MultiplyNumber)
             {
-                binary_op<std::greater<>>();
-                break;
+                number_op<std::multiplies<>, Op::Mutliply>();
+                VM_NEXT;
             }
-            case OpCode::Less:
+            VM_CASE(DivideNumber)
             {
-                binary_op<std::less<>>();
-                break;
+                number_op<std::divides<>, Op::Divide>();
+                VM_NEXT;
+            }
+            VM_CASE(GreaterNumber)
+            {
+                number_op<std::greater<>, Op::Greater>();
+                VM_NEXT;
+            }
+            VM_CASE(LessNumber)
+            {
+                number_op<std::less<>, Op::Less>();
+                VM_NEXT;
+            }
+            VM_CASE(GreaterEqualNumber)
+            {
+                number_op<not_less, Op::GreaterEqual>();
+                VM_NEXT;
+            }
+            VM_CASE(LessEqualNumber)
+            {
+                number_op<not_greater, Op::LessEqual>();
+                VM_NEXT;
+            }
+            // The constant was a number when these were quickened and cannot change; only the local is checked.
+            VM_CASE(AddLocalConstNumber)
+            {
+                const auto slot = base + read_byte_as<std::size_t>();
+                const auto constant = read_byte_as<std::uint8_t>();
+                const auto& local = stack.at(slot);
+                if (!values::is<Number>(local)) [[unlikely]]
+                {
+                    deoptimize(ip - 3, Op::AddLocalConst);
+                    VM_NEXT;
+                }
+                stack.push(values::make(values::as<Number>(local) + values::as<Number>(chunk->constants[constant])));
+                VM_NEXT;
+            }
+            VM_CASE(IncrLocalNumber)
+            {
+                const auto slot = base + read_byte_as<std::size_t>();
+                const auto constant = read_byte_as<std::uint8_t>();
+                const auto& local = stack.at(slot);
+                if (!values::is<Number>(local)) [[unlikely]]
+                {
+                    deoptimize(ip - 3, Op::IncrLocal);
+                    VM_NEXT;
+                }
+                const auto sum = values::as<Number>(local) + values::as<Number>(chunk->constants[constant]);
+                stack.set(slot, values::make(sum));
+                VM_NEXT;
             }
             }
         }
     }
 
+#undef VM_FETCH
+#define VM_FETCH() registers::opcode(instruction = read_word())
+
+    [[nodiscard]] InterpretResult run_registers()
+    {
+#if defined(AXOLOTL_THREADED_DISPATCH)
+        // Must list every RegOp, in declaration order.
+        static constexpr std::array<void*, register_opcode_count> dispatch_table{
+            &&op_LoadConstant,
+            &&op_LoadNil,
+            &&op_LoadTrue,
+            &&op_LoadFalse,
+            &&op_Move,
+            &&op_GetGlobal,
+            &&op_DefineGlobal,
+            &&op_SetGlobal,
+            &&op_GetGlobalSlot,
+            &&op_DefineGlobalSlot,
+            &&op_SetGlobalSlot,
+            &&op_Equal,
+            &&op_Greater,
+            &&op_Less,
+            &&op_Add,
+            &&op_Subtract,
+            &&op_Multiply,
+            &&op_Divide,
+            &&op_Not,
+            &&op_Negate,
+            &&op_Print,
+            &&op_Jump,
+            &&op_JumpIfFalse,
+            &&op_JumpIfTrue,
+            &&op_Loop,
+            &&op_Return,
+        };
+#else
+        // Only VM_CASE names opcodes here, and only the switch form of it uses the enum.
+        using Op = RegOp;
+#endif
+
+        // The register file is the bottom of the value stack, so the collector already scans it.
+        for (std::size_t i = 0; i < chunk->get_register_count(); i++)
+        {
+            stack.push(values::make(Nil{}));
+        }
+
+        Value* const frame = stack.live().data();
+        const Value* const constants = chunk->constants.data();
+        std::uint32_t instruction = 0;
+
+        const auto rk = [&](std::uint8_t operand) -> const Value&
+        {
+            return registers::is_constant(operand) ? constants[operand - registers::constant_flag] : frame[operand];
+        };
+
+        const auto jump = [&]
+        {
+            ip += static_cast<std::ptrdiff_t>(registers::arg_sbx(instruction))
+                  * static_cast<std::ptrdiff_t>(registers::instruction_size);
+        };
+
+        for (;;)
+        {
+            VM_DISPATCH
+            {
+            VM_CASE(LoadConstant)
+            {
+                frame[registers::arg_a(instruction)] = constants[registers::arg_bx(instruction)];
+                VM_NEXT;
+            }
+            VM_CASE(LoadNil)
+            {
+                frame[registers::arg_a(instruction)] = values::make(Nil{});
+                VM_NEXT;
+            }
+            VM_CASE(LoadTrue)
+            {
+                frame[registers::arg_a(instruction)] = values::make(true);
+                VM_NEXT;
+            }
+            VM_CASE(LoadFalse)
+            {
+                frame[registers::arg_a(instruction)] = values::make(false);
+                VM_NEXT;
+            }
+            VM_CASE(Move)
+            {
+                frame[registers::arg_a(instruction)] = frame[registers::arg_b(instruction)];
+                VM_NEXT;
+            }
+            VM_CASE(GetGlobal)
+            {
+                const auto constant = registers::arg_bx(instruction);
+                const auto slot = cached_global(constant);
+                if (!slot)
+                {
+                    return undefined_variable(values::as<ObjString>(constants[constant]));
+                }
+                frame[registers::arg_a(instruction)] = globals[*slot];
+                VM_NEXT;
+            }
+            VM_CASE(DefineGlobal)
+            {
+                define_global(values::as<ObjString>(constants[registers::arg_bx(instruction)]),
+                              frame[registers::arg_a(instruction)]);
+                VM_NEXT;
+            }
+            VM_CASE(SetGlobal)
+            {
+                if (set_named_global(registers::arg_bx(instruction), frame[registers::arg_a(instruction)])
+                    != InterpretResult::Ok)
+                {
+                    return InterpretResult::RuntimeError;
+                }
+                VM_NEXT;
+            }
+            VM_CASE(GetGlobalSlot)
+            {
+                frame[registers::arg_a(instruction)] = globals[registers::arg_bx(instruction)];
+                VM_NEXT;
+            }
+            VM_CASE(DefineGlobalSlot)
+            {
+                define_global(registers::arg_bx(instruction), frame[registers::arg_a(instruction)]);
+                VM_NEXT;
+            }
+            VM_CASE(SetGlobalSlot)
+            {
+                set_global(registers::arg_bx(instruction), frame[registers::arg_a(instruction)]);
+                VM_NEXT;
+            }
+            VM_CASE(Equal)
+            {
+                const auto equal = rk(registers::arg_b(instruction)) == rk(registers::arg_c(instruction));
+                frame[registers::arg_a(instruction)] = values::make(equal);
+                VM_NEXT;
+            }
+            VM_CASE(Greater)
+            {
+                if (!register_binary_op<std::greater<>>(frame, rk, instruction))
+                {
+                    return InterpretResult::RuntimeError;
+                }
+                VM_NEXT;
+            }
+            VM_CASE(Less)
+            {
+                if (!register_binary_op<std::less<>>(frame, rk, instruction))
+                {
+                    return InterpretResult::RuntimeError;
+                }
+                VM_NEXT;
+            }
+            VM_CASE(Add)
+            {
+                if (!register_binary_op<std::plus<>>(frame, rk, instruction))
+                {
+                    return InterpretResult::RuntimeError;
+                }
+                VM_NEXT;
+            }
+            VM_CASE(Subtract)
+            {
+                if (!register_binary_op<std::minus<>>(frame, rk, instruction))
+                {
+                    return InterpretResult::RuntimeError;
+                }
+                VM_NEXT;
+            }
+            VM_CASE(Multiply)
+            {
+                if (!register_binary_op<std::multiplies<>>(frame, rk, instruction))
+                {
+                    return InterpretResult::RuntimeError;
+                }
+                VM_NEXT;
+            }
+            VM_CASE(Divide)
+            {
+                if (!register_binary_op<std::divides<>>(frame, rk, instruction))
+                {
+                    return InterpretResult::RuntimeError;
+                }
+                VM_NEXT;
+            }
+            VM_CASE(Not)
+            {
+                frame[registers::arg_a(instruction)] = values::make(is_falsey(rk(registers::arg_b(instruction))));
+                VM_NEXT;
+            }
+            VM_CASE(Negate)
+            {
+                const auto& operand = rk(registers::arg_b(instruction));
+                if (!values::is<Number>(operand))
+                {
+                    return runtime_error("Operand must be a number.");
+                }
+                frame[registers::arg_a(instruction)] = values::make(-values::as<Number>(operand));
+                VM_NEXT;
+            }
+            VM_CASE(Print)
+            {
+                std::cout << rk(registers::arg_b(instruction)) << '\n';
+                VM_NEXT;
+            }
+            VM_CASE(Jump)
+            {
+                jump();
+                VM_NEXT;
+            }
+            VM_CASE(JumpIfFalse)
+            {
+                if (is_falsey(frame[registers::arg_a(instruction)]))
+                {
+                    jump();
+                }
+                VM_NEXT;
+            }
+            VM_CASE(JumpIfTrue)
+            {
+                if (!is_falsey(frame[registers::arg_a(instruction)]))
+                {
+                    jump();
+                }
+                VM_NEXT;
+            }
+            VM_CASE(Loop)
+            {
+                jump();
+                heap.safepoint();
+                VM_NEXT;
+            }
+            VM_CASE(Return)
+            {
+                return InterpretResult::Ok;
+            }
+            }
+        }
+    }
+
+#undef VM_FETCH
+#undef VM_DISPATCH
+#undef VM_CASE
+#undef VM_NEXT
+#undef VM_COUNT_INSTRUCTION
+
     template <typename T = std::byte>
     [[nodiscard]] constexpr auto read_byte_as() noexcept -> T
     {
-        return static_cast<T>(chunk.data[ip++]);
+        return static_cast<T>(chunk->data[ip++]);
+    }
+
+    [[nodiscard]] auto read_word() noexcept -> std::uint32_t
+    {
+        const auto word = chunk->word_at(ip);
+        ip += registers::instruction_size;
+        return word;
+    }
+
+    template <typename Func, typename Rk>
+    [[nodiscard]] auto register_binary_op(Value* frame, const Rk& rk, std::uint32_t instruction) -> bool
+    {
+        auto result = binary_value<Func>(rk(registers::arg_b(instruction)), rk(registers::arg_c(instruction)));
+        if (!result)
+        {
+            return false;
+        }
+
+        frame[registers::arg_a(instruction)] = std::move(*result);
+        return true;
     }
 
     [[nodiscard]] constexpr auto read_short() noexcept -> std::uint16_t
     {
         ip += 2;
-        return static_cast<std::uint16_t>((chunk.data[ip - 2] << 8) | chunk.data[ip - 1]);
+        return static_cast<std::uint16_t>((static_cast<std::uint16_t>(chunk->data[ip - 2]) << 8)
+                                          | static_cast<std::uint16_t>(chunk->data[ip - 1]));
+    }
+
+    // The 24-bit operand of the long constant forms.
+    [[nodiscard]] constexpr auto read_long() noexcept -> std::uint32_t
+    {
+        ip += 3;
+        return (static_cast<std::uint32_t>(chunk->data[ip - 3]) << 16)
+               | (static_cast<std::uint32_t>(chunk->data[ip - 2]) << 8)
+               | static_cast<std::uint32_t>(chunk->data[ip - 1]);
+    }
+
+
+    // `offset` values below the top; 0 is the top itself.
+    [[nodiscard]] auto peek(std::size_t offset) const noexcept -> const Value&
+    {
+        return stack.at(stack.top() - offset - 1);
     }
 
+    // Pops `count` values and pushes `value` in their place, as a single store.
+    auto replace_top(std::size_t count, Value&& value) -> void
+    {
+        stack.set(stack.top() - count, std::move(value));
+        for (std::size_t i = 1; i < count; i++)
+        {
+            stack.drop();
+        }
+    }
 
-    auto peek(int offset) -> Value
+    // Sets up the run-time state of a chunk, and of the functions among its constants, before it runs.
+    auto prepare(Chunk& code) -> void
     {
-        return stack.at(stack.top() + offset - 1);
+        code.global_cache.assign(code.constants.size(), unresolved_global);
+        code.stack_depth = code.max_stack_depth();
+        for (const auto& constant : code.constants)
+        {
+            if (values::is<ObjFunction>(constant))
+            {
+                prepare(values::as<ObjFunction>(constant)->function.chunk());
+            }
+        }
     }
 
+    // The function below the top `argument_count` values, if it can be called with that many arguments.
+    [[nodiscard]] auto callee(std::size_t argument_count) -> const ObjFunction*
+    {
+        const auto& value = peek(argument_count);
+        const ObjFunction* function = nullptr;
+        if (values::is<ObjFunction>(value))
+        {
+            function = values::as<ObjFunction>(value);
+        }
+        else if (values::is<ObjClosure>(value))
+        {
+            function = values::as<ObjClosure>(value)->function;
+        }
+        else
+        {
+            runtime_error("Can only call functions.");
+            return nullptr;
+        }
+
+        if (argument_count != function->function.get_arity())
+        {
+            runtime_error("Expected ", function->function.get_arity(), " arguments but got ", argument_count, ".");
+            return nullptr;
+        }
+        return function;
+    }
+
+    // Starts running the function below the top `argument_count` values. The callee and its arguments
+    // stay where they are and become the first slots of the new frame.
+    [[nodiscard]] auto call(std::size_t argument_count) -> bool
+    {
+        if (values::is<ObjNative>(peek(argument_count)))
+        {
+            return call_native(argument_count);
+        }
+
+        const auto* function = callee(argument_count);
+        if (function == nullptr)
+        {
+            return false;
+        }
+
+        auto& code = function->function.chunk();
+        if (frames.size() == max_frames || !stack.reserve(code.stack_depth))
+        {
+            runtime_error("Stack overflow.");
+            return false;
+        }
+
+        frames.back().ip = ip;
+        chunk = &code;
+        ip = 0;
+        base = stack.top() - argument_count - 1;
+        closure = closure_of(stack.at(base));
+        frames.push_back(CallFrame{ .function = function, .closure = closure, .chunk = chunk, .ip = ip, .base = base });
+        return true;
+    }
+
+    // Like call, but the callee takes over the running frame: it and its arguments move down over the
+    // frame's slots, and what it returns goes straight to the caller.
+    [[nodiscard]] auto tail_call(std::size_t argument_count) -> bool
+    {
+        // A native needs no frame: the Return after the call hands its result on.
+        if (values::is<ObjNative>(peek(argument_count)))
+        {
+            return call_native(argument_count);
+        }
+
+        const auto* function = callee(argument_count);
+        if (function == nullptr)
+        {
+            return false;
+        }
+
+        // The frame's variables die here, before the callee and its arguments overwrite them.
+        close_upvalues(base);
+        const auto first = stack.top() - argument_count - 1;
+        for (std::size_t i = 0; i <= argument_count; i++)
+        {
+            stack.set(base + i, std::move(stack.at(first + i)));
+        }
+        stack.truncate(base + argument_count + 1);
+
+        auto& code = function->function.chunk();
+        if (!stack.reserve(code.stack_depth))
+        {
+            runtime_error("Stack overflow.");
+            return false;
+        }
+
+        chunk = &code;
+        ip = 0;
+        closure = closure_of(stack.at(base));
+        frames.back() = CallFrame{ .function = function, .closure = closure, .chunk = chunk, .ip = ip, .base = base };
+        return true;
+    }
+
+    [[nodiscard]] static auto closure_of(const Value& callee) -> ObjClosure*
+    {
+        return values::is<ObjClosure>(callee) ? values::as<ObjClosure>(callee) : nullptr;
+    }
+
+    // Pushes a closure over the function in `constant`. The closure is on the stack, out of the collector's
+    // reach, before its upvalues are allocated.
+    auto make_closure(std::size_t constant) -> void
+    {
+        auto* function = values::as<ObjFunction>(chunk->constants[constant]);
+        auto* created = heap.allocate<ObjClosure>(function);
+        stack.push(values::make(created));
+
+        const auto& captures = function->function.get_captures();
+        for (std::size_t i = 0; i < captures.size(); i++)
+        {
+            created->upvalues[i] = captures[i].is_local ? capture_upvalue(base + captures[i].index)
+                                                        : closure->upvalues[captures[i].index];
+            heap.write_barrier(values::make(created->upvalues[i]));
+        }
+    }
+
+    // The upvalue for a stack slot, shared by every closure capturing the variable there. The open list is
+    // sorted by slot, highest first: looking a slot up stops at the running frame's variables, and closing
+    // the variables of a scope or frame takes them off its front.
+    [[nodiscard]] auto capture_upvalue(std::size_t slot) -> ObjUpvalue*
+    {
+        ObjUpvalue* previous = nullptr;
+        auto* upvalue = open_upvalues;
+        while (upvalue != nullptr && upvalue->slot > slot)
+        {
+            previous = upvalue;
+            upvalue = upvalue->next_open;
+        }
+
+        if (upvalue != nullptr && upvalue->slot == slot)
+        {
+            return upvalue;
+        }
+
+        auto* created = heap.allocate<ObjUpvalue>(slot);
+        created->next_open = upvalue;
+        (previous == nullptr ? open_upvalues : previous->next_open) = created;
+        return created;
+    }
+
+    // Closes the open upvalues of every slot from `first` up, moving the variables off the stack.
+    auto close_upvalues(std::size_t first) -> void
+    {
+        while (open_upvalues != nullptr && open_upvalues->slot >= first)
+        {
+            auto* upvalue = open_upvalues;
+            upvalue->closed = stack.at(upvalue->slot);
+            upvalue->slot = ObjUpvalue::closed_slot;
+            open_upvalues = std::exchange(upvalue->next_open, nullptr);
+            heap.object_write_barrier(upvalue, upvalue->closed);
+        }
+    }
+
+    // Native functions run without a frame. They read their arguments where they are on the stack, and
+    // their result replaces the arguments and the callee.
+    [[nodiscard]] auto call_native(std::size_t argument_count) -> bool
+    {
+        const auto* native = values::as<ObjNative>(peek(argument_count));
+        if (native->arity && argument_count != *native->arity)
+        {
+            runtime_error("Expected ", *native->arity, " arguments but got ", argument_count, ".");
+            return false;
+        }
+
+        const auto arguments = std::span<const Value>{ stack.live() }.last(argument_count);
+        auto result = native->function(heap, arguments);
+        if (!result)
+        {
+            runtime_error("Expected ", result.error().expected, " as argument ", result.error().argument + 1, " to ",
+                          native->name->view(), "().");
+            return false;
+        }
+
+        replace_top(argument_count + 1, std::move(*result));
+        return true;
+    }
+
+    // Closures outliving the failed run keep the values of the variables they captured.
     void reset_stack()
     {
+        close_upvalues(0);
         stack.reset();
+        frames.clear();
+    }
+
+    auto mark_roots(Heap& gc) -> void
+    {
+        for (auto& value : stack.live())
+        {
+            gc.mark_slot(value);
+        }
+        for (auto* upvalue = open_upvalues; upvalue != nullptr; upvalue = upvalue->next_open)
+        {
+            gc.mark_object(upvalue);
+        }
+
+        // Functions being run are reachable from their frame's slot 0; the script only from here.
+        for (const auto& constant : script.get_constants())
+        {
+            gc.mark_value(constant);
+        }
+    }
+
+    auto mark_globals(Heap& gc) -> void
+    {
+        for (std::size_t slot = 0; slot < globals.size(); slot++)
+        {
+            gc.mark_object(globals.name(slot));
+            gc.mark_slot(globals[slot]);
+        }
+    }
+
+    // Late-bound lookup for globals the compiler could not resolve to a slot.
+    [[nodiscard]] auto bound_global(ObjString* name) const -> std::optional<std::size_t>
+    {
+        const auto slot = globals.find(name);
+        if (!slot || !globals.is_defined(*slot))
+        {
+            return std::nullopt;
+        }
+        return slot;
+    }
+
+    auto define_global(std::size_t slot, const Value& value) -> void
+    {
+        globals.define(slot, value);
+        heap.write_barrier(value);
+    }
+
+    auto define_global(ObjString* name, const Value& value) -> void
+    {
+        define_global(globals.declare(name), value);
+        heap.write_barrier(values::make(name));
+    }
+
+    auto set_global(std::size_t slot, const Value& value) -> void
+    {
+        globals[slot] = value;
+        heap.write_barrier(value);
+    }
+
+    // Inline cache in front of bound_global, with an entry per constant naming a global, which every
+    // instruction naming it shares. A defined global keeps its slot and never becomes undefined again, so
+    // a hit needs no further check. Misses are not cached: the global may be defined by the next try.
+    [[nodiscard]] auto cached_global(std::size_t constant) -> std::optional<std::size_t>
+    {
+        auto& cached = chunk->global_cache[constant];
+        if (cached != unresolved_global) [[likely]]
+        {
+            return cached;
+        }
+
+        const auto slot = bound_global(values::as<ObjString>(chunk->constants[constant]));
+        if (slot)
+        {
+            cached = *slot;
+        }
+        return slot;
+    }
+
+    // The late-bound accesses, by the constant holding the name; shared by the short and long operand forms.
+    auto push_global(std::size_t constant) -> InterpretResult
+    {
+        const auto slot = cached_global(constant);
+        if (!slot)
+        {
+            return undefined_variable(values::as<ObjString>(chunk->constants[constant]));
+        }
+        stack.push(globals[*slot]);
+        return InterpretResult::Ok;
+    }
+
+    auto set_named_global(std::size_t constant, const Value& value) -> InterpretResult
+    {
+        const auto slot = cached_global(constant);
+        if (!slot)
+        {
+            return undefined_variable(values::as<ObjString>(chunk->constants[constant]));
+        }
+        set_global(*slot, value);
+        return InterpretResult::Ok;
+    }
+
+    auto undefined_variable(const ObjString* name) -> InterpretResult
+    {
+        return runtime_error("Undefined variable '", name->view(), "'.");
+    }
+
+    template <typename... Message>
+    auto runtime_error(const Message&... message) -> InterpretResult
+    {
+        (std::cerr << ... << message) << '\n';
+
+        frames.back().ip = ip;
+        for (const auto& frame : std::views::reverse(frames))
+        {
+            // A frame that has not run yet reports the line of its first instruction.
+            std::cerr << "[line " << frame.chunk->get_line(std::max<std::size_t>(frame.ip, 1) - 1) << "] in ";
+            if (frame.function == nullptr)
+            {
+                std::cerr << "script\n";
+            }
+            else
+            {
+                std::cerr << frame.function->function.get_name() << "()\n";
+            }
+        }
+        reset_stack();
+        return InterpretResult::RuntimeError;
     }
 
 
     static auto is_falsey(const Value& value) -> bool
     {
-        return (values::is<Number>(value) && values::as<Number>(value) == 0.) ||
-        (values::is<Boolean>(value) && !values::as<Boolean>(value));
+        return values::is<Nil>(value) || (values::is<Boolean>(value) && !values::as<Boolean>(value));
     }
 
-    static constexpr auto stack_size = 256U;
+    static constexpr auto unresolved_global = std::numeric_limits<std::size_t>::max();
 
-    Chunk chunk;
+    Heap heap;
+    Heap::Roots roots;
+    Heap::Roots global_roots;
+    // The chunk interpret was given, and the state of the innermost frame.
+    Chunk script;
+    Chunk* chunk = &script;
+    ObjClosure* closure = nullptr;
     std::size_t ip = 0;
-    Stack<Value, stack_size> stack;
-    std::map<std::string, Value> globals;
+    std::size_t base = 0;
+    Stack<Value> stack;
+    std::vector<CallFrame> frames;
+    ObjUpvalue* open_upvalues = nullptr;
+    std::size_t max_frames;
+    std::uint64_t instruction_count = 0;
+    Globals globals;
 };
\ No newline at end of file
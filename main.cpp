@@ -3,6 +3,7 @@
 #include "include/Debug.hpp"
 #include "include/Vm.hpp"
 
+#include <algorithm>
 #include <string_view>
 #include <vector>
 
@@ -35,6 +36,14 @@ int main(int argc, char** argv)
 {
     const auto args = std::vector<std::string_view>{ argv, argv + argc };
 
+    const auto engine = std::ranges::find(args, "--register") != args.end() ? Engine::Register : Engine::Stack;
+    const auto has_flag = [&args](std::string_view flag) { return std::ranges::find(args, flag) != args.end(); };
+    const auto optimization = has_flag("--ast")        ? Optimization::Ast
+                              : has_flag("--optimize") ? Optimization::Peephole
+                                                       : Optimization::None;
+
+    Vm vm;
+
     const auto chunk = Compiler{ R"===(for(var i = 0; i < 10; i=i+1)
 {
     print i;
@@ -45,12 +54,13 @@ while(b < 4)
     print b;
     b = b + 1;
 }
-        )===" }
-                       .compile()
+        )===",
+                                 vm.get_heap(),
+                                 vm.get_globals() }
+                       .compile(engine, optimization)
                        .value();
 
 
-    Vm vm;
     const auto result = vm.interpret(chunk);
 
     if (result != InterpretResult::Ok)
@@ -1,56 +1,48 @@
 #include "Value.hpp"
 #include "Chunk.hpp"
 #include <memory>
+#include <ostream>
 
-Function::Function() : chunk_ptr{ std::make_unique<Chunk>() }
+Function::Function() : chunk_ptr{ std::make_shared<Chunk>() }
 {
 }
 
-Function::~Function() = default;
-
-
-Function::Function(const Function& other)
-: arity(other.arity), chunk_ptr{ other.chunk_ptr ? std::make_unique<Chunk>(*other.chunk_ptr) : nullptr }, name{ other.name }
+[[nodiscard]] auto Function::chunk() const noexcept -> class Chunk&
 {
+    return *chunk_ptr;
 }
 
-Function& Function::operator=(const Function& other)
+auto operator<<(std::ostream& stream, const Value& value) -> std::ostream&
 {
-    if (this != &other)
+    if (values::is<Number>(value))
     {
-        arity = other.arity;
-        name = other.name;
-        chunk_ptr = other.chunk_ptr ? std::make_unique<Chunk>(*other.chunk_ptr) : nullptr;
+        return stream << values::as<Number>(value);
     }
-    return *this;
-}
 
-Function::Function(Function&& other) noexcept
-: chunk_ptr{ std::move(other.chunk_ptr) }, name{ std::move(other.name) }, arity{ other.arity }
-{
-    other.arity = 0;
-}
+    if (values::is<Boolean>(value))
+    {
+        return stream << (values::as<Boolean>(value) ? "true" : "false");
+    }
 
-Function& Function::operator=(Function&& other) noexcept
-{
-    if (this != &other)
+    if (values::is<ObjString>(value))
     {
-        chunk_ptr = std::move(other.chunk_ptr);
-        name = std::move(other.name);
-        arity = other.arity;
+        return stream << values::as<ObjString>(value)->view();
+    }
 
-        other.arity = 0;
+    if (values::is<ObjFunction>(value))
+    {
+        return stream << "<fn " << values::as<ObjFunction>(value)->function.get_name() << '>';
     }
-    return *this;
-}
 
-bool Function::operator==(const Function& other) const
-{
-    return name == other.name;
-}
+    if (values::is<ObjClosure>(value))
+    {
+        return stream << "<fn " << values::as<ObjClosure>(value)->function->function.get_name() << '>';
+    }
 
+    if (values::is<ObjNative>(value))
+    {
+        return stream << "<native fn " << values::as<ObjNative>(value)->name->view() << '>';
+    }
 
-[[nodiscard]] auto Function::chunk() const noexcept -> class Chunk&
-{
-    return *chunk_ptr;
+    return stream << "nil";
 }
\ No newline at end of file
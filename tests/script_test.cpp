@@ -0,0 +1,354 @@
+#include "Compiler.hpp"
+#include "Native.hpp"
+#include "Vm.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <optional>
+#include <ranges>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+
+// Runs one script under one engine, optimization level and collector setting, and checks what it prints
+// against the expectations written in its comments:
+//
+//     print 1 + 2; // expect: 3
+//     print -"a";  // expect runtime error: Operand must be a number.
+//
+// `expect compile error: <text>` requires compilation to fail with an error line ending in <text>. A script
+// may restrict where it runs with `engines: stack register` and `optimizations: none peephole ast`; other
+// combinations exit with skipped_exit_code. `repeat: <n>` runs the compiled chunk n times on the same VM, each
+// run having to meet the same expectations, and `max stack: <n>` limits the VM's stack to n values.
+// `expect constants: <n>` checks the size of the compiled script's constant pool, and `expect dead statements: <n>`
+// how many statements the tree passes dropped as unreachable, under `ast` only.
+//
+//     usage: axolotl_script_test <script> <stack|register> <none|peephole|ast> <default|incremental|old-only>
+namespace
+{
+    constexpr auto skipped_exit_code = 77;
+
+    struct Expectations
+    {
+        std::vector<std::string> output;
+        std::optional<std::string> runtime_error;
+        std::optional<std::string> compile_error;
+        std::vector<std::string> engines;
+        std::vector<std::string> optimizations;
+        std::size_t repeat = 1;
+        std::optional<std::size_t> max_stack;
+        std::optional<std::size_t> constants;
+        std::optional<std::size_t> dead_statements;
+    };
+
+    auto split_lines(const std::string& text) -> std::vector<std::string>
+    {
+        auto lines = std::vector<std::string>{};
+        auto stream = std::istringstream{ text };
+        for (auto line = std::string{}; std::getline(stream, line);)
+        {
+            lines.push_back(line);
+        }
+        return lines;
+    }
+
+    auto split_words(std::string_view text) -> std::vector<std::string>
+    {
+        auto words = std::vector<std::string>{};
+        for (const auto word : std::views::split(text, ' '))
+        {
+            if (!word.empty())
+            {
+                words.emplace_back(word.begin(), word.end());
+            }
+        }
+        return words;
+    }
+
+    auto parse_expectations(const std::string& source) -> Expectations
+    {
+        auto expectations = Expectations{};
+        for (const auto& line : split_lines(source))
+        {
+            const auto comment = line.find("// ");
+            if (comment == std::string::npos)
+            {
+                continue;
+            }
+
+            const auto directive = std::string_view{ line }.substr(comment + 3);
+            const auto argument = [&directive](std::string_view prefix) -> std::optional<std::string_view>
+            {
+                if (!directive.starts_with(prefix))
+                {
+                    return std::nullopt;
+                }
+                return directive.substr(prefix.size());
+            };
+
+            if (const auto text = argument("expect: "))
+            {
+                expectations.output.emplace_back(*text);
+            }
+            else if (const auto message = argument("expect runtime error: "))
+            {
+                expectations.runtime_error = std::string{ *message };
+            }
+            else if (const auto message = argument("expect compile error: "))
+            {
+                expectations.compile_error = std::string{ *message };
+            }
+            else if (const auto names = argument("engines: "))
+            {
+                expectations.engines = split_words(*names);
+            }
+            else if (const auto names = argument("optimizations: "))
+            {
+                expectations.optimizations = split_words(*names);
+            }
+            else if (const auto count = argument("repeat: "))
+            {
+                expectations.repeat = std::stoul(std::string{ *count });
+            }
+            else if (const auto size = argument("max stack: "))
+            {
+                expectations.max_stack = std::stoul(std::string{ *size });
+            }
+            else if (const auto count = argument("expect constants: "))
+            {
+                expectations.constants = std::stoul(std::string{ *count });
+            }
+            else if (const auto count = argument("expect dead statements: "))
+            {
+                expectations.dead_statements = std::stoul(std::string{ *count });
+            }
+        }
+        return expectations;
+    }
+
+    auto gc_config(std::string_view mode) -> std::optional<GcConfig>
+    {
+        // Thresholds small enough that even the short scripts collect many times.
+        if (mode == "default")
+        {
+            return GcConfig{};
+        }
+        if (mode == "incremental")
+        {
+            return GcConfig{ .initial_threshold = 64, .nursery_size = 512, .incremental = true,
+                             .max_pause = std::chrono::microseconds{ 0 } };
+        }
+        if (mode == "old-only")
+        {
+            return GcConfig{ .initial_threshold = 64, .nursery_size = 0 };
+        }
+        return std::nullopt;
+    }
+
+    // The natives the scripts under natives/ call.
+    auto hypot(Number x, Number y) noexcept -> Number
+    {
+        return std::sqrt(x * x + y * y);
+    }
+
+    auto join(Heap& heap, const ObjString* lhs, const ObjString* rhs) -> ObjString*
+    {
+        return heap.concatenate(lhs->view(), rhs->view());
+    }
+
+    auto negate(Boolean value) noexcept -> Boolean
+    {
+        return !value;
+    }
+
+    auto identity(Value value) noexcept -> Value
+    {
+        return value;
+    }
+
+    auto nothing() noexcept -> void
+    {
+    }
+
+    auto sum([[maybe_unused]] Heap& heap, std::span<const Value> arguments) -> NativeResult
+    {
+        auto total = Number{ 0 };
+        for (auto index = std::size_t{ 0 }; index < arguments.size(); index++)
+        {
+            if (!values::is<Number>(arguments[index]))
+            {
+                return std::unexpected{ NativeError{ .argument = index, .expected = "a number" } };
+            }
+            total += values::as<Number>(arguments[index]);
+        }
+        return values::make(total);
+    }
+
+    auto define_natives(Vm& vm) -> void
+    {
+        vm.define_native<&hypot>("hypot");
+        vm.define_native<&join>("join");
+        vm.define_native<&negate>("neg");
+        vm.define_native<&identity>("ident");
+        vm.define_native<&nothing>("nothing");
+        vm.define_native("sum", &sum);
+    }
+
+    auto allows(const std::vector<std::string>& names, std::string_view name) -> bool
+    {
+        return names.empty() || std::ranges::find(names, name) != names.end();
+    }
+
+    // Runs `body` with std::cout and std::cerr going to the given strings.
+    template <typename Body>
+    auto capture(std::string& out, std::string& err, Body&& body)
+    {
+        auto out_stream = std::ostringstream{};
+        auto err_stream = std::ostringstream{};
+        auto* const out_buffer = std::cout.rdbuf(out_stream.rdbuf());
+        auto* const err_buffer = std::cerr.rdbuf(err_stream.rdbuf());
+        const auto result = body();
+        std::cout.rdbuf(out_buffer);
+        std::cerr.rdbuf(err_buffer);
+        out = out_stream.str();
+        err = err_stream.str();
+        return result;
+    }
+
+    auto report(std::string_view what, const std::string& out, const std::string& err) -> int
+    {
+        std::cerr << what << "\n--- stdout\n" << out << "--- stderr\n" << err;
+        return EXIT_FAILURE;
+    }
+
+    auto check_run(const Expectations& expectations, InterpretResult result, const std::string& out,
+                   const std::string& err) -> int
+    {
+        if (split_lines(out) != expectations.output)
+        {
+            std::cerr << "expected output:\n";
+            for (const auto& line : expectations.output)
+            {
+                std::cerr << line << '\n';
+            }
+            return report("unexpected output", out, err);
+        }
+
+        if (expectations.runtime_error)
+        {
+            if (result != InterpretResult::RuntimeError)
+            {
+                return report("expected a runtime error", out, err);
+            }
+            const auto lines = split_lines(err);
+            if (lines.empty() || lines.front() != *expectations.runtime_error)
+            {
+                return report("expected runtime error: " + *expectations.runtime_error, out, err);
+            }
+        }
+        else if (result != InterpretResult::Ok)
+        {
+            return report("unexpected runtime error", out, err);
+        }
+        return EXIT_SUCCESS;
+    }
+} // namespace
+
+int main(int argc, char** argv)
+{
+    const auto args = std::vector<std::string_view>{ argv, argv + argc };
+    if (args.size() != 5)
+    {
+        std::cerr << "usage: " << args.front() << " <script> <stack|register> <none|peephole|ast> <gc mode>\n";
+        return EXIT_FAILURE;
+    }
+
+    const auto engine_name = args[2];
+    const auto optimization_name = args[3];
+    const auto engine = engine_name == "register" ? Engine::Register : Engine::Stack;
+    const auto optimization = optimization_name == "ast"        ? Optimization::Ast
+                              : optimization_name == "peephole" ? Optimization::Peephole
+                                                                : Optimization::None;
+    const auto config = gc_config(args[4]);
+    if (!config)
+    {
+        std::cerr << "unknown gc mode " << args[4] << '\n';
+        return EXIT_FAILURE;
+    }
+
+    auto file = std::ifstream{ std::string{ args[1] } };
+    if (!file)
+    {
+        std::cerr << "can't open " << args[1] << '\n';
+        return EXIT_FAILURE;
+    }
+    auto buffer = std::ostringstream{};
+    buffer << file.rdbuf();
+    const auto source = buffer.str();
+
+    const auto expectations = parse_expectations(source);
+    if (!allows(expectations.engines, engine_name) || !allows(expectations.optimizations, optimization_name))
+    {
+        return skipped_exit_code;
+    }
+
+    auto vm_config = VmConfig{};
+    if (expectations.max_stack)
+    {
+        vm_config.initial_stack_size = std::min(vm_config.initial_stack_size, *expectations.max_stack);
+        vm_config.max_stack_size = *expectations.max_stack;
+    }
+
+    Vm vm{ vm_config };
+    vm.get_heap().set_config(*config);
+    define_natives(vm);
+
+    auto out = std::string{};
+    auto err = std::string{};
+    auto compiler = Compiler{ source, vm.get_heap(), vm.get_globals() };
+    const auto chunk = capture(out, err, [&] { return compiler.compile(engine, optimization); });
+
+    if (expectations.compile_error)
+    {
+        const auto lines = split_lines(out);
+        const auto reported = std::ranges::any_of(lines, [&](const std::string& line)
+                                                  { return line.ends_with(*expectations.compile_error); });
+        if (chunk || !reported)
+        {
+            return report("expected compile error: " + *expectations.compile_error, out, err);
+        }
+        return EXIT_SUCCESS;
+    }
+    if (!chunk)
+    {
+        return report("unexpected compile error", out, err);
+    }
+    if (expectations.constants && chunk->get_constants().size() != *expectations.constants)
+    {
+        return report("expected " + std::to_string(*expectations.constants) + " constants, got "
+                      + std::to_string(chunk->get_constants().size()), out, err);
+    }
+    const auto dead_statements = compiler.get_ast_stats().dead_statements_removed;
+    if (expectations.dead_statements && optimization == Optimization::Ast
+        && dead_statements != *expectations.dead_statements)
+    {
+        return report("expected " + std::to_string(*expectations.dead_statements) + " dead statements, got "
+                      + std::to_string(dead_statements), out, err);
+    }
+
+    for (auto run = std::size_t{ 0 }; run < expectations.repeat; run++)
+    {
+        const auto result = capture(out, err, [&] { return vm.interpret(*chunk); });
+        if (const auto status = check_run(expectations, result, out, err); status != EXIT_SUCCESS)
+        {
+            std::cerr << "in run " << run + 1 << " of " << expectations.repeat << '\n';
+            return status;
+        }
+    }
+    return EXIT_SUCCESS;
+}